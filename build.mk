@@ -18,3 +18,17 @@ ifeq ($(REV_ID),)
   endif
 endif
 VERSION_CFLAGS=-DCOMMIT_ID=\"$(REV_ID)\"
+
+# Names resolved by the socks5 core go through src/hev-resolver.c, and its
+# datagrams to remote hosts through src/hev-socks5-session.c. Both files
+# refuse to build without these.
+RESOLVER_CFLAGS=-Dhev_task_dns_getaddrinfo=hev_resolver_getaddrinfo \
+		-Dhev_task_io_socket_sendto=hev_socks5_session_sendto
+
+# The socks5 core frees its objects through src/hev-socks5-session.c, which
+# keeps finished sessions for their worker to reuse.
+OBJECT_CFLAGS=-Dhev_free=hev_socks5_session_free
+
+# Users the socks5 core authenticates are looked up by
+# src/hev-socks5-session.c, in the table reloads publish.
+AUTH_CFLAGS=-Dhev_socks5_authenticator_get=hev_socks5_session_get_user
@@ -0,0 +1,459 @@
+/*
+ ============================================================================
+ Name        : hev-auth-db.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Compiled Auth Database
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-auth-db.h"
+
+/*
+ * Image layout, native byte order:
+ *
+ *   HevAuthDbHead
+ *   uint32_t seeds[buckets]
+ *   HevAuthDbRecord records[count], in hash slot order
+ *   char strings[strings], names, passwords and options back to back
+ *
+ * A name hashes to a bucket, and the bucket seed places it into a slot of
+ * its own (hash and displace). The table has exactly one slot per user.
+ */
+
+#define AUTH_DB_MAGIC (0x42444148)
+#define AUTH_DB_VERSION (2)
+#define AUTH_DB_BUCKET_SIZE (4)
+#define AUTH_DB_MAX_SEED (1 << 24)
+
+typedef struct _HevAuthDbHead HevAuthDbHead;
+typedef struct _HevAuthDbRecord HevAuthDbRecord;
+
+struct _HevAuthDbHead
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t buckets;
+    uint64_t strings;
+};
+
+struct _HevAuthDbRecord
+{
+    uint32_t name_off;
+    uint32_t pass_off;
+    uint32_t opts_off;
+    uint16_t name_len;
+    uint16_t pass_len;
+    uint16_t opts_len;
+    uint16_t reserved;
+    uint32_t mark;
+};
+
+static uint64_t
+hash_mix (uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static uint64_t
+hash_name (const char *name, unsigned int len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return hash_mix (h);
+}
+
+static unsigned int
+hash_bucket (uint64_t h, unsigned int buckets)
+{
+    return (h >> 32) % buckets;
+}
+
+static unsigned int
+hash_slot (uint64_t h, uint32_t seed, unsigned int count)
+{
+    return hash_mix (h ^ (seed * 0x9e3779b97f4a7c15ULL)) % count;
+}
+
+int
+hev_auth_db_probe (const void *data, size_t size)
+{
+    const HevAuthDbHead *head = data;
+
+    if (size < sizeof (HevAuthDbHead))
+        return 0;
+
+    return head->magic == AUTH_DB_MAGIC;
+}
+
+int
+hev_auth_db_init (HevAuthDb *self, const void *data, size_t size)
+{
+    const HevAuthDbHead *head = data;
+    const HevAuthDbRecord *records;
+    uint64_t need;
+    unsigned int i;
+
+    if (size < sizeof (HevAuthDbHead))
+        return -1;
+    if (head->magic != AUTH_DB_MAGIC || head->version != AUTH_DB_VERSION)
+        return -1;
+    if (head->count && !head->buckets)
+        return -1;
+
+    need = sizeof (HevAuthDbHead);
+    need += (uint64_t)head->buckets * sizeof (uint32_t);
+    need += (uint64_t)head->count * sizeof (HevAuthDbRecord);
+    need += head->strings;
+    if (need != size)
+        return -1;
+
+    self->count = head->count;
+    self->buckets = head->buckets;
+    self->seeds = (const uint32_t *)(head + 1);
+    self->records = self->seeds + head->buckets;
+    self->strings = (const char *)self->records;
+    self->strings += head->count * sizeof (HevAuthDbRecord);
+
+    records = self->records;
+    for (i = 0; i < head->count; i++) {
+        const HevAuthDbRecord *r = &records[i];
+
+        if (((uint64_t)r->name_off + r->name_len) > head->strings ||
+            ((uint64_t)r->pass_off + r->pass_len) > head->strings ||
+            ((uint64_t)r->opts_off + r->opts_len) > head->strings)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+hev_auth_db_find (HevAuthDb *self, const char *name, unsigned int name_len)
+{
+    const HevAuthDbRecord *r;
+    unsigned int slot;
+    uint32_t seed;
+    uint64_t h;
+
+    if (!self->count)
+        return -1;
+
+    h = hash_name (name, name_len);
+    seed = self->seeds[hash_bucket (h, self->buckets)];
+    if (!seed)
+        return -1;
+
+    slot = hash_slot (h, seed, self->count);
+    r = (const HevAuthDbRecord *)self->records + slot;
+    if (r->name_len != name_len)
+        return -1;
+    if (memcmp (self->strings + r->name_off, name, name_len) != 0)
+        return -1;
+
+    return slot;
+}
+
+void
+hev_auth_db_get (HevAuthDb *self, unsigned int index, HevAuthDbEntry *entry)
+{
+    const HevAuthDbRecord *r;
+
+    r = (const HevAuthDbRecord *)self->records + index;
+    entry->name = self->strings + r->name_off;
+    entry->name_len = r->name_len;
+    entry->pass = self->strings + r->pass_off;
+    entry->pass_len = r->pass_len;
+    entry->opts = self->strings + r->opts_off;
+    entry->opts_len = r->opts_len;
+    entry->mark = r->mark;
+}
+
+static unsigned int
+hev_auth_db_dedup (const HevAuthDbEntry *entries, unsigned int *order,
+                   unsigned int *offs, unsigned int buckets)
+{
+    unsigned int count = 0;
+    unsigned int b;
+
+    for (b = 0; b < buckets; b++) {
+        unsigned int s = offs[b];
+        unsigned int e = offs[b + 1];
+        unsigned int i;
+
+        /* The order is stable, so the first line of a name wins. */
+        offs[b] = count;
+        for (i = s; i < e; i++) {
+            const HevAuthDbEntry *x = &entries[order[i]];
+            unsigned int j;
+
+            for (j = offs[b]; j < count; j++) {
+                const HevAuthDbEntry *y = &entries[order[j]];
+
+                if (x->name_len == y->name_len &&
+                    memcmp (x->name, y->name, x->name_len) == 0)
+                    break;
+            }
+
+            if (j < count) {
+                LOG_E ("auth db user conflict");
+                continue;
+            }
+
+            order[count++] = order[i];
+        }
+    }
+    offs[buckets] = count;
+
+    return count;
+}
+
+static int
+hev_auth_db_place (uint64_t *hashes, unsigned int *order, unsigned int *offs,
+                   unsigned int buckets, unsigned int count, uint32_t *seeds,
+                   unsigned int *slots)
+{
+    unsigned int *sorted;
+    unsigned int *sizes;
+    unsigned char *used;
+    unsigned int max = 0;
+    unsigned int b;
+    unsigned int i;
+    int res = -1;
+
+    sorted = hev_malloc (sizeof (unsigned int) * buckets);
+    used = hev_malloc0 (count);
+    sizes = NULL;
+    if (!sorted || !used)
+        goto exit;
+
+    for (b = 0; b < buckets; b++)
+        if ((offs[b + 1] - offs[b]) > max)
+            max = offs[b + 1] - offs[b];
+
+    /* Largest buckets first, while the table is still empty. */
+    sizes = hev_malloc0 (sizeof (unsigned int) * (max + 2));
+    if (!sizes)
+        goto exit;
+    for (b = 0; b < buckets; b++)
+        sizes[max - (offs[b + 1] - offs[b]) + 1]++;
+    for (i = 1; i <= max + 1; i++)
+        sizes[i] += sizes[i - 1];
+    for (b = 0; b < buckets; b++)
+        sorted[sizes[max - (offs[b + 1] - offs[b])]++] = b;
+
+    for (i = 0; i < buckets; i++) {
+        unsigned int s, e, k;
+        uint32_t seed;
+
+        b = sorted[i];
+        s = offs[b];
+        e = offs[b + 1];
+        seeds[b] = 0;
+        if (s == e)
+            continue;
+
+        for (seed = 1; seed < AUTH_DB_MAX_SEED; seed++) {
+            for (k = s; k < e; k++) {
+                unsigned int slot;
+
+                slot = hash_slot (hashes[order[k]], seed, count);
+                if (used[slot])
+                    break;
+                used[slot] = 1;
+                slots[order[k]] = slot;
+            }
+
+            if (k == e)
+                break;
+
+            while (k-- > s)
+                used[slots[order[k]]] = 0;
+        }
+
+        if (seed == AUTH_DB_MAX_SEED) {
+            LOG_E ("auth db perfect hash");
+            goto exit;
+        }
+
+        seeds[b] = seed;
+    }
+
+    res = 0;
+exit:
+    hev_free (sizes);
+    hev_free (sorted);
+    hev_free (used);
+    return res;
+}
+
+static int
+hev_auth_db_dump (FILE *fp, const HevAuthDbEntry *entries,
+                  const unsigned int *by_slot, const uint32_t *seeds,
+                  unsigned int buckets, unsigned int count)
+{
+    HevAuthDbRecord *records;
+    HevAuthDbHead head;
+    uint64_t offset = 0;
+    unsigned int i;
+    int res = -1;
+
+    records = hev_malloc (sizeof (HevAuthDbRecord) * count + 1);
+    if (!records)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        const HevAuthDbEntry *x = &entries[by_slot[i]];
+        HevAuthDbRecord *r = &records[i];
+
+        r->name_off = offset;
+        r->name_len = x->name_len;
+        offset += x->name_len;
+        r->pass_off = offset;
+        r->pass_len = x->pass_len;
+        offset += x->pass_len;
+        r->opts_off = offset;
+        r->opts_len = x->opts_len;
+        offset += x->opts_len;
+        r->reserved = 0;
+        r->mark = x->mark;
+    }
+
+    if (offset > UINT32_MAX) {
+        LOG_E ("auth db strings too large");
+        goto exit;
+    }
+
+    head.magic = AUTH_DB_MAGIC;
+    head.version = AUTH_DB_VERSION;
+    head.count = count;
+    head.buckets = buckets;
+    head.strings = offset;
+
+    if (fwrite (&head, sizeof (head), 1, fp) != 1)
+        goto exit;
+    if (fwrite (seeds, sizeof (uint32_t), buckets, fp) != buckets)
+        goto exit;
+    if (fwrite (records, sizeof (HevAuthDbRecord), count, fp) != count)
+        goto exit;
+
+    for (i = 0; i < count; i++) {
+        const HevAuthDbEntry *x = &entries[by_slot[i]];
+
+        if (fwrite (x->name, 1, x->name_len, fp) != x->name_len)
+            goto exit;
+        if (fwrite (x->pass, 1, x->pass_len, fp) != x->pass_len)
+            goto exit;
+        if (fwrite (x->opts, 1, x->opts_len, fp) != x->opts_len)
+            goto exit;
+    }
+
+    res = 0;
+exit:
+    hev_free (records);
+    return res;
+}
+
+int
+hev_auth_db_write (const char *path, const HevAuthDbEntry *entries,
+                   unsigned int num)
+{
+    unsigned int *by_slot = NULL;
+    unsigned int *order = NULL;
+    unsigned int *slots = NULL;
+    unsigned int *offs = NULL;
+    uint64_t *hashes = NULL;
+    uint32_t *seeds = NULL;
+    unsigned int buckets;
+    unsigned int count;
+    unsigned int i;
+    char tmp[1024];
+    int res = -1;
+    FILE *fp;
+
+    buckets = num / AUTH_DB_BUCKET_SIZE + 1;
+
+    hashes = hev_malloc (sizeof (uint64_t) * num + 1);
+    order = hev_malloc (sizeof (unsigned int) * num + 1);
+    slots = hev_malloc (sizeof (unsigned int) * num + 1);
+    by_slot = hev_malloc (sizeof (unsigned int) * num + 1);
+    offs = hev_malloc0 (sizeof (unsigned int) * (buckets + 1));
+    seeds = hev_malloc0 (sizeof (uint32_t) * buckets);
+    if (!hashes || !order || !slots || !by_slot || !offs || !seeds) {
+        LOG_E ("auth db alloc");
+        goto exit;
+    }
+
+    /* Group entries by bucket, keeping the input order inside each. */
+    for (i = 0; i < num; i++) {
+        hashes[i] = hash_name (entries[i].name, entries[i].name_len);
+        offs[hash_bucket (hashes[i], buckets) + 1]++;
+    }
+    for (i = 1; i <= buckets; i++)
+        offs[i] += offs[i - 1];
+    for (i = 0; i < num; i++)
+        order[offs[hash_bucket (hashes[i], buckets)]++] = i;
+    for (i = buckets; i > 0; i--)
+        offs[i] = offs[i - 1];
+    offs[0] = 0;
+
+    count = hev_auth_db_dedup (entries, order, offs, buckets);
+    if (count) {
+        res = hev_auth_db_place (hashes, order, offs, buckets, count, seeds,
+                                 slots);
+        if (res < 0)
+            goto exit;
+        res = -1;
+    }
+
+    for (i = 0; i < count; i++)
+        by_slot[slots[order[i]]] = order[i];
+
+    snprintf (tmp, sizeof (tmp), "%s.tmp", path);
+    fp = fopen (tmp, "w");
+    if (!fp) {
+        LOG_E ("auth db open %s", tmp);
+        goto exit;
+    }
+
+    res = hev_auth_db_dump (fp, entries, by_slot, seeds, buckets, count);
+    if (fclose (fp) < 0)
+        res = -1;
+    if (res == 0 && rename (tmp, path) < 0)
+        res = -1;
+    if (res < 0) {
+        LOG_E ("auth db write %s", path);
+        unlink (tmp);
+    }
+
+exit:
+    hev_free (seeds);
+    hev_free (offs);
+    hev_free (by_slot);
+    hev_free (slots);
+    hev_free (order);
+    hev_free (hashes);
+    return res;
+}
@@ -0,0 +1,121 @@
+/*
+ ============================================================================
+ Name        : hev-auth-db.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Compiled Auth Database
+ ============================================================================
+ */
+
+#ifndef __HEV_AUTH_DB_H__
+#define __HEV_AUTH_DB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevAuthDb HevAuthDb;
+typedef struct _HevAuthDbEntry HevAuthDbEntry;
+
+struct _HevAuthDb
+{
+    unsigned int count;
+    unsigned int buckets;
+
+    const uint32_t *seeds;
+    const void *records;
+    const char *strings;
+};
+
+struct _HevAuthDbEntry
+{
+    const char *name;
+    const char *pass;
+    const char *opts;
+    unsigned int name_len;
+    unsigned int pass_len;
+    unsigned int opts_len;
+    unsigned int mark;
+};
+
+/**
+ * hev_auth_db_probe:
+ * @data: file data
+ * @size: file size
+ *
+ * Tell a compiled image from a text file, of any image version.
+ *
+ * Returns: returns 1 if @data starts like an image, otherwise returns 0.
+ *
+ * Since: 2.14
+ */
+int hev_auth_db_probe (const void *data, size_t size);
+
+/**
+ * hev_auth_db_init:
+ * @self: a #HevAuthDb
+ * @data: image data
+ * @size: image size
+ *
+ * Attach to a compiled image, usually a read-only mapping of the file. The
+ * image is validated once, lookups then trust it. Nothing is copied, so
+ * the data must outlive @self and every entry taken from it.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_auth_db_init (HevAuthDb *self, const void *data, size_t size);
+
+/**
+ * hev_auth_db_find:
+ * @self: a #HevAuthDb
+ * @name: user name
+ * @name_len: length of user name
+ *
+ * Look up a user with one hash and one compare.
+ *
+ * Returns: returns the entry index, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_auth_db_find (HevAuthDb *self, const char *name,
+                      unsigned int name_len);
+
+/**
+ * hev_auth_db_get:
+ * @self: a #HevAuthDb
+ * @index: entry index, less than the count
+ * @entry: (out): the entry
+ *
+ * Read an entry. The strings point into the image.
+ *
+ * Since: 2.14
+ */
+void hev_auth_db_get (HevAuthDb *self, unsigned int index,
+                      HevAuthDbEntry *entry);
+
+/**
+ * hev_auth_db_write:
+ * @path: output file path
+ * @entries: entries, later duplicates of a name are dropped
+ * @num: number of entries
+ *
+ * Build the minimal perfect hash and write an image. The file is replaced
+ * with a rename, so running servers keep reading the old one.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_auth_db_write (const char *path, const HevAuthDbEntry *entries,
+                       unsigned int num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_AUTH_DB_H__ */
@@ -0,0 +1,876 @@
+/*
+ ============================================================================
+ Name        : hev-auth-file.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Auth File
+ ============================================================================
+ */
+
+/*
+ * Users are diffed against the authenticator of the control thread, not
+ * the table the sessions look them up in, see the AUTH_CFLAGS of build.mk.
+ */
+#undef hev_socks5_authenticator_get
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-auth-db.h"
+#include "hev-compiler.h"
+#include "hev-socks5-user-mark.h"
+
+#include "hev-auth-file.h"
+
+#define AUTH_FILE_MAX_TOKEN (255)
+#define AUTH_FILE_MAX_OPTIONS (4095)
+
+enum
+{
+    CHANGE_ADD,
+    CHANGE_DEL,
+    CHANGE_ATTR,
+};
+
+typedef struct _HevAuthFileToken HevAuthFileToken;
+typedef struct _HevAuthFileChange HevAuthFileChange;
+typedef struct _HevAuthFileOption HevAuthFileOption;
+
+struct _HevAuthFileToken
+{
+    const char *ptr;
+    unsigned int len;
+};
+
+struct _HevAuthFileOption
+{
+    const char *key;
+    size_t offset;
+};
+
+struct _HevAuthFileChange
+{
+    int type;
+    unsigned int mark;
+    HevSocks5UserLimit limit;
+    HevSocks5UserMark *user;
+
+    /* Pending additions point into the mapped file until allocated. */
+    HevAuthFileToken name;
+    HevAuthFileToken pass;
+};
+
+struct _HevAuthFile
+{
+    HevSocks5Authenticator *auth;
+    HevAuthTable *table;
+    HevAuthTable *prev;
+    HevList retired;
+    HevList users;
+    unsigned int gen;
+    unsigned int count;
+
+    unsigned int num;
+    unsigned int max;
+    HevAuthFileChange *changes;
+};
+
+static int
+is_space (char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int
+hex_value (char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static unsigned int
+parse_mark (HevAuthFileToken *tok)
+{
+    const char *p = tok->ptr;
+    const char *e = p + tok->len;
+    unsigned long mark = 0;
+
+    if ((e - p) > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2;
+
+    for (; p < e; p++) {
+        int v = hex_value (*p);
+        if (v < 0)
+            break;
+        mark = (mark << 4) | v;
+    }
+
+    return mark;
+}
+
+static const HevAuthFileOption options[] = {
+    { "up", offsetof (HevSocks5UserLimit, rate_up) },
+    { "down", offsetof (HevSocks5UserLimit, rate_down) },
+    { "sessions", offsetof (HevSocks5UserLimit, sessions) },
+    { "connects", offsetof (HevSocks5UserLimit, connects) },
+};
+
+static int
+parse_size (const char *p, const char *e, unsigned int *value)
+{
+    unsigned long long v = 0;
+    unsigned int shift = 0;
+
+    if (p == e)
+        return -1;
+
+    for (; p < e && *p >= '0' && *p <= '9'; p++) {
+        v = v * 10 + (*p - '0');
+        if (v > UINT_MAX)
+            return -1;
+    }
+
+    if ((e - p) == 1) {
+        switch (*p) {
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        default:
+            return -1;
+        }
+    } else if (p != e) {
+        return -1;
+    }
+
+    v <<= shift;
+    *value = (v > UINT_MAX) ? UINT_MAX : v;
+
+    return 0;
+}
+
+static int
+parse_options (HevAuthFileToken *tok, HevSocks5UserLimit *limit)
+{
+    const char *p = tok->ptr;
+    const char *e = p + tok->len;
+
+    memset (limit, 0, sizeof (HevSocks5UserLimit));
+
+    while (p < e) {
+        const char *s, *k;
+        unsigned int i;
+
+        while (p < e && is_space (*p))
+            p++;
+        if (p == e)
+            break;
+
+        s = p;
+        while (p < e && !is_space (*p))
+            p++;
+
+        k = memchr (s, '=', p - s);
+        if (!k)
+            return -1;
+
+        for (i = 0; i < ARRAY_SIZE (options); i++) {
+            const HevAuthFileOption *o = &options[i];
+            unsigned int *v = (unsigned int *)((char *)limit + o->offset);
+
+            if (strlen (o->key) != (k - s) || memcmp (o->key, s, k - s) != 0)
+                continue;
+            if (parse_size (k + 1, p, v) < 0)
+                return -1;
+            break;
+        }
+        if (i == ARRAY_SIZE (options))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+split_line (const char *p, const char *e, HevAuthFileToken *toks, int max)
+{
+    int num = 0;
+
+    while (num < max) {
+        const char *s;
+
+        while (p < e && is_space (*p))
+            p++;
+        if (p == e)
+            break;
+
+        s = p;
+        while (p < e && !is_space (*p))
+            p++;
+
+        toks[num].ptr = s;
+        toks[num].len = p - s;
+        num++;
+    }
+
+    return num;
+}
+
+/* Splits name, password and mark, the rest of the line is the options. */
+static int
+split_record (const char *p, const char *e, HevAuthFileToken *toks)
+{
+    int num;
+
+    num = split_line (p, e, toks, 3);
+
+    toks[3].ptr = e;
+    toks[3].len = 0;
+    if (num == 3) {
+        const char *s = toks[2].ptr + toks[2].len;
+
+        while (s < e && is_space (*s))
+            s++;
+        while (e > s && is_space (e[-1]))
+            e--;
+
+        toks[3].ptr = s;
+        toks[3].len = e - s;
+    }
+
+    return num;
+}
+
+static int
+is_valid (HevAuthFileToken *toks, int num)
+{
+    if (num < 2)
+        return 0;
+
+    if (toks[0].len > AUTH_FILE_MAX_TOKEN || toks[1].len > AUTH_FILE_MAX_TOKEN)
+        return 0;
+
+    if (toks[3].len > AUTH_FILE_MAX_OPTIONS)
+        return 0;
+
+    return 1;
+}
+
+HevAuthFile *
+hev_auth_file_new (HevSocks5Authenticator *auth)
+{
+    HevAuthFile *self;
+
+    self = hev_malloc0 (sizeof (HevAuthFile));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p auth file new", self);
+
+    hev_object_ref (HEV_OBJECT (auth));
+    self->auth = auth;
+
+    return self;
+}
+
+static void
+hev_auth_file_reset (HevAuthFile *self)
+{
+    unsigned int i;
+
+    for (i = 0; i < self->num; i++) {
+        HevAuthFileChange *c = &self->changes[i];
+
+        if (c->type == CHANGE_ADD && c->user)
+            hev_object_unref (HEV_OBJECT (c->user));
+    }
+
+    self->num = 0;
+}
+
+void
+hev_auth_file_destroy (HevAuthFile *self)
+{
+    LOG_D ("%p auth file destroy", self);
+
+    hev_auth_file_reset (self);
+    hev_auth_file_release (self);
+    if (self->table)
+        hev_auth_table_destroy (self->table);
+    hev_object_unref (HEV_OBJECT (self->auth));
+    free (self->changes);
+    hev_free (self);
+}
+
+static HevAuthFileChange *
+hev_auth_file_change (HevAuthFile *self, int type, HevSocks5UserMark *user)
+{
+    HevAuthFileChange *c;
+
+    if (self->num == self->max) {
+        unsigned int max = self->max ? self->max * 2 : 64;
+
+        c = realloc (self->changes, sizeof (HevAuthFileChange) * max);
+        if (!c) {
+            LOG_E ("auth file changes");
+            return NULL;
+        }
+
+        self->changes = c;
+        self->max = max;
+    }
+
+    c = &self->changes[self->num++];
+    memset (c, 0, sizeof (HevAuthFileChange));
+    c->type = type;
+    c->user = user;
+
+    return c;
+}
+
+static void
+hev_auth_file_record (HevAuthFile *self, HevAuthFileToken *toks, int num)
+{
+    HevSocks5UserMark *user;
+    HevSocks5User *base;
+    HevAuthFileChange *c;
+    HevSocks5UserLimit limit;
+    unsigned int mark = 0;
+
+    if (num > 2)
+        mark = parse_mark (&toks[2]);
+
+    if (parse_options (&toks[3], &limit) < 0) {
+        LOG_E ("socks5 proxy user options");
+        return;
+    }
+
+    base = hev_socks5_authenticator_get (self->auth, toks[0].ptr, toks[0].len);
+    user = HEV_SOCKS5_USER_MARK (base);
+
+    if (user) {
+        if (user->gen == self->gen) {
+            LOG_E ("socks5 proxy user conflict");
+            return;
+        }
+        user->gen = self->gen;
+
+        if (base->pass_len == toks[1].len &&
+            memcmp (base->pass, toks[1].ptr, toks[1].len) == 0) {
+            if (user->mark == mark &&
+                memcmp (&user->limit, &limit, sizeof (limit)) == 0)
+                return;
+
+            c = hev_auth_file_change (self, CHANGE_ATTR, user);
+            if (c) {
+                c->mark = mark;
+                c->limit = limit;
+            }
+            return;
+        }
+
+        /* Names and passwords are immutable, replace the whole user. */
+        if (!hev_auth_file_change (self, CHANGE_DEL, user))
+            return;
+    }
+
+    c = hev_auth_file_change (self, CHANGE_ADD, NULL);
+    if (!c)
+        return;
+
+    c->mark = mark;
+    c->limit = limit;
+    c->name = toks[0];
+    c->pass = toks[1];
+}
+
+static void
+hev_auth_file_parse (HevAuthFile *self, const char *p, const char *e)
+{
+    while (p < e) {
+        HevAuthFileToken toks[4];
+        const char *l;
+        int res;
+
+        l = memchr (p, '\n', e - p);
+        if (!l)
+            l = e;
+
+        res = split_record (p, l, toks);
+        p = l + 1;
+        if (res == 0)
+            continue;
+
+        if (!is_valid (toks, res)) {
+            LOG_E ("socks5 proxy user/pass format");
+            continue;
+        }
+
+        hev_auth_file_record (self, toks, res);
+    }
+}
+
+static void
+hev_auth_file_alloc (HevAuthFile *self)
+{
+    HevSocks5UserArena *arena;
+    unsigned int users = 0;
+    size_t size = 0;
+    unsigned int i;
+
+    for (i = 0; i < self->num; i++) {
+        HevAuthFileChange *c = &self->changes[i];
+
+        if (c->type != CHANGE_ADD)
+            continue;
+
+        size += c->name.len + c->pass.len;
+        users++;
+    }
+
+    if (!users)
+        return;
+
+    /*
+     * One block holds every user added by this reload, with their strings.
+     * Nothing points into the file once it is unmapped, so it may be
+     * rewritten in place later on.
+     */
+    arena = hev_socks5_user_arena_new (users, size);
+    if (!arena) {
+        LOG_E ("socks5 proxy user arena");
+        return;
+    }
+
+    for (i = 0; i < self->num; i++) {
+        HevAuthFileChange *c = &self->changes[i];
+
+        if (c->type != CHANGE_ADD)
+            continue;
+
+        c->user = hev_socks5_user_arena_alloc (arena, c->name.ptr, c->name.len,
+                                               c->pass.ptr, c->pass.len,
+                                               c->mark);
+        if (!c->user) {
+            LOG_E ("socks5 proxy user new");
+            continue;
+        }
+        c->user->gen = self->gen;
+        c->user->limit = c->limit;
+    }
+
+    hev_socks5_user_arena_unref (arena);
+}
+
+static void
+hev_auth_file_sweep (HevAuthFile *self)
+{
+    HevListNode *node;
+
+    node = hev_list_first (&self->users);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5UserMark *user;
+
+        user = container_of (node, HevSocks5UserMark, node);
+        if (user->gen != self->gen)
+            hev_auth_file_change (self, CHANGE_DEL, user);
+    }
+}
+
+static int
+hev_auth_file_diff_db (HevAuthFile *self, HevAuthDb *db)
+{
+    HevSocks5UserLimit limit;
+    HevAuthDbEntry entry;
+    HevAuthFileToken opts;
+    HevAuthFileChange *c;
+    HevListNode *node;
+    unsigned char *seen;
+    unsigned int i;
+
+    seen = hev_malloc0 (db->count + 1);
+    if (!seen) {
+        LOG_E ("auth file seen");
+        return -1;
+    }
+
+    /* The current users are looked up in the image, not the other way. */
+    node = hev_list_first (&self->users);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5UserMark *user;
+        HevSocks5User *base;
+        int index;
+
+        user = container_of (node, HevSocks5UserMark, node);
+        base = HEV_SOCKS5_USER (user);
+
+        index = hev_auth_db_find (db, base->name, base->name_len);
+        if (index < 0) {
+            hev_auth_file_change (self, CHANGE_DEL, user);
+            continue;
+        }
+
+        seen[index] = 1;
+        hev_auth_db_get (db, index, &entry);
+
+        opts.ptr = entry.opts;
+        opts.len = entry.opts_len;
+        if (parse_options (&opts, &limit) < 0)
+            memset (&limit, 0, sizeof (limit));
+
+        if (base->pass_len == entry.pass_len &&
+            memcmp (base->pass, entry.pass, entry.pass_len) == 0) {
+            if (user->mark == entry.mark &&
+                memcmp (&user->limit, &limit, sizeof (limit)) == 0)
+                continue;
+
+            c = hev_auth_file_change (self, CHANGE_ATTR, user);
+            if (c) {
+                c->mark = entry.mark;
+                c->limit = limit;
+            }
+            continue;
+        }
+
+        if (!hev_auth_file_change (self, CHANGE_DEL, user))
+            continue;
+        seen[index] = 0;
+    }
+
+    for (i = 0; i < db->count; i++) {
+        if (seen[i])
+            continue;
+
+        c = hev_auth_file_change (self, CHANGE_ADD, NULL);
+        if (!c)
+            break;
+
+        hev_auth_db_get (db, i, &entry);
+        opts.ptr = entry.opts;
+        opts.len = entry.opts_len;
+        if (parse_options (&opts, &c->limit) < 0)
+            memset (&c->limit, 0, sizeof (c->limit));
+        c->mark = entry.mark;
+        c->name.ptr = entry.name;
+        c->name.len = entry.name_len;
+        c->pass.ptr = entry.pass;
+        c->pass.len = entry.pass_len;
+    }
+
+    hev_free (seen);
+
+    return 0;
+}
+
+int
+hev_auth_file_diff (HevAuthFile *self, const char *path)
+{
+    struct stat st;
+    HevAuthDb db;
+    char *p = NULL;
+    int res = 0;
+    int fd;
+
+    LOG_D ("%p auth file diff %s", self, path);
+
+    hev_auth_file_reset (self);
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat (fd, &st) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    /*
+     * The file is parsed straight out of the page cache. Replace it with a
+     * rename rather than truncating it in place while a reload is running.
+     */
+    if (st.st_size) {
+        p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close (fd);
+            return -1;
+        }
+    }
+    close (fd);
+
+    if (++self->gen == 0)
+        self->gen = 1;
+
+    if (p && hev_auth_db_probe (p, st.st_size)) {
+        if (hev_auth_db_init (&db, p, st.st_size) < 0) {
+            LOG_E ("auth db %s invalid or outdated", path);
+            munmap (p, st.st_size);
+            return -1;
+        }
+
+        res = hev_auth_file_diff_db (self, &db);
+        if (res == 0)
+            hev_auth_file_alloc (self);
+        munmap (p, st.st_size);
+        return res;
+    }
+
+    if (p) {
+        posix_madvise (p, st.st_size, POSIX_MADV_SEQUENTIAL);
+        hev_auth_file_parse (self, p, p + st.st_size);
+        hev_auth_file_alloc (self);
+        munmap (p, st.st_size);
+    }
+
+    hev_auth_file_sweep (self);
+
+    return 0;
+}
+
+int
+hev_auth_file_apply (HevAuthFile *self)
+{
+    HevAuthTable *table;
+    unsigned int add = 0;
+    unsigned int del = 0;
+    unsigned int mod = 0;
+    unsigned int i;
+
+    LOG_D ("%p auth file apply", self);
+
+    for (i = 0; i < self->num; i++) {
+        HevAuthFileChange *c = &self->changes[i];
+
+        if (c->type == CHANGE_ADD && c->user)
+            add++;
+        else if (c->type == CHANGE_DEL)
+            del++;
+    }
+
+    /* Sessions keep reading the published table while this one is built. */
+    table = self->table;
+    if (add || del || !table) {
+        table = hev_auth_table_new (self->table, self->count + add);
+        if (!table) {
+            LOG_E ("auth file table");
+            hev_auth_file_reset (self);
+            return -1;
+        }
+    }
+    add = 0;
+    del = 0;
+
+    /* Removals go first, so a replaced user can be added back. */
+    for (i = 0; i < self->num; i++) {
+        HevAuthFileChange *c = &self->changes[i];
+        HevSocks5User *base = HEV_SOCKS5_USER (c->user);
+
+        switch (c->type) {
+        case CHANGE_DEL:
+            hev_list_del (&self->users, &c->user->node);
+            hev_auth_table_del (table, base);
+            /* Kept for sessions that may have just looked it up. */
+            hev_object_ref (HEV_OBJECT (base));
+            hev_socks5_authenticator_del (self->auth, base->name,
+                                          base->name_len);
+            hev_list_add_tail (&self->retired, &c->user->node);
+            self->count--;
+            del++;
+            break;
+        case CHANGE_ATTR:
+            /* Read by sessions as they go, field by field. */
+            WRITE_ONCE (c->user->mark, c->mark);
+            WRITE_ONCE (c->user->limit, c->limit);
+            mod++;
+            break;
+        }
+    }
+
+    for (i = 0; i < self->num; i++) {
+        HevAuthFileChange *c = &self->changes[i];
+        HevSocks5User *base = HEV_SOCKS5_USER (c->user);
+        int res;
+
+        if (c->type != CHANGE_ADD || !c->user)
+            continue;
+
+        res = hev_socks5_authenticator_add (self->auth, base);
+        if (res < 0) {
+            LOG_E ("socks5 proxy user conflict");
+            hev_object_unref (HEV_OBJECT (c->user));
+            continue;
+        }
+
+        hev_auth_table_add (table, base);
+        hev_list_add_tail (&self->users, &c->user->node);
+        self->count++;
+        add++;
+    }
+
+    self->num = 0;
+
+    if (table != self->table) {
+        self->prev = self->table;
+        self->table = table;
+    }
+
+    LOG_I ("socks5 proxy auth %u added %u removed %u changed", add, del, mod);
+
+    return 0;
+}
+
+HevAuthTable *
+hev_auth_file_get_table (HevAuthFile *self)
+{
+    return self->table;
+}
+
+void
+hev_auth_file_release (HevAuthFile *self)
+{
+    HevListNode *node;
+
+    LOG_D ("%p auth file release", self);
+
+    if (self->prev) {
+        hev_auth_table_destroy (self->prev);
+        self->prev = NULL;
+    }
+
+    while ((node = hev_list_first (&self->retired))) {
+        HevSocks5UserMark *user;
+
+        user = container_of (node, HevSocks5UserMark, node);
+        hev_list_del (&self->retired, node);
+        hev_object_unref (HEV_OBJECT (user));
+    }
+}
+
+void
+hev_auth_file_foreach (HevAuthFile *self, HevAuthFileForeachFunc func,
+                       void *data)
+{
+    HevListNode *node;
+
+    node = hev_list_first (&self->users);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5UserMark *user;
+
+        user = container_of (node, HevSocks5UserMark, node);
+        func (user, data);
+    }
+}
+
+int
+hev_auth_file_compile (const char *path, const char *out)
+{
+    HevAuthDbEntry *entries = NULL;
+    unsigned int num = 0;
+    unsigned int max = 0;
+    const char *p, *e;
+    struct stat st;
+    char *map = NULL;
+    int res = -1;
+    int fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        LOG_E ("auth file open %s", path);
+        return -1;
+    }
+
+    if (fstat (fd, &st) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    if (st.st_size) {
+        map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close (fd);
+            return -1;
+        }
+        posix_madvise (map, st.st_size, POSIX_MADV_SEQUENTIAL);
+    }
+    close (fd);
+
+    p = map;
+    e = map ? map + st.st_size : NULL;
+    while (p < e) {
+        HevSocks5UserLimit limit;
+        HevAuthFileToken toks[4];
+        HevAuthDbEntry *x;
+        const char *l;
+        int n;
+
+        l = memchr (p, '\n', e - p);
+        if (!l)
+            l = e;
+
+        n = split_record (p, l, toks);
+        p = l + 1;
+        if (n == 0)
+            continue;
+
+        if (!is_valid (toks, n)) {
+            LOG_E ("socks5 proxy user/pass format");
+            continue;
+        }
+
+        /* Options are kept as text, checked once here. */
+        if (parse_options (&toks[3], &limit) < 0) {
+            LOG_E ("socks5 proxy user options");
+            continue;
+        }
+
+        if (num == max) {
+            max = max ? max * 2 : 1024;
+            x = realloc (entries, sizeof (HevAuthDbEntry) * max);
+            if (!x) {
+                LOG_E ("auth file entries");
+                goto exit;
+            }
+            entries = x;
+        }
+
+        x = &entries[num++];
+        x->name = toks[0].ptr;
+        x->name_len = toks[0].len;
+        x->pass = toks[1].ptr;
+        x->pass_len = toks[1].len;
+        x->opts = toks[3].ptr;
+        x->opts_len = toks[3].len;
+        x->mark = (n > 2) ? parse_mark (&toks[2]) : 0;
+    }
+
+    res = hev_auth_db_write (out, entries, num);
+    if (res == 0)
+        LOG_I ("auth file compiled %u users into %s", num, out);
+
+exit:
+    free (entries);
+    if (map)
+        munmap (map, st.st_size);
+    return res;
+}
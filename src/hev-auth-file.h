@@ -0,0 +1,33 @@
+/*
+ ============================================================================
+ Name        : hev-auth-file.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Auth File
+ ============================================================================
+ */
+
+#ifndef __HEV_AUTH_FILE_H__
+#define __HEV_AUTH_FILE_H__
+
+#include <hev-socks5-authenticator.h>
+
+#include "hev-auth-table.h"
+#include "hev-socks5-user-mark.h"
+
+typedef struct _HevAuthFile HevAuthFile;
+typedef void (*HevAuthFileForeachFunc) (HevSocks5UserMark *user, void *data);
+
+HevAuthFile *hev_auth_file_new (HevSocks5Authenticator *auth);
+void hev_auth_file_destroy (HevAuthFile *self);
+
+int hev_auth_file_diff (HevAuthFile *self, const char *path);
+int hev_auth_file_apply (HevAuthFile *self);
+void hev_auth_file_release (HevAuthFile *self);
+HevAuthTable *hev_auth_file_get_table (HevAuthFile *self);
+void hev_auth_file_foreach (HevAuthFile *self, HevAuthFileForeachFunc func,
+                            void *data);
+
+int hev_auth_file_compile (const char *path, const char *out);
+
+#endif /* __HEV_AUTH_FILE_H__ */
@@ -0,0 +1,548 @@
+/*
+ ============================================================================
+ Name        : hev-auth-hash.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Hashed Password
+ ============================================================================
+ */
+
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-list.h"
+#include "hev-misc.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-sha256.h"
+#include "hev-compiler.h"
+
+#include "hev-auth-hash.h"
+
+/*
+ * Passwords may be stored in the passlib pbkdf2_sha256 format:
+ *
+ *   $pbkdf2-sha256$<rounds>$<salt>$<checksum>
+ *
+ * with salt and checksum in unpadded base64, '.' standing in for '+'.
+ */
+
+#define HASH_PREFIX "$pbkdf2-sha256$"
+#define HASH_ROUNDS (29000)
+#define HASH_MAX_ROUNDS (10000000)
+#define HASH_MAX_SALT (64)
+#define HASH_SALT_SIZE (16)
+#define HASH_MAX_PENDING (64)
+#define HASH_MAX_THREADS (8)
+#define HASH_USER_RATE (8)
+#define CACHE_SETS (1024)
+#define CACHE_WAYS (4)
+
+typedef struct _HevAuthHash HevAuthHash;
+typedef struct _HevAuthHashJob HevAuthHashJob;
+typedef struct _HevAuthHashCache HevAuthHashCache;
+
+struct _HevAuthHash
+{
+    unsigned int rounds;
+    unsigned int salt_len;
+    uint8_t salt[HASH_MAX_SALT];
+    uint8_t sum[HEV_SHA256_SIZE];
+};
+
+struct _HevAuthHashJob
+{
+    HevListNode node;
+    /* Held by the waiter and the thread, the last one frees the job. */
+    atomic_int refs;
+    HevAuthHash hash;
+    unsigned int pass_len;
+    char pass[256];
+    int fd;
+};
+
+struct _HevAuthHashCache
+{
+    uint8_t keys[CACHE_SETS][CACHE_WAYS][HEV_SHA256_SIZE];
+    uint8_t used[CACHE_SETS][CACHE_WAYS];
+};
+
+static const char ab64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789./";
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static uint8_t cache_secret[HEV_SHA256_SIZE];
+
+static int job_num;
+static int job_max;
+static int job_ready;
+static HevList job_list;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+ab64_value (char c)
+{
+    const char *p = memchr (ab64, c, 64);
+
+    return p ? p - ab64 : -1;
+}
+
+static int
+ab64_decode (const char *s, unsigned int len, uint8_t *out, unsigned int max)
+{
+    unsigned int bits = 0;
+    unsigned int num = 0;
+    uint32_t acc = 0;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        int v = ab64_value (s[i]);
+
+        if (v < 0)
+            return -1;
+
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (num == max)
+                return -1;
+            out[num++] = acc >> bits;
+        }
+    }
+
+    return num;
+}
+
+static int
+ab64_encode (const uint8_t *in, unsigned int len, char *out)
+{
+    unsigned int bits = 0;
+    uint32_t acc = 0;
+    int num = 0;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        acc = (acc << 8) | in[i];
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out[num++] = ab64[(acc >> bits) & 63];
+        }
+    }
+    if (bits)
+        out[num++] = ab64[(acc << (6 - bits)) & 63];
+
+    return num;
+}
+
+static int
+hev_auth_hash_parse (HevAuthHash *self, const char *s, unsigned int len)
+{
+    const char *e = s + len;
+    const char *salt;
+    const char *p;
+    int res;
+
+    s += sizeof (HASH_PREFIX) - 1;
+
+    self->rounds = 0;
+    for (p = s; p < e && *p >= '0' && *p <= '9'; p++) {
+        self->rounds = self->rounds * 10 + (*p - '0');
+        if (self->rounds > HASH_MAX_ROUNDS)
+            return -1;
+    }
+    if (p == s || p == e || *p != '$' || !self->rounds)
+        return -1;
+
+    salt = ++p;
+    p = memchr (salt, '$', e - salt);
+    if (!p)
+        return -1;
+
+    res = ab64_decode (salt, p - salt, self->salt, HASH_MAX_SALT);
+    if (res < 0)
+        return -1;
+    self->salt_len = res;
+
+    p++;
+    res = ab64_decode (p, e - p, self->sum, HEV_SHA256_SIZE);
+    if (res != HEV_SHA256_SIZE)
+        return -1;
+
+    return 0;
+}
+
+static int
+hev_auth_hash_verify (HevAuthHash *self, const char *pass,
+                      unsigned int pass_len)
+{
+    uint8_t sum[HEV_SHA256_SIZE];
+    uint8_t diff = 0;
+    int i;
+
+    hev_pbkdf2_sha256 (pass, pass_len, self->salt, self->salt_len,
+                       self->rounds, sum, sizeof (sum));
+
+    for (i = 0; i < HEV_SHA256_SIZE; i++)
+        diff |= sum[i] ^ self->sum[i];
+
+    return diff ? -1 : 0;
+}
+
+static void
+hev_auth_hash_job_unref (HevAuthHashJob *job)
+{
+    if (atomic_fetch_sub (&job->refs, 1) == 1)
+        hev_free (job);
+}
+
+static int
+hash_io_yielder (HevTaskYieldType type, void *data)
+{
+    const int *cancel = data;
+
+    hev_task_yield (type);
+
+    return (cancel && READ_ONCE (*cancel)) ? -1 : 0;
+}
+
+static void *
+job_thread_handler (void *data)
+{
+    sigset_t set;
+
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock (&job_mutex);
+    for (;;) {
+        HevAuthHashJob *job;
+        HevListNode *node;
+        ssize_t size;
+        char res;
+        int fd;
+
+        node = hev_list_first (&job_list);
+        if (!node) {
+            pthread_cond_wait (&job_cond, &job_mutex);
+            continue;
+        }
+        hev_list_del (&job_list, node);
+        pthread_mutex_unlock (&job_mutex);
+
+        /* Jobs whose waiter has given up are not worth hashing. */
+        job = container_of (node, HevAuthHashJob, node);
+        res = -1;
+        if (atomic_load (&job->refs) > 1)
+            res = hev_auth_hash_verify (&job->hash, job->pass, job->pass_len);
+        fd = job->fd;
+        size = write (fd, &res, sizeof (res));
+        close (fd);
+        hev_auth_hash_job_unref (job);
+        (void)size;
+
+        pthread_mutex_lock (&job_mutex);
+        job_num--;
+    }
+
+    return NULL;
+}
+
+static void
+hev_auth_hash_cache_free (void *data)
+{
+    hev_free (data);
+}
+
+static void
+hev_auth_hash_init (void)
+{
+    unsigned int threads;
+    unsigned int i;
+    int res;
+    int fd;
+
+    pthread_key_create (&cache_key, hev_auth_hash_cache_free);
+
+    /* Only keys the cache, a weak fallback is not a credential leak. */
+    fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 ||
+        read (fd, cache_secret, sizeof (cache_secret)) !=
+            sizeof (cache_secret)) {
+        int64_t seed = time (NULL) ^ getpid ();
+
+        LOG_W ("auth hash random secret");
+        hev_hmac_sha256 (&seed, sizeof (seed), &fd, sizeof (fd), cache_secret);
+    }
+    if (fd >= 0)
+        close (fd);
+
+    /* Hashing competes with the workers for the CPUs, half of them do. */
+    threads = (hev_config_get_workers () + 1) / 2;
+    if (threads > HASH_MAX_THREADS)
+        threads = HASH_MAX_THREADS;
+    if (!threads)
+        threads = 1;
+
+    for (i = 0; i < threads; i++) {
+        pthread_t thread;
+
+        res = pthread_create (&thread, NULL, job_thread_handler, NULL);
+        if (res != 0)
+            break;
+        pthread_detach (thread);
+    }
+    if (!i) {
+        LOG_E ("auth hash thread");
+        return;
+    }
+
+    job_max = HASH_MAX_PENDING * i;
+    job_ready = 1;
+}
+
+static HevAuthHashCache *
+hev_auth_hash_cache (void)
+{
+    HevAuthHashCache *cache;
+
+    cache = pthread_getspecific (cache_key);
+    if (cache)
+        return cache;
+
+    cache = hev_malloc0 (sizeof (HevAuthHashCache));
+    if (cache)
+        pthread_setspecific (cache_key, cache);
+
+    return cache;
+}
+
+static void
+hev_auth_hash_cache_key (const char *stored, unsigned int stored_len,
+                         const char *pass, unsigned int pass_len,
+                         uint8_t *key)
+{
+    char data[512 + 1];
+
+    memcpy (data, stored, stored_len);
+    data[stored_len] = '\0';
+    memcpy (data + stored_len + 1, pass, pass_len);
+
+    hev_hmac_sha256 (cache_secret, sizeof (cache_secret), data,
+                     stored_len + 1 + pass_len, key);
+}
+
+/* Each set keeps its ways in most recently used order. */
+static int
+hev_auth_hash_cache_get (HevAuthHashCache *self, const uint8_t *key)
+{
+    unsigned int set = (key[0] | (key[1] << 8)) % CACHE_SETS;
+    int i;
+
+    for (i = 0; i < CACHE_WAYS && self->used[set][i]; i++) {
+        if (memcmp (self->keys[set][i], key, HEV_SHA256_SIZE) != 0)
+            continue;
+
+        if (i) {
+            memmove (self->keys[set][1], self->keys[set][0],
+                     HEV_SHA256_SIZE * i);
+            memcpy (self->keys[set][0], key, HEV_SHA256_SIZE);
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+static void
+hev_auth_hash_cache_put (HevAuthHashCache *self, const uint8_t *key)
+{
+    unsigned int set = (key[0] | (key[1] << 8)) % CACHE_SETS;
+
+    memmove (self->keys[set][1], self->keys[set][0],
+             HEV_SHA256_SIZE * (CACHE_WAYS - 1));
+    memmove (&self->used[set][1], &self->used[set][0], CACHE_WAYS - 1);
+    memcpy (self->keys[set][0], key, HEV_SHA256_SIZE);
+    self->used[set][0] = 1;
+}
+
+/* Same scheme as the connect limit of sessions, see hev-socks5-session.c. */
+static int
+hev_auth_hash_admit (atomic_ullong *tries)
+{
+    uint32_t sec = get_monotonic_ms () / 1000;
+    uint64_t prev;
+    uint64_t next;
+
+    prev = atomic_load_explicit (tries, memory_order_relaxed);
+    do {
+        if ((int32_t)(sec - (uint32_t)(prev >> 32)) <= 0)
+            next = prev + 1;
+        else
+            next = ((uint64_t)sec << 32) | 1;
+        if ((uint32_t)next > HASH_USER_RATE)
+            return -1;
+    } while (!atomic_compare_exchange_weak_explicit (
+        tries, &prev, next, memory_order_relaxed, memory_order_relaxed));
+
+    return 0;
+}
+
+static int
+hev_auth_hash_offload (HevAuthHash *hash, const char *pass,
+                       unsigned int pass_len, const int *cancel)
+{
+    HevAuthHashJob *job;
+    HevTask *task;
+    ssize_t size;
+    int fds[2];
+    char res;
+
+    job = hev_malloc (sizeof (HevAuthHashJob));
+    if (!job)
+        return -1;
+
+    if (pipe (fds) < 0) {
+        hev_free (job);
+        return -1;
+    }
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[0], F_SETFL, O_NONBLOCK);
+
+    atomic_init (&job->refs, 2);
+    job->hash = *hash;
+    job->pass_len = pass_len;
+    memcpy (job->pass, pass, pass_len);
+    job->fd = fds[1];
+
+    pthread_mutex_lock (&job_mutex);
+    if (job_num >= job_max) {
+        pthread_mutex_unlock (&job_mutex);
+        LOG_W ("auth hash queue full");
+        close (fds[0]);
+        close (fds[1]);
+        hev_free (job);
+        return -1;
+    }
+    job_num++;
+    hev_list_add_tail (&job_list, &job->node);
+    pthread_cond_signal (&job_cond);
+    pthread_mutex_unlock (&job_mutex);
+
+    /*
+     * Other sessions of this worker keep running while the thread hashes,
+     * and a terminated session leaves the job to the thread.
+     */
+    res = -1;
+    task = hev_task_self ();
+    hev_task_add_fd (task, fds[0], POLLIN);
+    size = hev_task_io_read (fds[0], &res, sizeof (res), hash_io_yielder,
+                             (void *)cancel);
+    hev_task_del_fd (task, fds[0]);
+    close (fds[0]);
+    hev_auth_hash_job_unref (job);
+
+    return (size == sizeof (res)) ? res : -1;
+}
+
+int
+hev_auth_hash_is_hashed (const char *stored, unsigned int stored_len)
+{
+    if (stored_len < (sizeof (HASH_PREFIX) - 1))
+        return 0;
+
+    return !memcmp (stored, HASH_PREFIX, sizeof (HASH_PREFIX) - 1);
+}
+
+int
+hev_auth_hash_check (const char *stored, unsigned int stored_len,
+                     const char *pass, unsigned int pass_len,
+                     atomic_ullong *tries, const int *cancel)
+{
+    uint8_t key[HEV_SHA256_SIZE];
+    HevAuthHashCache *cache;
+    HevAuthHash hash;
+    int res;
+
+    if (stored_len > 255 || pass_len > 255)
+        return -1;
+
+    pthread_once (&once, hev_auth_hash_init);
+
+    hev_auth_hash_cache_key (stored, stored_len, pass, pass_len, key);
+    cache = hev_auth_hash_cache ();
+    if (cache && hev_auth_hash_cache_get (cache, key) == 0)
+        return 0;
+
+    if (hev_auth_hash_parse (&hash, stored, stored_len) < 0) {
+        LOG_E ("auth hash format");
+        return -1;
+    }
+
+    /* Wrong guesses must not keep the hashing threads busy for others. */
+    if (tries && hev_auth_hash_admit (tries) < 0) {
+        LOG_D ("auth hash rate limit");
+        return -1;
+    }
+
+    if (job_ready)
+        res = hev_auth_hash_offload (&hash, pass, pass_len, cancel);
+    else
+        res = hev_auth_hash_verify (&hash, pass, pass_len);
+
+    /* Only successes are cached, a wrong guess always pays the full cost. */
+    if (res == 0 && cache)
+        hev_auth_hash_cache_put (cache, key);
+
+    return res;
+}
+
+int
+hev_auth_hash_make (const char *pass, unsigned int pass_len, char *out,
+                    size_t size)
+{
+    uint8_t salt[HASH_SALT_SIZE];
+    HevAuthHash hash;
+    char salt_str[32];
+    char sum_str[48];
+    int len;
+    int fd;
+
+    fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    len = read (fd, salt, sizeof (salt));
+    close (fd);
+    if (len != sizeof (salt))
+        return -1;
+
+    hev_pbkdf2_sha256 (pass, pass_len, salt, sizeof (salt), HASH_ROUNDS,
+                       hash.sum, sizeof (hash.sum));
+
+    len = ab64_encode (salt, sizeof (salt), salt_str);
+    salt_str[len] = '\0';
+    len = ab64_encode (hash.sum, sizeof (hash.sum), sum_str);
+    sum_str[len] = '\0';
+
+    len = snprintf (out, size, HASH_PREFIX "%u$%s$%s", HASH_ROUNDS, salt_str,
+                    sum_str);
+    if (len < 0 || (size_t)len >= size)
+        return -1;
+
+    return len;
+}
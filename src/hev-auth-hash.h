@@ -0,0 +1,41 @@
+/*
+ ============================================================================
+ Name        : hev-auth-hash.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Hashed Password
+ ============================================================================
+ */
+
+#ifndef __HEV_AUTH_HASH_H__
+#define __HEV_AUTH_HASH_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+int hev_auth_hash_is_hashed (const char *stored, unsigned int stored_len);
+
+/**
+ * hev_auth_hash_check:
+ * @stored: a stored hash
+ * @stored_len: length of @stored
+ * @pass: the password to check
+ * @pass_len: length of @pass
+ * @tries: (nullable): uncached checks of the user in the current second
+ * @cancel: (nullable): set to give up waiting for the hash
+ *
+ * Check @pass against @stored. Unless a success is cached on the calling
+ * thread, the hash is computed on a helper thread while the calling task
+ * waits, and at most a few of them are let through per second by @tries.
+ *
+ * Returns: returns zero on match, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_auth_hash_check (const char *stored, unsigned int stored_len,
+                         const char *pass, unsigned int pass_len,
+                         atomic_ullong *tries, const int *cancel);
+int hev_auth_hash_make (const char *pass, unsigned int pass_len, char *out,
+                        size_t size);
+
+#endif /* __HEV_AUTH_HASH_H__ */
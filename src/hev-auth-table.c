@@ -0,0 +1,155 @@
+/*
+ ============================================================================
+ Name        : hev-auth-table.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Auth Table
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-auth-table.h"
+
+#define TABLE_MIN_SIZE (16)
+
+typedef struct _HevAuthTableSlot HevAuthTableSlot;
+
+struct _HevAuthTableSlot
+{
+    unsigned int hash;
+    HevSocks5User *user;
+};
+
+struct _HevAuthTable
+{
+    unsigned int size;
+    unsigned int used;
+    HevAuthTableSlot slots[];
+};
+
+/* Taken by removed users, so probes go on past them. */
+static char tombstone;
+
+#define TOMBSTONE ((HevSocks5User *)&tombstone)
+
+static unsigned int
+name_hash (const char *name, unsigned int len)
+{
+    unsigned int hash = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void
+hev_auth_table_put (HevAuthTable *self, unsigned int hash, HevSocks5User *user)
+{
+    unsigned int mask = self->size - 1;
+    unsigned int i;
+
+    for (i = hash & mask; self->slots[i].user; i = (i + 1) & mask)
+        ;
+
+    self->slots[i].hash = hash;
+    self->slots[i].user = user;
+    self->used++;
+}
+
+HevAuthTable *
+hev_auth_table_new (const HevAuthTable *prev, unsigned int num)
+{
+    HevAuthTable *self;
+    unsigned int size;
+    unsigned int i;
+
+    /* At most half full, so probes stay short. */
+    for (size = TABLE_MIN_SIZE; size < (num * 2); size <<= 1)
+        ;
+
+    self = hev_malloc (sizeof (HevAuthTable) +
+                       sizeof (HevAuthTableSlot) * size);
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p auth table new", self);
+
+    self->size = size;
+    self->used = 0;
+    memset (self->slots, 0, sizeof (HevAuthTableSlot) * size);
+
+    /* Users of @prev are put back, the slots of removed ones are dropped. */
+    for (i = 0; prev && i < prev->size; i++) {
+        const HevAuthTableSlot *slot = &prev->slots[i];
+
+        if (slot->user && slot->user != TOMBSTONE)
+            hev_auth_table_put (self, slot->hash, slot->user);
+    }
+
+    return self;
+}
+
+void
+hev_auth_table_destroy (HevAuthTable *self)
+{
+    LOG_D ("%p auth table destroy", self);
+
+    hev_free (self);
+}
+
+int
+hev_auth_table_add (HevAuthTable *self, HevSocks5User *user)
+{
+    if ((self->used + 1) * 2 > self->size)
+        return -1;
+
+    hev_auth_table_put (self, name_hash (user->name, user->name_len), user);
+
+    return 0;
+}
+
+void
+hev_auth_table_del (HevAuthTable *self, HevSocks5User *user)
+{
+    unsigned int hash = name_hash (user->name, user->name_len);
+    unsigned int mask = self->size - 1;
+    unsigned int i;
+
+    for (i = hash & mask; self->slots[i].user; i = (i + 1) & mask) {
+        if (self->slots[i].user == user) {
+            self->slots[i].user = TOMBSTONE;
+            return;
+        }
+    }
+}
+
+HevSocks5User *
+hev_auth_table_get (const HevAuthTable *self, const char *name,
+                    unsigned int name_len)
+{
+    unsigned int hash = name_hash (name, name_len);
+    unsigned int mask = self->size - 1;
+    unsigned int i;
+
+    for (i = hash & mask; self->slots[i].user; i = (i + 1) & mask) {
+        const HevAuthTableSlot *slot = &self->slots[i];
+
+        if (slot->hash != hash || slot->user == TOMBSTONE)
+            continue;
+        if (slot->user->name_len != name_len)
+            continue;
+        if (memcmp (slot->user->name, name, name_len) == 0)
+            return slot->user;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,81 @@
+/*
+ ============================================================================
+ Name        : hev-auth-table.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Auth Table
+ ============================================================================
+ */
+
+#ifndef __HEV_AUTH_TABLE_H__
+#define __HEV_AUTH_TABLE_H__
+
+#include <hev-socks5-user.h>
+
+typedef struct _HevAuthTable HevAuthTable;
+
+/**
+ * hev_auth_table_new:
+ * @prev: (nullable): a #HevAuthTable to start from
+ * @num: the number of users the table is going to hold
+ *
+ * Create a table of users by name, with the users of @prev. The table is
+ * only changed until it is published, readers on other threads then look
+ * users up without any locking. It holds no references to its users.
+ *
+ * Returns: returns table on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevAuthTable *hev_auth_table_new (const HevAuthTable *prev, unsigned int num);
+
+/**
+ * hev_auth_table_destroy:
+ * @self: a #HevAuthTable
+ *
+ * Destroy the table, once no reader can be using it any longer.
+ *
+ * Since: 2.14
+ */
+void hev_auth_table_destroy (HevAuthTable *self);
+
+/**
+ * hev_auth_table_add:
+ * @self: a #HevAuthTable
+ * @user: a #HevSocks5User
+ *
+ * Add @user, there must be enough room for it.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_auth_table_add (HevAuthTable *self, HevSocks5User *user);
+
+/**
+ * hev_auth_table_del:
+ * @self: a #HevAuthTable
+ * @user: a #HevSocks5User
+ *
+ * Remove @user, if it is in the table.
+ *
+ * Since: 2.14
+ */
+void hev_auth_table_del (HevAuthTable *self, HevSocks5User *user);
+
+/**
+ * hev_auth_table_get:
+ * @self: a #HevAuthTable
+ * @name: user name
+ * @name_len: length of user name
+ *
+ * Look a user up by name.
+ *
+ * Returns: returns the user, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevSocks5User *hev_auth_table_get (const HevAuthTable *self, const char *name,
+                                   unsigned int name_len);
+
+#endif /* __HEV_AUTH_TABLE_H__ */
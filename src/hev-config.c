@@ -19,6 +19,8 @@
 #include "hev-config.h"
 
 static unsigned int workers;
+static unsigned int max_workers;
+static int auto_scale;
 static int listen_ipv6_only;
 static char listen_address[256];
 static char listen_port[8];
@@ -26,24 +28,53 @@ static char udp_listen_address[256];
 static char udp_public_address[2][256];
 static char bind_address[2][256];
 static char bind_interface[256];
+static char bind_address_pool[1024];
 static char auth_file[1024];
+static char acl_source_file[1024];
+static char acl_destination_file[1024];
 static char username[256];
 static char password[256];
 static char log_file[1024];
 static char pid_file[1024];
+static char stats_file[1024];
+static char handover_socket[1024];
 static int udp_listen_port_beg;
 static int udp_listen_port_mod;
 static int task_stack_size;
+static int task_pool_size;
 static int udp_recv_buffer_size;
 static int udp_copy_buffer_nums;
 static int connect_timeout;
 static int tcp_read_write_timeout;
 static int udp_read_write_timeout;
 static int limit_nofile;
+static int stats_interval;
 static int log_level;
 static int addr_family;
 static unsigned int socket_mark;
 static int tcp_fastopen;
+static int tcp_fastopen_qlen;
+static int tcp_defer_accept;
+static int listen_backlog;
+static int listen_incoming_cpu;
+static int listen_cpu_steering;
+static int cpu_affinity;
+static int bind_least_used;
+static int accept_batch;
+static int max_sessions;
+static int max_worker_sessions;
+static unsigned int auth_max_sessions;
+static unsigned int auth_max_connects;
+static int overload_reject;
+static int timer_wheel;
+static int io_uring;
+static unsigned int dns_cache_size;
+static unsigned int dns_cache_ttl;
+static unsigned int dns_cache_negative_ttl;
+static int dns_cache_prefetch;
+static int dns_native;
+static char dns_resolv_conf[1024];
+static char dns_hosts_file[1024];
 
 static int
 hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
@@ -53,6 +84,12 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
     const char *port = NULL;
     const char *mark = NULL;
     const char *tfso = NULL;
+    const char *tfsq = NULL;
+    const char *tdfa = NULL;
+    const char *backlog = NULL;
+    const char *incpu = NULL;
+    const char *steer = NULL;
+    const char *affinity = NULL;
     const char *udp_addr = NULL;
     const char *udp_addr4 = NULL;
     const char *udp_addr6 = NULL;
@@ -61,6 +98,8 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
     const char *bind_saddr4 = NULL;
     const char *bind_saddr6 = NULL;
     const char *bind_iface = NULL;
+    const char *bind_pool = NULL;
+    const char *bind_select = NULL;
     const char *addr_type = NULL;
 
     if (!base || YAML_MAPPING_NODE != base->type)
@@ -86,6 +125,10 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
 
         if (0 == strcmp (key, "workers"))
             workers = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-workers"))
+            max_workers = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "auto-scale"))
+            auto_scale = (0 == strcasecmp (value, "true")) ? 1 : 0;
         else if (0 == strcmp (key, "port"))
             port = value;
         else if (0 == strcmp (key, "listen-address"))
@@ -108,12 +151,28 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
             bind_saddr6 = value;
         else if (0 == strcmp (key, "bind-interface"))
             bind_iface = value;
+        else if (0 == strcmp (key, "bind-address-pool"))
+            bind_pool = value;
+        else if (0 == strcmp (key, "bind-address-select"))
+            bind_select = value;
         else if (0 == strcmp (key, "domain-address-type"))
             addr_type = value;
         else if (0 == strcmp (key, "mark"))
             mark = value;
         else if (0 == strcmp (key, "tcp-fastopen"))
             tfso = value;
+        else if (0 == strcmp (key, "tcp-fastopen-qlen"))
+            tfsq = value;
+        else if (0 == strcmp (key, "tcp-defer-accept"))
+            tdfa = value;
+        else if (0 == strcmp (key, "listen-backlog"))
+            backlog = value;
+        else if (0 == strcmp (key, "listen-incoming-cpu"))
+            incpu = value;
+        else if (0 == strcmp (key, "listen-cpu-steering"))
+            steer = value;
+        else if (0 == strcmp (key, "cpu-affinity"))
+            affinity = value;
     }
 
     if (!workers) {
@@ -136,8 +195,12 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
         fprintf (stderr, "Only supports one worker on Windows.\n");
         workers = 1;
     }
+    max_workers = 1;
 #endif
 
+    if (max_workers < workers)
+        max_workers = workers;
+
     strncpy (listen_port, port, 8 - 1);
     strncpy (listen_address, addr, 256 - 1);
 
@@ -175,6 +238,18 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
     if (bind_iface)
         strncpy (bind_interface, bind_iface, 256 - 1);
 
+    if (bind_pool)
+        strncpy (bind_address_pool, bind_pool, 1024 - 1);
+
+    if (bind_select) {
+        if (0 == strcmp (bind_select, "least-used")) {
+            bind_least_used = 1;
+        } else if (0 != strcmp (bind_select, "hash")) {
+            fprintf (stderr, "Invalid main.bind-address-select!\n");
+            return -1;
+        }
+    }
+
     if (addr_type) {
         if (0 == strcmp (addr_type, "ipv4"))
             addr_family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
@@ -188,6 +263,24 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
     if (tfso)
         tcp_fastopen = (0 == strcasecmp (tfso, "true")) ? 1 : 0;
 
+    if (tfsq)
+        tcp_fastopen_qlen = strtoul (tfsq, NULL, 10);
+
+    if (tdfa)
+        tcp_defer_accept = strtoul (tdfa, NULL, 10);
+
+    if (backlog)
+        listen_backlog = strtoul (backlog, NULL, 10);
+
+    if (incpu)
+        listen_incoming_cpu = (0 == strcasecmp (incpu, "true")) ? 1 : 0;
+
+    if (steer)
+        listen_cpu_steering = (0 == strcasecmp (steer, "true")) ? 1 : 0;
+
+    if (affinity)
+        cpu_affinity = (0 == strcasecmp (affinity, "true")) ? 1 : 0;
+
     return 0;
 }
 
@@ -224,6 +317,10 @@ hev_config_parse_auth (yaml_document_t *doc, yaml_node_t *base)
             pass = value;
         else if (0 == strcmp (key, "file"))
             file = value;
+        else if (0 == strcmp (key, "max-sessions"))
+            auth_max_sessions = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-connects"))
+            auth_max_connects = strtoul (value, NULL, 10);
     }
 
     if (file) {
@@ -249,6 +346,96 @@ hev_config_parse_log_level (const char *value)
     return HEV_LOGGER_WARN;
 }
 
+static int
+hev_config_parse_acl (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            continue;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "source-file"))
+            strncpy (acl_source_file, value, 1023);
+        else if (0 == strcmp (key, "destination-file"))
+            strncpy (acl_destination_file, value, 1023);
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_dns (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+    const char *resolver = NULL;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            continue;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "cache-size"))
+            dns_cache_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-ttl"))
+            dns_cache_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-negative-ttl"))
+            dns_cache_negative_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-prefetch"))
+            dns_cache_prefetch = (0 == strcasecmp (value, "true")) ? 1 : 0;
+        else if (0 == strcmp (key, "resolver"))
+            resolver = value;
+        else if (0 == strcmp (key, "resolv-conf"))
+            strncpy (dns_resolv_conf, value, 1024 - 1);
+        else if (0 == strcmp (key, "hosts-file"))
+            strncpy (dns_hosts_file, value, 1024 - 1);
+    }
+
+    if (resolver) {
+        if (0 == strcmp (resolver, "native")) {
+            dns_native = 1;
+        } else if (0 != strcmp (resolver, "system")) {
+            fprintf (stderr, "Invalid dns.resolver!\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static int
 hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
 {
@@ -280,6 +467,8 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
 
         if (0 == strcmp (key, "task-stack-size"))
             task_stack_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "task-pool-size"))
+            task_pool_size = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-recv-buffer-size"))
             udp_recv_buffer_size = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-copy-buffer-nums"))
@@ -298,9 +487,35 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
             strncpy (log_file, value, 1024 - 1);
         else if (0 == strcmp (key, "log-level"))
             log_level = hev_config_parse_log_level (value);
+        else if (0 == strcmp (key, "stats-file"))
+            strncpy (stats_file, value, 1024 - 1);
+        else if (0 == strcmp (key, "handover-socket"))
+            strncpy (handover_socket, value, 1024 - 1);
+        else if (0 == strcmp (key, "stats-interval"))
+            stats_interval = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "limit-nofile"))
             limit_nofile = strtol (value, NULL, 10);
+        else if (0 == strcmp (key, "io-uring"))
+            io_uring = (0 == strcasecmp (value, "true")) ? 1 : 0;
+        else if (0 == strcmp (key, "accept-batch"))
+            accept_batch = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-sessions"))
+            max_sessions = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-worker-sessions"))
+            max_worker_sessions = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "overload-reject"))
+            overload_reject = (0 == strcasecmp (value, "true")) ? 1 : 0;
+        else if (0 == strcmp (key, "timer-wheel"))
+            timer_wheel = (0 == strcasecmp (value, "true")) ? 1 : 0;
+    }
+
+#if !defined(__linux__)
+    /* Idle times of the wheel come from TCP_INFO. */
+    if (timer_wheel) {
+        fprintf (stderr, "Only supports misc.timer-wheel on Linux.\n");
+        timer_wheel = 0;
     }
+#endif
 
     if (tcp_rw_timeout <= 0)
         tcp_rw_timeout = rw_timeout;
@@ -345,6 +560,10 @@ hev_config_parse_doc (yaml_document_t *doc)
             res = hev_config_parse_main (doc, node);
         else if (0 == strcmp (key, "auth"))
             res = hev_config_parse_auth (doc, node);
+        else if (0 == strcmp (key, "acl"))
+            res = hev_config_parse_acl (doc, node);
+        else if (0 == strcmp (key, "dns"))
+            res = hev_config_parse_dns (doc, node);
         else if (0 == strcmp (key, "misc"))
             res = hev_config_parse_misc (doc, node);
 
@@ -359,20 +578,44 @@ static void
 hev_config_reset (void)
 {
     workers = 0;
+    max_workers = 0;
+    auto_scale = 0;
     listen_ipv6_only = 0;
     udp_listen_port_beg = 0;
     udp_listen_port_mod = 0;
     task_stack_size = 8192;
+    task_pool_size = 64;
     udp_recv_buffer_size = 524288;
     udp_copy_buffer_nums = 10;
     connect_timeout = 10000;
     tcp_read_write_timeout = 300000;
     udp_read_write_timeout = 60000;
     limit_nofile = 65535;
+    stats_interval = 10000;
     log_level = HEV_LOGGER_WARN;
     addr_family = HEV_SOCKS5_ADDR_FAMILY_UNSPEC;
     socket_mark = 0;
     tcp_fastopen = 0;
+    tcp_fastopen_qlen = 100;
+    tcp_defer_accept = 0;
+    listen_backlog = 100;
+    listen_incoming_cpu = 0;
+    listen_cpu_steering = 0;
+    cpu_affinity = 0;
+    bind_least_used = 0;
+    io_uring = 0;
+    accept_batch = 64;
+    max_sessions = 0;
+    max_worker_sessions = 0;
+    auth_max_sessions = 0;
+    auth_max_connects = 0;
+    overload_reject = 0;
+    timer_wheel = 0;
+    dns_cache_size = 0;
+    dns_cache_ttl = 60;
+    dns_cache_negative_ttl = 10;
+    dns_cache_prefetch = 0;
+    dns_native = 0;
 
     memset (listen_address, 0, sizeof (listen_address));
     memset (listen_port, 0, sizeof (listen_port));
@@ -380,11 +623,19 @@ hev_config_reset (void)
     memset (udp_public_address, 0, sizeof (udp_public_address));
     memset (bind_address, 0, sizeof (bind_address));
     memset (bind_interface, 0, sizeof (bind_interface));
+    memset (bind_address_pool, 0, sizeof (bind_address_pool));
     memset (auth_file, 0, sizeof (auth_file));
+    memset (acl_source_file, 0, sizeof (acl_source_file));
+    memset (acl_destination_file, 0, sizeof (acl_destination_file));
     memset (username, 0, sizeof (username));
     memset (password, 0, sizeof (password));
     memset (log_file, 0, sizeof (log_file));
     memset (pid_file, 0, sizeof (pid_file));
+    memset (stats_file, 0, sizeof (stats_file));
+    memset (handover_socket, 0, sizeof (handover_socket));
+
+    strcpy (dns_resolv_conf, "/etc/resolv.conf");
+    strcpy (dns_hosts_file, "/etc/hosts");
 }
 
 int
@@ -457,6 +708,18 @@ hev_config_get_workers (void)
     return workers;
 }
 
+unsigned int
+hev_config_get_max_workers (void)
+{
+    return max_workers;
+}
+
+int
+hev_config_get_auto_scale (void)
+{
+    return auto_scale;
+}
+
 const char *
 hev_config_get_listen_address (void)
 {
@@ -508,6 +771,30 @@ hev_config_get_listen_ipv6_only (void)
     return listen_ipv6_only;
 }
 
+int
+hev_config_get_listen_backlog (void)
+{
+    return listen_backlog;
+}
+
+int
+hev_config_get_listen_incoming_cpu (void)
+{
+    return listen_incoming_cpu;
+}
+
+int
+hev_config_get_listen_cpu_steering (void)
+{
+    return listen_cpu_steering;
+}
+
+int
+hev_config_get_cpu_affinity (void)
+{
+    return cpu_affinity;
+}
+
 const char *
 hev_config_get_bind_address (int family)
 {
@@ -519,6 +806,21 @@ hev_config_get_bind_address (int family)
     return bind_address[idx];
 }
 
+const char *
+hev_config_get_bind_address_pool (void)
+{
+    if ('\0' == bind_address_pool[0])
+        return NULL;
+
+    return bind_address_pool;
+}
+
+int
+hev_config_get_bind_address_least_used (void)
+{
+    return bind_least_used;
+}
+
 const char *
 hev_config_get_bind_interface (void)
 {
@@ -546,6 +848,18 @@ hev_config_get_tcp_fastopen (void)
     return tcp_fastopen;
 }
 
+int
+hev_config_get_tcp_fastopen_qlen (void)
+{
+    return tcp_fastopen_qlen;
+}
+
+int
+hev_config_get_tcp_defer_accept (void)
+{
+    return tcp_defer_accept;
+}
+
 const char *
 hev_config_get_auth_file (void)
 {
@@ -573,12 +887,90 @@ hev_config_get_auth_password (void)
     return password;
 }
 
+unsigned int
+hev_config_get_auth_max_sessions (void)
+{
+    return auth_max_sessions;
+}
+
+unsigned int
+hev_config_get_auth_max_connects (void)
+{
+    return auth_max_connects;
+}
+
+const char *
+hev_config_get_acl_source_file (void)
+{
+    if ('\0' == acl_source_file[0])
+        return NULL;
+
+    return acl_source_file;
+}
+
+const char *
+hev_config_get_acl_destination_file (void)
+{
+    if ('\0' == acl_destination_file[0])
+        return NULL;
+
+    return acl_destination_file;
+}
+
+unsigned int
+hev_config_get_dns_cache_size (void)
+{
+    return dns_cache_size;
+}
+
+unsigned int
+hev_config_get_dns_cache_ttl (void)
+{
+    return dns_cache_ttl;
+}
+
+unsigned int
+hev_config_get_dns_cache_negative_ttl (void)
+{
+    return dns_cache_negative_ttl;
+}
+
+int
+hev_config_get_dns_cache_prefetch (void)
+{
+    return dns_cache_prefetch;
+}
+
+int
+hev_config_get_dns_native (void)
+{
+    return dns_native;
+}
+
+const char *
+hev_config_get_dns_resolv_conf (void)
+{
+    return dns_resolv_conf;
+}
+
+const char *
+hev_config_get_dns_hosts_file (void)
+{
+    return dns_hosts_file;
+}
+
 int
 hev_config_get_misc_task_stack_size (void)
 {
     return task_stack_size;
 }
 
+int
+hev_config_get_misc_task_pool_size (void)
+{
+    return task_pool_size;
+}
+
 int
 hev_config_get_misc_udp_recv_buffer_size (void)
 {
@@ -615,6 +1007,46 @@ hev_config_get_misc_limit_nofile (void)
     return limit_nofile;
 }
 
+int
+hev_config_get_misc_io_uring (void)
+{
+    return io_uring;
+}
+
+int
+hev_config_get_misc_accept_batch (void)
+{
+    return accept_batch;
+}
+
+int
+hev_config_get_misc_max_sessions (void)
+{
+    return max_sessions;
+}
+
+int
+hev_config_get_misc_max_worker_sessions (void)
+{
+    return max_worker_sessions;
+}
+
+int
+hev_config_get_misc_overload_reject (void)
+{
+    return overload_reject;
+}
+
+int
+hev_config_get_misc_timer_wheel (void)
+{
+#if defined(__linux__)
+    return timer_wheel;
+#else
+    return 0;
+#endif
+}
+
 const char *
 hev_config_get_misc_pid_file (void)
 {
@@ -640,3 +1072,27 @@ hev_config_get_misc_log_level (void)
 {
     return log_level;
 }
+
+const char *
+hev_config_get_misc_stats_file (void)
+{
+    if ('\0' == stats_file[0])
+        return NULL;
+
+    return stats_file;
+}
+
+int
+hev_config_get_misc_stats_interval (void)
+{
+    return stats_interval;
+}
+
+const char *
+hev_config_get_misc_handover_socket (void)
+{
+    if ('\0' == handover_socket[0])
+        return NULL;
+
+    return handover_socket;
+}
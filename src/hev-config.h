@@ -15,6 +15,8 @@ int hev_config_init_from_str (const unsigned char *config_str,
                               unsigned int config_len);
 
 unsigned int hev_config_get_workers (void);
+unsigned int hev_config_get_max_workers (void);
+int hev_config_get_auto_scale (void);
 
 const char *hev_config_get_listen_address (void);
 const char *hev_config_get_listen_port (void);
@@ -22,27 +24,58 @@ const char *hev_config_get_udp_listen_address (void);
 int hev_config_get_udp_listen_port (void);
 const char *hev_config_get_udp_public_address (int family);
 int hev_config_get_listen_ipv6_only (void);
+int hev_config_get_listen_backlog (void);
+int hev_config_get_listen_incoming_cpu (void);
+int hev_config_get_listen_cpu_steering (void);
+int hev_config_get_cpu_affinity (void);
 
 const char *hev_config_get_bind_address (int family);
+const char *hev_config_get_bind_address_pool (void);
+int hev_config_get_bind_address_least_used (void);
 const char *hev_config_get_bind_interface (void);
 
 int hev_config_get_address_family (void);
 unsigned int hev_config_get_socket_mark (void);
 int hev_config_get_tcp_fastopen (void);
+int hev_config_get_tcp_fastopen_qlen (void);
+int hev_config_get_tcp_defer_accept (void);
 
 const char *hev_config_get_auth_file (void);
 const char *hev_config_get_auth_username (void);
 const char *hev_config_get_auth_password (void);
+unsigned int hev_config_get_auth_max_sessions (void);
+unsigned int hev_config_get_auth_max_connects (void);
+
+const char *hev_config_get_acl_source_file (void);
+const char *hev_config_get_acl_destination_file (void);
+
+unsigned int hev_config_get_dns_cache_size (void);
+unsigned int hev_config_get_dns_cache_ttl (void);
+unsigned int hev_config_get_dns_cache_negative_ttl (void);
+int hev_config_get_dns_cache_prefetch (void);
+int hev_config_get_dns_native (void);
+const char *hev_config_get_dns_resolv_conf (void);
+const char *hev_config_get_dns_hosts_file (void);
 
 int hev_config_get_misc_task_stack_size (void);
+int hev_config_get_misc_task_pool_size (void);
 int hev_config_get_misc_udp_recv_buffer_size (void);
 int hev_config_get_misc_udp_copy_buffer_nums (void);
 int hev_config_get_misc_connect_timeout (void);
 int hev_config_get_misc_tcp_read_write_timeout (void);
 int hev_config_get_misc_udp_read_write_timeout (void);
 int hev_config_get_misc_limit_nofile (void);
+int hev_config_get_misc_io_uring (void);
+int hev_config_get_misc_accept_batch (void);
+int hev_config_get_misc_max_sessions (void);
+int hev_config_get_misc_max_worker_sessions (void);
+int hev_config_get_misc_overload_reject (void);
+int hev_config_get_misc_timer_wheel (void);
 const char *hev_config_get_misc_pid_file (void);
 const char *hev_config_get_misc_log_file (void);
 int hev_config_get_misc_log_level (void);
+const char *hev_config_get_misc_stats_file (void);
+int hev_config_get_misc_stats_interval (void);
+const char *hev_config_get_misc_handover_socket (void);
 
 #endif /* __HEV_CONFIG_H__ */
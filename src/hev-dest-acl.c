@@ -0,0 +1,632 @@
+/*
+ ============================================================================
+ Name        : hev-dest-acl.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Destination ACL
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-cidr-trie.h"
+#include "hev-domain-trie.h"
+
+#include "hev-dest-acl.h"
+
+enum
+{
+    ACL_NONE = -1,
+    ACL_ALLOW = 0,
+    ACL_DENY = 1,
+};
+
+typedef struct _HevDestAclRule HevDestAclRule;
+typedef struct _HevDestAclSet HevDestAclSet;
+typedef struct _HevDestAclUser HevDestAclUser;
+typedef struct _HevDestAclEntry HevDestAclEntry;
+typedef struct _HevDestAclPolicy HevDestAclPolicy;
+
+struct _HevDestAclRule
+{
+    uint16_t lo;
+    uint16_t hi;
+    int action;
+};
+
+/*
+ * The rules of one target, in file order. A target whose rules do not
+ * cover a port falls back to the closest target containing it.
+ */
+struct _HevDestAclSet
+{
+    unsigned int first;
+    unsigned int num;
+    int parent;
+};
+
+struct _HevDestAclUser
+{
+    unsigned int hash;
+    unsigned int name;
+    unsigned int len;
+    unsigned int policy;
+};
+
+struct _HevDestAclPolicy
+{
+    HevCidrTrie cidr;
+    HevDomainTrie domain;
+};
+
+/* A parsed rule, only kept while compiling. */
+struct _HevDestAclEntry
+{
+    unsigned int policy;
+    unsigned int seq;
+    unsigned int plen;
+    unsigned int name;
+    int domain;
+    int action;
+    uint16_t lo;
+    uint16_t hi;
+    uint8_t addr[16];
+};
+
+struct _HevDestAcl
+{
+    unsigned int num_policies;
+    unsigned int num_entries;
+    unsigned int max_entries;
+    unsigned int users_mask;
+    unsigned int names_len;
+    unsigned int names_max;
+
+    char *names;
+    HevDestAclSet *sets;
+    HevDestAclRule *rules;
+    HevDestAclUser *users;
+    HevDestAclEntry *entries;
+    HevDestAclPolicy *policies;
+};
+
+/* Entries are sorted by this while compiling. */
+static const char *sort_names;
+
+static unsigned int
+name_hash (const char *name, unsigned int len)
+{
+    unsigned int hash = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static int
+hev_dest_acl_name_add (HevDestAcl *self, const char *name, unsigned int len)
+{
+    unsigned int off = self->names_len;
+
+    if ((self->names_len + len + 1) > self->names_max) {
+        unsigned int max = self->names_max ? self->names_max * 2 : 4096;
+        char *names;
+
+        while (max < (self->names_len + len + 1))
+            max *= 2;
+
+        names = realloc (self->names, max);
+        if (!names)
+            return -1;
+
+        self->names = names;
+        self->names_max = max;
+    }
+
+    memcpy (&self->names[off], name, len);
+    self->names[off + len] = '\0';
+    self->names_len += len + 1;
+
+    return off;
+}
+
+static HevDestAclUser *
+hev_dest_acl_user_find (const HevDestAcl *self, const char *name,
+                        unsigned int len, unsigned int hash)
+{
+    unsigned int i;
+
+    if (!self->users)
+        return NULL;
+
+    for (i = hash & self->users_mask;; i = (i + 1) & self->users_mask) {
+        HevDestAclUser *u = &self->users[i];
+
+        if (!u->policy)
+            return &self->users[i];
+        if (u->hash == hash && u->len == len &&
+            memcmp (&self->names[u->name], name, len) == 0)
+            return &self->users[i];
+    }
+}
+
+static int
+hev_dest_acl_policy_new (HevDestAcl *self)
+{
+    HevDestAclPolicy *policies;
+    unsigned int num = self->num_policies;
+
+    policies = realloc (self->policies, sizeof (HevDestAclPolicy) * (num + 1));
+    if (!policies)
+        return -1;
+
+    hev_cidr_trie_init (&policies[num].cidr);
+    hev_domain_trie_init (&policies[num].domain);
+    self->policies = policies;
+    self->num_policies++;
+
+    return num;
+}
+
+static int
+hev_dest_acl_user_policy (HevDestAcl *self, const char *name, unsigned int len)
+{
+    HevDestAclUser *u;
+    unsigned int hash;
+    int policy;
+    int off;
+
+    hash = name_hash (name, len);
+    u = hev_dest_acl_user_find (self, name, len, hash);
+    if (u && u->policy)
+        return u->policy;
+
+    /* Keep the table at most half full, so probes stay short. */
+    if (!self->users || (self->num_policies * 2) > self->users_mask) {
+        unsigned int size = self->users ? (self->users_mask + 1) * 2 : 64;
+        HevDestAclUser *users;
+        unsigned int i;
+
+        users = calloc (size, sizeof (HevDestAclUser));
+        if (!users)
+            return -1;
+
+        for (i = 0; self->users && i <= self->users_mask; i++) {
+            unsigned int j;
+
+            if (!self->users[i].policy)
+                continue;
+
+            j = self->users[i].hash & (size - 1);
+            for (; users[j].policy; j = (j + 1) & (size - 1))
+                ;
+            users[j] = self->users[i];
+        }
+
+        free (self->users);
+        self->users = users;
+        self->users_mask = size - 1;
+    }
+
+    off = hev_dest_acl_name_add (self, name, len);
+    if (off < 0)
+        return -1;
+
+    policy = hev_dest_acl_policy_new (self);
+    if (policy < 0)
+        return -1;
+
+    u = hev_dest_acl_user_find (self, name, len, hash);
+    u->hash = hash;
+    u->name = off;
+    u->len = len;
+    u->policy = policy;
+
+    return policy;
+}
+
+static int
+hev_dest_acl_parse_ports (const char *str, uint16_t *lo, uint16_t *hi,
+                          const char **next)
+{
+    unsigned long a, b;
+    char *end;
+
+    if (str[0] == '*') {
+        *lo = 0;
+        *hi = 65535;
+        *next = str + 1;
+        return 0;
+    }
+
+    a = strtoul (str, &end, 10);
+    if (end == str || a > 65535)
+        return -1;
+
+    b = a;
+    if (*end == '-') {
+        str = end + 1;
+        b = strtoul (str, &end, 10);
+        if (end == str || b > 65535 || b < a)
+            return -1;
+    }
+
+    *lo = a;
+    *hi = b;
+    *next = end;
+
+    return 0;
+}
+
+static int
+hev_dest_acl_add (HevDestAcl *self, HevDestAclEntry *entry)
+{
+    if (self->num_entries == self->max_entries) {
+        unsigned int max = self->max_entries ? self->max_entries * 2 : 256;
+        HevDestAclEntry *entries;
+
+        entries = realloc (self->entries, sizeof (HevDestAclEntry) * max);
+        if (!entries)
+            return -1;
+
+        self->entries = entries;
+        self->max_entries = max;
+    }
+
+    entry->seq = self->num_entries;
+    self->entries[self->num_entries++] = *entry;
+
+    return 0;
+}
+
+static int
+hev_dest_acl_parse_target (HevDestAcl *self, HevDestAclEntry *entry,
+                           char *target)
+{
+    unsigned int len = strlen (target);
+    unsigned int i;
+    int off;
+
+    if (hev_cidr_trie_parse (target, len, entry->addr, &entry->plen) == 0) {
+        entry->domain = 0;
+        return 0;
+    }
+
+    /* A domain covers its subdomains, `*` covers every name. */
+    if (target[0] == '*' && target[1] == '.') {
+        target += 2;
+        len -= 2;
+    } else if (target[0] == '*' || target[0] == '.') {
+        target++;
+        len--;
+    }
+    if (len && target[len - 1] == '.')
+        len--;
+
+    entry->plen = len ? 1 : 0;
+    for (i = 0; i < len; i++) {
+        char c = target[i];
+
+        if (c >= 'A' && c <= 'Z')
+            target[i] |= 0x20;
+        else if (c == '.')
+            entry->plen++;
+        else if (!(c >= 'a' && c <= 'z') && !(c >= '0' && c <= '9') &&
+                 c != '-' && c != '_')
+            return -1;
+    }
+
+    off = hev_dest_acl_name_add (self, target, len);
+    if (off < 0)
+        return -1;
+
+    entry->domain = 1;
+    entry->name = off;
+
+    return 0;
+}
+
+static int
+hev_dest_acl_parse (HevDestAcl *self, char *line, unsigned int lineno)
+{
+    const char *sep = " \t\r\n";
+    const char *ports = "*";
+    HevDestAclEntry entry;
+    char *target;
+    char *action;
+    char *token;
+    char *save;
+
+    action = strtok_r (line, sep, &save);
+    if (!action || action[0] == '#')
+        return 0;
+
+    memset (&entry, 0, sizeof (entry));
+    if (strcmp (action, "allow") == 0)
+        entry.action = ACL_ALLOW;
+    else if (strcmp (action, "deny") == 0)
+        entry.action = ACL_DENY;
+    else
+        goto error;
+
+    target = strtok_r (NULL, sep, &save);
+    if (!target)
+        goto error;
+
+    while ((token = strtok_r (NULL, sep, &save))) {
+        if (strncmp (token, "user=", 5) == 0) {
+            int policy;
+
+            if (entry.policy || !token[5])
+                goto error;
+
+            policy = hev_dest_acl_user_policy (self, token + 5,
+                                               strlen (token + 5));
+            if (policy < 0)
+                return -1;
+            entry.policy = policy;
+        } else {
+            ports = token;
+        }
+    }
+
+    if (hev_dest_acl_parse_target (self, &entry, target) < 0)
+        goto error;
+
+    for (;;) {
+        if (hev_dest_acl_parse_ports (ports, &entry.lo, &entry.hi, &ports) < 0)
+            goto error;
+        if (hev_dest_acl_add (self, &entry) < 0)
+            return -1;
+        if (*ports == '\0')
+            break;
+        if (*ports++ != ',')
+            goto error;
+    }
+
+    return 0;
+
+error:
+    LOG_E ("dest acl line %u format", lineno);
+    return -1;
+}
+
+static int
+entry_key_compare (const HevDestAclEntry *a, const HevDestAclEntry *b)
+{
+    if (a->policy != b->policy)
+        return (a->policy < b->policy) ? -1 : 1;
+    if (a->domain != b->domain)
+        return a->domain - b->domain;
+    if (a->plen != b->plen)
+        return (a->plen < b->plen) ? -1 : 1;
+    if (a->domain)
+        return strcmp (&sort_names[a->name], &sort_names[b->name]);
+
+    return memcmp (a->addr, b->addr, 16);
+}
+
+static int
+entry_compare (const void *pa, const void *pb)
+{
+    const HevDestAclEntry *a = pa;
+    const HevDestAclEntry *b = pb;
+    int res;
+
+    res = entry_key_compare (a, b);
+    if (res)
+        return res;
+
+    return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+/*
+ * Targets are inserted from the shortest up, so a lookup right before an
+ * insert finds the closest enclosing target, which becomes the parent.
+ */
+static int
+hev_dest_acl_compile (HevDestAcl *self)
+{
+    HevDestAclEntry *e = self->entries;
+    unsigned int num = self->num_entries;
+    unsigned int sets = 0;
+    unsigned int i;
+
+    self->rules = malloc (sizeof (HevDestAclRule) * (num ? num : 1));
+    self->sets = malloc (sizeof (HevDestAclSet) * (num ? num : 1));
+    if (!self->rules || !self->sets)
+        return -1;
+
+    sort_names = self->names;
+    if (num)
+        qsort (e, num, sizeof (HevDestAclEntry), entry_compare);
+
+    for (i = 0; i < num; i++) {
+        HevDestAclPolicy *p = &self->policies[e[i].policy];
+        HevDestAclSet *s = &self->sets[sets];
+        int res;
+
+        self->rules[i].lo = e[i].lo;
+        self->rules[i].hi = e[i].hi;
+        self->rules[i].action = e[i].action;
+
+        if (i && entry_key_compare (&e[i - 1], &e[i]) == 0) {
+            self->sets[sets - 1].num++;
+            continue;
+        }
+
+        s->first = i;
+        s->num = 1;
+        if (e[i].domain) {
+            const char *name = &self->names[e[i].name];
+            unsigned int len = strlen (name);
+
+            s->parent = hev_domain_trie_lookup (&p->domain, name, len);
+            res = hev_domain_trie_insert (&p->domain, name, len, sets);
+        } else {
+            s->parent = hev_cidr_trie_lookup (&p->cidr, e[i].addr);
+            res = hev_cidr_trie_insert (&p->cidr, e[i].addr, e[i].plen, sets);
+        }
+        if (res < 0)
+            return -1;
+
+        sets++;
+    }
+
+    for (i = 0; i < self->num_policies; i++)
+        hev_cidr_trie_seal (&self->policies[i].cidr);
+
+    free (self->entries);
+    self->entries = NULL;
+    self->num_entries = 0;
+    self->max_entries = 0;
+
+    return sets;
+}
+
+HevDestAcl *
+hev_dest_acl_new (const char *path)
+{
+    HevDestAcl *self;
+    unsigned int lineno = 0;
+    char line[1024];
+    FILE *fp;
+    int res;
+
+    fp = fopen (path, "r");
+    if (!fp)
+        return NULL;
+
+    self = hev_malloc0 (sizeof (HevDestAcl));
+    if (!self) {
+        fclose (fp);
+        return NULL;
+    }
+
+    LOG_D ("%p dest acl new", self);
+
+    /* Policy 0 holds the rules for everyone. */
+    if (hev_dest_acl_policy_new (self) < 0)
+        goto exit;
+
+    while (fgets (line, sizeof (line), fp)) {
+        if (hev_dest_acl_parse (self, line, ++lineno) < 0)
+            goto exit;
+    }
+
+    res = hev_dest_acl_compile (self);
+    if (res < 0) {
+        LOG_E ("dest acl compile");
+        goto exit;
+    }
+
+    fclose (fp);
+
+    LOG_I ("dest acl %s loaded, %d targets, %u users", path, res,
+           self->num_policies - 1);
+
+    return self;
+
+exit:
+    fclose (fp);
+    hev_dest_acl_destroy (self);
+    return NULL;
+}
+
+void
+hev_dest_acl_destroy (HevDestAcl *self)
+{
+    unsigned int i;
+
+    LOG_D ("%p dest acl destroy", self);
+
+    for (i = 0; i < self->num_policies; i++) {
+        hev_cidr_trie_fini (&self->policies[i].cidr);
+        hev_domain_trie_fini (&self->policies[i].domain);
+    }
+
+    free (self->policies);
+    free (self->entries);
+    free (self->users);
+    free (self->rules);
+    free (self->sets);
+    free (self->names);
+    hev_free (self);
+}
+
+static int
+hev_dest_acl_eval (const HevDestAcl *self, int set, unsigned int port)
+{
+    while (set >= 0) {
+        const HevDestAclSet *s = &self->sets[set];
+        const HevDestAclRule *r = &self->rules[s->first];
+        unsigned int i;
+
+        for (i = 0; i < s->num; i++) {
+            if (port >= r[i].lo && port <= r[i].hi)
+                return r[i].action;
+        }
+
+        set = s->parent;
+    }
+
+    return ACL_NONE;
+}
+
+static int
+hev_dest_acl_policy_check (const HevDestAcl *self, const HevDestAclPolicy *p,
+                           const char *name, unsigned int len,
+                           const struct sockaddr_in6 *addr, unsigned int port)
+{
+    int res;
+    int set;
+
+    if (name) {
+        set = hev_domain_trie_lookup (&p->domain, name, len);
+        res = hev_dest_acl_eval (self, set, port);
+        if (res != ACL_NONE)
+            return res;
+    }
+
+    set = hev_cidr_trie_lookup (&p->cidr, addr->sin6_addr.s6_addr);
+    return hev_dest_acl_eval (self, set, port);
+}
+
+int
+hev_dest_acl_check (HevDestAcl *self, const char *user, unsigned int user_len,
+                    const char *name, const struct sockaddr_in6 *addr)
+{
+    unsigned int port = ntohs (addr->sin6_port);
+    unsigned int len = 0;
+    int res = ACL_NONE;
+
+    if (name)
+        len = strlen (name);
+
+    if (user && self->users) {
+        HevDestAclUser *u;
+
+        u = hev_dest_acl_user_find (self, user, user_len,
+                                    name_hash (user, user_len));
+        if (u->policy)
+            res = hev_dest_acl_policy_check (self, &self->policies[u->policy],
+                                             name, len, addr, port);
+    }
+
+    if (res == ACL_NONE)
+        res = hev_dest_acl_policy_check (self, &self->policies[0], name, len,
+                                         addr, port);
+
+    return (res == ACL_DENY) ? -1 : 0;
+}
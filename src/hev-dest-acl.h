@@ -0,0 +1,61 @@
+/*
+ ============================================================================
+ Name        : hev-dest-acl.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Destination ACL
+ ============================================================================
+ */
+
+#ifndef __HEV_DEST_ACL_H__
+#define __HEV_DEST_ACL_H__
+
+#include <netinet/in.h>
+
+typedef struct _HevDestAcl HevDestAcl;
+
+/**
+ * hev_dest_acl_new:
+ * @path: rules file path
+ *
+ * Load and compile a rules file. Each line is `allow|deny TARGET [PORTS]
+ * [user=NAME]`, the target is a CIDR or a domain suffix. The result is
+ * immutable and may be shared by all workers.
+ *
+ * Returns: returns destination acl on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevDestAcl *hev_dest_acl_new (const char *path);
+
+/**
+ * hev_dest_acl_destroy:
+ * @self: a #HevDestAcl
+ *
+ * Destroy the acl.
+ *
+ * Since: 2.14
+ */
+void hev_dest_acl_destroy (HevDestAcl *self);
+
+/**
+ * hev_dest_acl_check:
+ * @self: a #HevDestAcl
+ * @user: (nullable): user name
+ * @user_len: length of @user
+ * @name: (nullable): the domain name the client asked for
+ * @addr: the destination address and port
+ *
+ * Check a destination. Rules of @user are tried before the global ones,
+ * domain rules before address rules, and the most specific target that
+ * has a rule for the port decides. Nothing is allocated.
+ *
+ * Returns: returns zero if allowed, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_dest_acl_check (HevDestAcl *self, const char *user,
+                        unsigned int user_len, const char *name,
+                        const struct sockaddr_in6 *addr);
+
+#endif /* __HEV_DEST_ACL_H__ */
@@ -0,0 +1,470 @@
+/*
+ ============================================================================
+ Name        : hev-dns-cache.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : DNS Cache
+ ============================================================================
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-misc.h"
+#include "hev-logger.h"
+
+#include "hev-dns-cache.h"
+
+#define WAYS (4)
+#define QUERY_BUCKETS (64)
+#define WAIT_POLL_INTERVAL (10)
+
+typedef struct _HevDnsCacheSlot HevDnsCacheSlot;
+typedef struct _HevDnsCacheEntry HevDnsCacheEntry;
+typedef union _HevDnsCacheWords HevDnsCacheWords;
+
+struct _HevDnsCacheEntry
+{
+    HevDnsCacheKey key;
+    HevDnsCacheAnswer ans;
+};
+
+#define ENTRY_WORDS                                                          \
+    ((sizeof (HevDnsCacheEntry) + sizeof (unsigned long) - 1) /              \
+     sizeof (unsigned long))
+
+union _HevDnsCacheWords
+{
+    HevDnsCacheEntry entry;
+    unsigned long words[ENTRY_WORDS];
+};
+
+/*
+ * Readers race the writer by design, so the whole payload is kept in
+ * relaxed atomics and only trusted if the sequence did not move.
+ */
+struct _HevDnsCacheSlot
+{
+    atomic_uint seq;
+    atomic_uint hash;
+    atomic_llong expire;
+    atomic_llong refresh;
+
+    atomic_ulong data[ENTRY_WORDS];
+};
+
+struct _HevDnsCacheQuery
+{
+    HevDnsCacheQuery *next;
+    atomic_int refs;
+    atomic_int done;
+    int fds[2];
+
+    HevDnsCacheKey key;
+    HevDnsCacheAnswer ans;
+};
+
+struct _HevDnsCache
+{
+    unsigned int mask;
+    int prefetch;
+
+    atomic_ulong hits;
+    atomic_ulong negative_hits;
+    atomic_ulong misses;
+    atomic_ulong coalesced;
+    atomic_ulong prefetches;
+
+    pthread_mutex_t mutex;
+    HevDnsCacheQuery *queries[QUERY_BUCKETS];
+
+    HevDnsCacheSlot slots[];
+};
+
+HevDnsCache *
+hev_dns_cache_new (unsigned int size, int prefetch)
+{
+    HevDnsCache *self;
+    unsigned int num = WAYS;
+
+    while (num < size && num < (1U << 24))
+        num <<= 1;
+
+    self = hev_malloc0 (sizeof (HevDnsCache) + sizeof (HevDnsCacheSlot) * num);
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p dns cache new", self);
+
+    self->mask = num - 1;
+    self->prefetch = prefetch;
+    pthread_mutex_init (&self->mutex, NULL);
+
+    LOG_I ("dns cache %u entries", num);
+
+    return self;
+}
+
+void
+hev_dns_cache_destroy (HevDnsCache *self)
+{
+    LOG_D ("%p dns cache destroy", self);
+
+    pthread_mutex_destroy (&self->mutex);
+    hev_free (self);
+}
+
+int
+hev_dns_cache_key (HevDnsCacheKey *key, const char *name, int family)
+{
+    unsigned int hash = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; name[i]; i++) {
+        char c = name[i];
+
+        if (i == sizeof (key->name) - 1)
+            return -1;
+
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        key->name[i] = c;
+        hash = (hash ^ (unsigned char)c) * 16777619U;
+    }
+
+    key->name[i] = '\0';
+    key->len = i;
+    key->family = family;
+    key->hash = (hash ^ family) * 16777619U;
+
+    return 0;
+}
+
+static int
+key_equal (const HevDnsCacheKey *a, const HevDnsCacheKey *b)
+{
+    return a->hash == b->hash && a->family == b->family && a->len == b->len &&
+           memcmp (a->name, b->name, a->len) == 0;
+}
+
+static HevDnsCacheSlot *
+hev_dns_cache_bucket (HevDnsCache *self, unsigned int hash)
+{
+    return &self->slots[hash & self->mask & ~(WAYS - 1)];
+}
+
+static void
+slot_read (HevDnsCacheSlot *s, HevDnsCacheWords *w)
+{
+    unsigned int i;
+
+    for (i = 0; i < ENTRY_WORDS; i++)
+        w->words[i] = atomic_load_explicit (&s->data[i], memory_order_relaxed);
+}
+
+static void
+slot_write (HevDnsCacheSlot *s, const HevDnsCacheWords *w)
+{
+    unsigned int i;
+
+    for (i = 0; i < ENTRY_WORDS; i++)
+        atomic_store_explicit (&s->data[i], w->words[i],
+                               memory_order_relaxed);
+}
+
+int
+hev_dns_cache_lookup (HevDnsCache *self, const HevDnsCacheKey *key,
+                      HevDnsCacheAnswer *ans)
+{
+    HevDnsCacheSlot *slots = hev_dns_cache_bucket (self, key->hash);
+    int64_t now = get_monotonic_ms ();
+    HevDnsCacheWords w;
+    int i;
+
+    for (i = 0; i < WAYS; i++) {
+        HevDnsCacheSlot *s = &slots[i];
+        unsigned int seq;
+        int64_t expire;
+        int64_t refresh;
+
+        seq = atomic_load_explicit (&s->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        if (atomic_load_explicit (&s->hash, memory_order_relaxed) !=
+            key->hash)
+            continue;
+
+        expire = atomic_load_explicit (&s->expire, memory_order_relaxed);
+        slot_read (s, &w);
+
+        atomic_thread_fence (memory_order_acquire);
+        if (atomic_load_explicit (&s->seq, memory_order_relaxed) != seq)
+            continue;
+        if (!key_equal (&w.entry.key, key) || expire <= now)
+            continue;
+
+        *ans = w.entry.ans;
+        if (ans->error) {
+            atomic_fetch_add_explicit (&self->negative_hits, 1,
+                                       memory_order_relaxed);
+            return 0;
+        }
+
+        /* One caller per fill wins the refresh. */
+        ans->refresh = 0;
+        refresh = atomic_load_explicit (&s->refresh, memory_order_relaxed);
+        if (refresh && refresh <= now &&
+            atomic_compare_exchange_strong_explicit (&s->refresh, &refresh, 0,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+            atomic_fetch_add_explicit (&self->prefetches, 1,
+                                       memory_order_relaxed);
+            ans->refresh = 1;
+        }
+
+        atomic_fetch_add_explicit (&self->hits, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    atomic_fetch_add_explicit (&self->misses, 1, memory_order_relaxed);
+    return -1;
+}
+
+void
+hev_dns_cache_store (HevDnsCache *self, const HevDnsCacheKey *key,
+                     const HevDnsCacheAnswer *ans, unsigned int ttl)
+{
+    HevDnsCacheSlot *slots = hev_dns_cache_bucket (self, key->hash);
+    int64_t now = get_monotonic_ms ();
+    HevDnsCacheSlot *s = NULL;
+    int64_t victim = 0;
+    int64_t refresh = 0;
+    HevDnsCacheWords w;
+    unsigned int seq;
+    int i;
+
+    if (!ttl)
+        return;
+
+    /* The victim is only a guess until the seqlock is held. */
+    for (i = 0; i < WAYS; i++) {
+        int64_t expire;
+
+        expire = atomic_load_explicit (&slots[i].expire, memory_order_relaxed);
+        if (atomic_load_explicit (&slots[i].hash, memory_order_relaxed) ==
+            key->hash) {
+            s = &slots[i];
+            break;
+        }
+        if (!s || expire < victim) {
+            s = &slots[i];
+            victim = expire;
+        }
+    }
+
+    seq = atomic_load_explicit (&s->seq, memory_order_relaxed);
+    if ((seq & 1) ||
+        !atomic_compare_exchange_strong_explicit (&s->seq, &seq, seq + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        return;
+
+    /* The odd sequence must be seen before any of the payload. */
+    atomic_thread_fence (memory_order_release);
+
+    if (self->prefetch && !ans->error)
+        refresh = now + (int64_t)ttl * 900;
+
+    memset (&w, 0, sizeof (w));
+    w.entry.key = *key;
+    w.entry.ans = *ans;
+    w.entry.ans.refresh = 0;
+
+    atomic_store_explicit (&s->hash, key->hash, memory_order_relaxed);
+    atomic_store_explicit (&s->expire, now + (int64_t)ttl * 1000,
+                           memory_order_relaxed);
+    atomic_store_explicit (&s->refresh, refresh, memory_order_relaxed);
+    slot_write (s, &w);
+
+    atomic_store_explicit (&s->seq, seq + 2, memory_order_release);
+}
+
+static int
+hev_dns_cache_query_bell (HevDnsCacheQuery *q)
+{
+#if defined(__linux__)
+    int fd;
+
+    fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    q->fds[0] = fd;
+    q->fds[1] = fd;
+#else
+    if (pipe (q->fds) < 0)
+        return -1;
+
+    fcntl (q->fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (q->fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl (q->fds[1], F_SETFL, O_NONBLOCK);
+#endif
+
+    return 0;
+}
+
+HevDnsCacheQuery *
+hev_dns_cache_join (HevDnsCache *self, const HevDnsCacheKey *key, int *leader)
+{
+    HevDnsCacheQuery **bucket;
+    HevDnsCacheQuery *q;
+
+    bucket = &self->queries[key->hash % QUERY_BUCKETS];
+    *leader = 1;
+
+    pthread_mutex_lock (&self->mutex);
+    for (q = *bucket; q; q = q->next) {
+        if (!key_equal (&q->key, key))
+            continue;
+
+        /* The doorbell is only made once someone waits, else go alone. */
+        if (q->fds[0] < 0 && hev_dns_cache_query_bell (q) < 0) {
+            pthread_mutex_unlock (&self->mutex);
+            return NULL;
+        }
+
+        atomic_fetch_add_explicit (&q->refs, 1, memory_order_relaxed);
+        pthread_mutex_unlock (&self->mutex);
+
+        atomic_fetch_add_explicit (&self->coalesced, 1, memory_order_relaxed);
+        *leader = 0;
+        return q;
+    }
+
+    q = hev_malloc0 (sizeof (HevDnsCacheQuery));
+    if (q) {
+        q->key = *key;
+        q->refs = 1;
+        q->fds[0] = -1;
+        q->fds[1] = -1;
+        q->next = *bucket;
+        *bucket = q;
+    }
+    pthread_mutex_unlock (&self->mutex);
+
+    return q;
+}
+
+static void
+hev_dns_cache_query_unref (HevDnsCacheQuery *q)
+{
+    if (atomic_fetch_sub_explicit (&q->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    if (q->fds[0] >= 0) {
+        close (q->fds[0]);
+        if (q->fds[1] != q->fds[0])
+            close (q->fds[1]);
+    }
+    hev_free (q);
+}
+
+void
+hev_dns_cache_finish (HevDnsCache *self, HevDnsCacheQuery *query,
+                      const HevDnsCacheAnswer *ans)
+{
+    HevDnsCacheQuery **pq;
+    uint64_t val = 1;
+
+    query->ans = *ans;
+
+    pthread_mutex_lock (&self->mutex);
+    pq = &self->queries[query->key.hash % QUERY_BUCKETS];
+    for (; *pq; pq = &(*pq)->next) {
+        if (*pq == query) {
+            *pq = query->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&self->mutex);
+
+    /* Unlinked, so the doorbell can no longer be made behind our back. */
+    atomic_store_explicit (&query->done, 1, memory_order_release);
+    if (query->fds[1] >= 0 && write (query->fds[1], &val, sizeof (val)) < 0)
+        LOG_W ("%p dns cache doorbell", query);
+    hev_dns_cache_query_unref (query);
+}
+
+int
+hev_dns_cache_wait (HevDnsCacheQuery *query, HevDnsCacheAnswer *ans,
+                    unsigned int timeout, const int *cancel)
+{
+    HevTask *task = hev_task_self ();
+    int64_t deadline;
+    int res = -1;
+    int fd;
+
+    /*
+     * Each waiter watches a dup of the doorbell, a worker can not add the
+     * same fd twice. It is never read, so it stays readable for everyone.
+     */
+    fd = dup (query->fds[0]);
+    if (fd >= 0 && hev_task_add_fd (task, fd, POLLIN) < 0) {
+        close (fd);
+        fd = -1;
+    }
+
+    /* The doorbell, a wakeup of the terminator and the deadline end it. */
+    deadline = get_monotonic_ms () + timeout;
+    for (;;) {
+        int64_t now;
+
+        if (atomic_load_explicit (&query->done, memory_order_acquire)) {
+            *ans = query->ans;
+            res = 0;
+            break;
+        }
+
+        now = get_monotonic_ms ();
+        if ((cancel && *cancel) || now >= deadline)
+            break;
+
+        if (fd >= 0)
+            hev_task_sleep (deadline - now);
+        else
+            hev_task_sleep (WAIT_POLL_INTERVAL);
+    }
+
+    if (fd >= 0) {
+        hev_task_del_fd (task, fd);
+        close (fd);
+    }
+
+    hev_dns_cache_query_unref (query);
+
+    return res;
+}
+
+void
+hev_dns_cache_get_stats (HevDnsCache *self, HevDnsCacheStats *stats)
+{
+    stats->hits = atomic_load_explicit (&self->hits, memory_order_relaxed);
+    stats->negative_hits =
+        atomic_load_explicit (&self->negative_hits, memory_order_relaxed);
+    stats->misses = atomic_load_explicit (&self->misses, memory_order_relaxed);
+    stats->coalesced =
+        atomic_load_explicit (&self->coalesced, memory_order_relaxed);
+    stats->prefetches =
+        atomic_load_explicit (&self->prefetches, memory_order_relaxed);
+}
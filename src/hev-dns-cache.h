@@ -0,0 +1,178 @@
+/*
+ ============================================================================
+ Name        : hev-dns-cache.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : DNS Cache
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_CACHE_H__
+#define __HEV_DNS_CACHE_H__
+
+#include <stdint.h>
+
+typedef struct _HevDnsCache HevDnsCache;
+typedef struct _HevDnsCacheKey HevDnsCacheKey;
+typedef struct _HevDnsCacheAnswer HevDnsCacheAnswer;
+typedef struct _HevDnsCacheQuery HevDnsCacheQuery;
+typedef struct _HevDnsCacheStats HevDnsCacheStats;
+
+struct _HevDnsCacheKey
+{
+    unsigned int hash;
+    int family;
+    unsigned int len;
+    char name[256];
+};
+
+struct _HevDnsCacheAnswer
+{
+    int error;
+    int family;
+    int refresh;
+    uint8_t addr[16];
+};
+
+struct _HevDnsCacheStats
+{
+    unsigned long hits;
+    unsigned long negative_hits;
+    unsigned long misses;
+    unsigned long coalesced;
+    unsigned long prefetches;
+};
+
+/**
+ * hev_dns_cache_new:
+ * @size: number of entries, rounded up to a power of two
+ * @prefetch: refresh entries that are still used in the last tenth of their
+ *            ttl
+ *
+ * Create a cache of name lookups shared by all workers. Lookups take no
+ * lock, each entry is a seqlock, and a writer that finds an entry busy
+ * skips the store.
+ *
+ * Returns: returns dns cache on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevDnsCache *hev_dns_cache_new (unsigned int size, int prefetch);
+
+/**
+ * hev_dns_cache_destroy:
+ * @self: a #HevDnsCache
+ *
+ * Destroy the cache, after every query is finished.
+ *
+ * Since: 2.14
+ */
+void hev_dns_cache_destroy (HevDnsCache *self);
+
+/**
+ * hev_dns_cache_key:
+ * @key: (out): a #HevDnsCacheKey
+ * @name: host name
+ * @family: address family of the lookup
+ *
+ * Build the key of a lookup. Names are matched case-insensitively.
+ *
+ * Returns: returns zero on successful, -1 if @name is too long.
+ *
+ * Since: 2.14
+ */
+int hev_dns_cache_key (HevDnsCacheKey *key, const char *name, int family);
+
+/**
+ * hev_dns_cache_lookup:
+ * @self: a #HevDnsCache
+ * @key: a #HevDnsCacheKey
+ * @ans: (out): the cached answer
+ *
+ * Look up a live answer, positive or negative. The refresh field of @ans
+ * is set for the one caller that should prefetch the entry.
+ *
+ * Returns: returns zero on hit, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_dns_cache_lookup (HevDnsCache *self, const HevDnsCacheKey *key,
+                          HevDnsCacheAnswer *ans);
+
+/**
+ * hev_dns_cache_store:
+ * @self: a #HevDnsCache
+ * @key: a #HevDnsCacheKey
+ * @ans: the answer
+ * @ttl: time to live in seconds
+ *
+ * Store an answer, replacing the entry of @key or the one closest to
+ * expiry in its bucket.
+ *
+ * Since: 2.14
+ */
+void hev_dns_cache_store (HevDnsCache *self, const HevDnsCacheKey *key,
+                          const HevDnsCacheAnswer *ans, unsigned int ttl);
+
+/**
+ * hev_dns_cache_join:
+ * @self: a #HevDnsCache
+ * @key: a #HevDnsCacheKey
+ * @leader: (out): whether the caller has to resolve
+ *
+ * Join the in-flight query of @key, or start one. The leader resolves and
+ * calls hev_dns_cache_finish(), the others call hev_dns_cache_wait().
+ *
+ * Returns: returns the query, otherwise returns %NULL, in which case the
+ * caller resolves alone.
+ *
+ * Since: 2.14
+ */
+HevDnsCacheQuery *hev_dns_cache_join (HevDnsCache *self,
+                                      const HevDnsCacheKey *key, int *leader);
+
+/**
+ * hev_dns_cache_finish:
+ * @self: a #HevDnsCache
+ * @query: a #HevDnsCacheQuery
+ * @ans: the answer
+ *
+ * Hand the answer to the waiters and release the query of the leader.
+ *
+ * Since: 2.14
+ */
+void hev_dns_cache_finish (HevDnsCache *self, HevDnsCacheQuery *query,
+                           const HevDnsCacheAnswer *ans);
+
+/**
+ * hev_dns_cache_wait:
+ * @query: a #HevDnsCacheQuery
+ * @ans: (out): the answer
+ * @timeout: longest wait in milliseconds
+ * @cancel: (nullable): set by another task, which then wakes the caller,
+ *   to stop waiting
+ *
+ * Wait on the calling task for the leader, which may run on any worker,
+ * and release the query. The leader rings a doorbell fd of the query, so
+ * waiters sleep in the poller of their own worker.
+ *
+ * Returns: returns zero on successful, -1 if the wait timed out or was
+ * canceled.
+ *
+ * Since: 2.14
+ */
+int hev_dns_cache_wait (HevDnsCacheQuery *query, HevDnsCacheAnswer *ans,
+                        unsigned int timeout, const int *cancel);
+
+/**
+ * hev_dns_cache_get_stats:
+ * @self: a #HevDnsCache
+ * @stats: (out): the counters
+ *
+ * Get the counters.
+ *
+ * Since: 2.14
+ */
+void hev_dns_cache_get_stats (HevDnsCache *self, HevDnsCacheStats *stats);
+
+#endif /* __HEV_DNS_CACHE_H__ */
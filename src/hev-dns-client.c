@@ -0,0 +1,977 @@
+/*
+ ============================================================================
+ Name        : hev-dns-client.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : DNS Client
+ ============================================================================
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <poll.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-misc.h"
+#include "hev-logger.h"
+
+#include "hev-dns-client.h"
+
+#ifndef EAI_NODATA
+#define EAI_NODATA EAI_NONAME
+#endif
+
+#define MAX_SERVERS (8)
+#define MAX_SEARCH (6)
+#define MAX_UDP_SIZE (4096)
+
+#define TYPE_A (1)
+#define TYPE_CNAME (5)
+#define TYPE_SOA (6)
+#define TYPE_AAAA (28)
+#define CLASS_IN (1)
+
+#define RCODE_NOERROR (0)
+#define RCODE_NXDOMAIN (3)
+
+typedef struct _HevDnsClientHost HevDnsClientHost;
+typedef struct _HevDnsClientQuery HevDnsClientQuery;
+typedef struct _HevDnsClientWait HevDnsClientWait;
+
+struct _HevDnsClientHost
+{
+    char *name;
+    unsigned int hash;
+    int family;
+    uint8_t addr[16];
+};
+
+struct _HevDnsClientQuery
+{
+    const char *name;
+    unsigned int type;
+    unsigned int id;
+    unsigned int len;
+
+    int done;
+    int rcode;
+    int found;
+    int truncated;
+    unsigned int ttl;
+    unsigned int negative_ttl;
+    uint8_t addr[16];
+
+    uint8_t req[288];
+};
+
+struct _HevDnsClientWait
+{
+    int64_t deadline;
+    const int *cancel;
+};
+
+struct _HevDnsClient
+{
+    unsigned int timeout;
+    unsigned int attempts;
+    unsigned int ndots;
+    int rotate;
+
+    atomic_uint seq;
+    uint64_t seed;
+
+    unsigned int num_servers;
+    unsigned int num_search;
+    struct sockaddr_storage servers[MAX_SERVERS];
+    char search[MAX_SEARCH][256];
+
+    unsigned int hosts_mask;
+    HevDnsClientHost *hosts;
+};
+
+static uint64_t
+mix64 (uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static unsigned int
+name_hash (const char *name)
+{
+    unsigned int hash = 2166136261U;
+
+    for (; *name; name++) {
+        char c = *name;
+
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ (unsigned char)c) * 16777619U;
+    }
+
+    return hash;
+}
+
+static int
+parse_addr (const char *str, int *family, uint8_t *addr)
+{
+    if (inet_pton (AF_INET, str, addr) == 1) {
+        *family = AF_INET;
+        return 0;
+    }
+
+    if (inet_pton (AF_INET6, str, addr) == 1) {
+        *family = AF_INET6;
+        return 0;
+    }
+
+    return -1;
+}
+
+static int
+hev_dns_client_add_server (HevDnsClient *self, char *str)
+{
+    struct sockaddr_storage *ss;
+    unsigned int scope = 0;
+    unsigned long port = 53;
+    uint8_t addr[16];
+    char *iface;
+    char *sep;
+    int family;
+
+    if (self->num_servers == MAX_SERVERS)
+        return 0;
+
+    /* An optional port, as in 127.0.0.1:5353 or [::1]:5353. */
+    if (str[0] == '[') {
+        sep = strchr (++str, ']');
+        if (!sep || (sep[1] && sep[1] != ':')) {
+            LOG_W ("dns client nameserver %s", str);
+            return -1;
+        }
+        *sep++ = '\0';
+    } else {
+        sep = strchr (str, ':');
+        if (sep && strchr (sep + 1, ':'))
+            sep = NULL;
+    }
+    if (sep && *sep == ':') {
+        char *end;
+
+        *sep++ = '\0';
+        port = strtoul (sep, &end, 10);
+        if (*end || !port || port > 65535) {
+            LOG_W ("dns client nameserver port %s", sep);
+            return -1;
+        }
+    }
+
+    iface = strchr (str, '%');
+    if (iface) {
+        *iface++ = '\0';
+        scope = if_nametoindex (iface);
+    }
+
+    if (parse_addr (str, &family, addr) < 0) {
+        LOG_W ("dns client nameserver %s", str);
+        return -1;
+    }
+
+    ss = &self->servers[self->num_servers++];
+    memset (ss, 0, sizeof (struct sockaddr_storage));
+
+    if (family == AF_INET) {
+        struct sockaddr_in *sa = (struct sockaddr_in *)ss;
+
+        sa->sin_family = AF_INET;
+        sa->sin_port = htons (port);
+        memcpy (&sa->sin_addr, addr, 4);
+    } else {
+        struct sockaddr_in6 *sa = (struct sockaddr_in6 *)ss;
+
+        sa->sin6_family = AF_INET6;
+        sa->sin6_port = htons (port);
+        sa->sin6_scope_id = scope;
+        memcpy (&sa->sin6_addr, addr, 16);
+    }
+
+    return 0;
+}
+
+static void
+hev_dns_client_add_search (HevDnsClient *self, char *str)
+{
+    size_t len = strlen (str);
+
+    if (self->num_search == MAX_SEARCH)
+        return;
+
+    if (len && str[len - 1] == '.')
+        str[--len] = '\0';
+    if (!len || len >= sizeof (self->search[0]))
+        return;
+
+    memcpy (self->search[self->num_search++], str, len + 1);
+}
+
+static void
+hev_dns_client_set_option (HevDnsClient *self, const char *opt)
+{
+    unsigned int val;
+
+    if (0 == strcmp (opt, "rotate")) {
+        self->rotate = 1;
+    } else if (1 == sscanf (opt, "timeout:%u", &val)) {
+        val = (val < 1) ? 1 : (val > 30) ? 30 : val;
+        self->timeout = val * 1000;
+    } else if (1 == sscanf (opt, "attempts:%u", &val)) {
+        self->attempts = (val < 1) ? 1 : (val > 5) ? 5 : val;
+    } else if (1 == sscanf (opt, "ndots:%u", &val)) {
+        self->ndots = (val > 15) ? 15 : val;
+    }
+}
+
+static int
+hev_dns_client_load_conf (HevDnsClient *self, const char *path)
+{
+    char line[1024];
+    FILE *fp;
+
+    fp = fopen (path, "r");
+    if (!fp) {
+        LOG_W ("dns client open %s", path);
+        return 0;
+    }
+
+    while (fgets (line, sizeof (line), fp)) {
+        const char *sep = " \t\r\n";
+        char *save;
+        char *key;
+        char *val;
+
+        line[strcspn (line, "#;")] = '\0';
+        key = strtok_r (line, sep, &save);
+        if (!key)
+            continue;
+
+        if (0 == strcmp (key, "nameserver")) {
+            val = strtok_r (NULL, sep, &save);
+            if (val)
+                hev_dns_client_add_server (self, val);
+        } else if (0 == strcmp (key, "search") ||
+                   0 == strcmp (key, "domain")) {
+            /* The last of them wins, like in the libc. */
+            self->num_search = 0;
+            while ((val = strtok_r (NULL, sep, &save)))
+                hev_dns_client_add_search (self, val);
+        } else if (0 == strcmp (key, "options")) {
+            while ((val = strtok_r (NULL, sep, &save)))
+                hev_dns_client_set_option (self, val);
+        }
+    }
+
+    fclose (fp);
+    return 0;
+}
+
+static HevDnsClientHost *
+hev_dns_client_find_host (HevDnsClient *self, const char *name,
+                          unsigned int hash, int family)
+{
+    unsigned int i;
+
+    for (i = hash & self->hosts_mask;; i = (i + 1) & self->hosts_mask) {
+        HevDnsClientHost *h = &self->hosts[i];
+
+        if (!h->name)
+            return h;
+        if (h->hash == hash && h->family == family &&
+            0 == strcasecmp (h->name, name))
+            return h;
+    }
+}
+
+static int
+hev_dns_client_load_hosts (HevDnsClient *self, const char *path)
+{
+    HevDnsClientHost *list = NULL;
+    unsigned int num = 0;
+    unsigned int size;
+    unsigned int i;
+    char line[1024];
+    FILE *fp;
+    int res = -1;
+
+    fp = fopen (path, "r");
+    if (!fp) {
+        LOG_W ("dns client open %s", path);
+        return 0;
+    }
+
+    while (fgets (line, sizeof (line), fp)) {
+        const char *sep = " \t\r\n";
+        HevDnsClientHost host;
+        char *save;
+        char *name;
+        char *addr;
+
+        line[strcspn (line, "#")] = '\0';
+        addr = strtok_r (line, sep, &save);
+        if (!addr || parse_addr (addr, &host.family, host.addr) < 0)
+            continue;
+
+        while ((name = strtok_r (NULL, sep, &save))) {
+            HevDnsClientHost *l;
+
+            l = realloc (list, sizeof (HevDnsClientHost) * (num + 1));
+            if (!l)
+                goto exit;
+            list = l;
+
+            host.name = strdup (name);
+            if (!host.name)
+                goto exit;
+            host.hash = name_hash (name);
+            list[num++] = host;
+        }
+    }
+
+    for (size = 4; size < num * 2; size <<= 1)
+        ;
+    self->hosts = calloc (size, sizeof (HevDnsClientHost));
+    if (!self->hosts)
+        goto exit;
+    self->hosts_mask = size - 1;
+
+    /* The first line of a name wins, later ones are dropped. */
+    for (i = 0; i < num; i++) {
+        HevDnsClientHost *h;
+
+        h = hev_dns_client_find_host (self, list[i].name, list[i].hash,
+                                      list[i].family);
+        if (h->name) {
+            free (list[i].name);
+            continue;
+        }
+        *h = list[i];
+    }
+    num = 0;
+    res = 0;
+
+exit:
+    for (i = 0; i < num; i++)
+        free (list[i].name);
+    free (list);
+    fclose (fp);
+    return res;
+}
+
+HevDnsClient *
+hev_dns_client_new (const char *resolv_conf, const char *hosts)
+{
+    HevDnsClient *self;
+    int fd;
+
+    self = hev_malloc0 (sizeof (HevDnsClient));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p dns client new", self);
+
+    self->timeout = 5000;
+    self->attempts = 2;
+    self->ndots = 1;
+
+    if (hev_dns_client_load_conf (self, resolv_conf) < 0 ||
+        hev_dns_client_load_hosts (self, hosts) < 0) {
+        hev_dns_client_destroy (self);
+        return NULL;
+    }
+
+    if (!self->num_servers) {
+        char addr[] = "127.0.0.1";
+
+        hev_dns_client_add_server (self, addr);
+    }
+
+    /* Query ids are the only secret against off-path spoofing. */
+    fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 ||
+        read (fd, &self->seed, sizeof (self->seed)) != sizeof (self->seed))
+        self->seed = time (NULL) ^ ((uint64_t)getpid () << 32);
+    if (fd >= 0)
+        close (fd);
+
+    LOG_I ("dns client %u servers, %u search domains", self->num_servers,
+           self->num_search);
+
+    return self;
+}
+
+void
+hev_dns_client_destroy (HevDnsClient *self)
+{
+    unsigned int i;
+
+    LOG_D ("%p dns client destroy", self);
+
+    if (self->hosts) {
+        for (i = 0; i <= self->hosts_mask; i++)
+            free (self->hosts[i].name);
+        free (self->hosts);
+    }
+    hev_free (self);
+}
+
+static int
+hev_dns_client_hosts (HevDnsClient *self, const char *name, int family,
+                      HevDnsCacheAnswer *ans)
+{
+    static const int order[] = { AF_INET, AF_INET6 };
+    unsigned int hash;
+    int i;
+
+    if (!self->hosts)
+        return -1;
+
+    hash = name_hash (name);
+    for (i = 0; i < 2; i++) {
+        HevDnsClientHost *h;
+
+        if (family != AF_UNSPEC && family != order[i])
+            continue;
+
+        h = hev_dns_client_find_host (self, name, hash, order[i]);
+        if (h->name) {
+            ans->family = h->family;
+            memcpy (ans->addr, h->addr, 16);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static unsigned int
+get16 (const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static unsigned int
+get32 (const uint8_t *p)
+{
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int
+hev_dns_client_build (HevDnsClient *self, HevDnsClientQuery *q,
+                      const char *name, unsigned int type)
+{
+    unsigned int max = 12 + 255;
+    unsigned int pos = 12;
+    uint64_t rnd;
+
+    memset (q, 0, sizeof (HevDnsClientQuery));
+    q->name = name;
+
+    while (*name) {
+        const char *dot = strchr (name, '.');
+        size_t len = dot ? dot - name : strlen (name);
+
+        if (!len || len > 63 || pos + 1 + len >= max)
+            return -1;
+
+        q->req[pos++] = len;
+        memcpy (&q->req[pos], name, len);
+        pos += len;
+        name += len;
+        if (*name)
+            name++;
+    }
+    q->req[pos++] = 0;
+
+    rnd = mix64 (self->seed + atomic_fetch_add_explicit (
+                                  &self->seq, 1, memory_order_relaxed));
+    q->id = rnd & 0xffff;
+    q->type = type;
+
+    q->req[0] = q->id >> 8;
+    q->req[1] = q->id;
+    q->req[2] = 0x01; /* RD */
+    q->req[5] = 1;
+    q->req[pos++] = type >> 8;
+    q->req[pos++] = type;
+    q->req[pos++] = 0;
+    q->req[pos++] = CLASS_IN;
+    q->len = pos;
+
+    return 0;
+}
+
+static int
+read_name (const uint8_t *buf, int len, int *off, char *out, int size)
+{
+    int jumps = 0;
+    int pos = *off;
+    int end = -1;
+    int n = 0;
+
+    for (;;) {
+        unsigned int c;
+
+        if (pos >= len)
+            return -1;
+
+        c = buf[pos];
+        if (c == 0) {
+            pos++;
+            break;
+        }
+
+        if ((c & 0xc0) == 0xc0) {
+            if (pos + 1 >= len || ++jumps > 32)
+                return -1;
+            if (end < 0)
+                end = pos + 2;
+            pos = ((c & 0x3f) << 8) | buf[pos + 1];
+            continue;
+        }
+
+        if ((c & 0xc0) || pos + 1 + c > len)
+            return -1;
+
+        if (out) {
+            if (n + c + 2 > size)
+                return -1;
+            if (n)
+                out[n++] = '.';
+            memcpy (&out[n], &buf[pos + 1], c);
+            n += c;
+        }
+        pos += 1 + c;
+    }
+
+    if (out)
+        out[n] = '\0';
+    *off = (end < 0) ? pos : end;
+
+    return 0;
+}
+
+static int
+hev_dns_client_parse (HevDnsClientQuery *q, const uint8_t *buf, int len)
+{
+    unsigned int negative_ttl = 0;
+    unsigned int ttl_min = ~0U;
+    unsigned int count;
+    unsigned int an;
+    unsigned int i;
+    uint8_t addr[16] = { 0 };
+    char owner[256];
+    char name[256];
+    int truncated;
+    int found = 0;
+    size_t nlen;
+    int off = 12;
+
+    if (len < 12 || get16 (buf) != q->id || !(buf[2] & 0x80))
+        return -1;
+    if (get16 (&buf[4]) != 1)
+        return -1;
+
+    if (read_name (buf, len, &off, name, sizeof (name)) < 0 || off + 4 > len)
+        return -1;
+    nlen = strlen (q->name);
+    if (nlen && q->name[nlen - 1] == '.')
+        nlen--;
+    if (strlen (name) != nlen || strncasecmp (name, q->name, nlen) != 0 ||
+        get16 (&buf[off]) != q->type || get16 (&buf[off + 2]) != CLASS_IN)
+        return -1;
+    off += 4;
+
+    /*
+     * The query is only touched once the whole packet is valid. Answers
+     * are taken in order like the libc does: @name follows the CNAME
+     * chain, and records owned by other names are ignored.
+     */
+    truncated = !!(buf[2] & 0x02);
+    an = get16 (&buf[6]);
+    count = an + get16 (&buf[8]);
+    for (i = 0; i < count && !truncated; i++) {
+        unsigned int type;
+        unsigned int ttl;
+        unsigned int rdlen;
+
+        if (read_name (buf, len, &off, owner, sizeof (owner)) < 0 ||
+            off + 10 > len)
+            return -1;
+
+        type = get16 (&buf[off]);
+        ttl = get32 (&buf[off + 4]);
+        rdlen = get16 (&buf[off + 8]);
+        off += 10;
+        if (off + rdlen > len)
+            return -1;
+        if (ttl > 0x7fffffff)
+            ttl = 0;
+
+        if (i < an) {
+            if (found || strcasecmp (owner, name) != 0) {
+                off += rdlen;
+                continue;
+            }
+
+            /* Records of a CNAME chain bound the ttl of the answer. */
+            if (type == TYPE_CNAME) {
+                int pos = off;
+
+                if (read_name (buf, len, &pos, name, sizeof (name)) < 0 ||
+                    pos != off + rdlen)
+                    return -1;
+                if (ttl < ttl_min)
+                    ttl_min = ttl;
+            } else if (type == q->type &&
+                       rdlen == ((type == TYPE_A) ? 4 : 16)) {
+                memcpy (addr, &buf[off], rdlen);
+                found = 1;
+                if (ttl < ttl_min)
+                    ttl_min = ttl;
+            }
+        } else if (type == TYPE_SOA) {
+            int pos = off;
+            unsigned int min;
+
+            if (read_name (buf, len, &pos, NULL, 0) < 0 ||
+                read_name (buf, len, &pos, NULL, 0) < 0 || pos + 20 > len)
+                return -1;
+
+            min = get32 (&buf[pos + 16]);
+            negative_ttl = (ttl < min) ? ttl : min;
+        }
+
+        off += rdlen;
+    }
+
+    q->rcode = buf[3] & 0x0f;
+    q->truncated = truncated;
+    q->found = found;
+    q->ttl = found ? ttl_min : 0;
+    q->negative_ttl = negative_ttl;
+    if (found)
+        memcpy (q->addr, addr, 16);
+    q->done = 1;
+
+    return 0;
+}
+
+static int
+io_yielder (HevTaskYieldType type, void *data)
+{
+    HevDnsClientWait *wait = data;
+    int64_t now = get_monotonic_ms ();
+
+    if (now >= wait->deadline)
+        return -1;
+    if (wait->cancel && *wait->cancel)
+        return -1;
+
+    hev_task_sleep (wait->deadline - now);
+    return 0;
+}
+
+static socklen_t
+addr_len (const struct sockaddr_storage *ss)
+{
+    if (ss->ss_family == AF_INET)
+        return sizeof (struct sockaddr_in);
+
+    return sizeof (struct sockaddr_in6);
+}
+
+static void
+hev_dns_client_udp (HevDnsClient *self, const struct sockaddr_storage *ss,
+                    HevDnsClientQuery *qs, int num, const int *cancel)
+{
+    HevTask *task = hev_task_self ();
+    HevDnsClientWait wait;
+    int pending = 0;
+    uint8_t *buf;
+    int fd;
+    int i;
+
+    /* Session stacks are small, keep the datagram off them. */
+    buf = hev_malloc (MAX_UDP_SIZE);
+    if (!buf)
+        return;
+
+    fd = hev_task_io_socket_socket (ss->ss_family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        hev_free (buf);
+        return;
+    }
+
+    hev_task_add_fd (task, fd, POLLIN);
+
+    /* Connected, so replies from other sources never reach the parser. */
+    if (connect (fd, (struct sockaddr *)ss, addr_len (ss)) < 0)
+        goto exit;
+
+    for (i = 0; i < num; i++) {
+        if (qs[i].done)
+            continue;
+        if (send (fd, qs[i].req, qs[i].len, 0) < 0)
+            goto exit;
+        pending++;
+    }
+
+    wait.deadline = get_monotonic_ms () + self->timeout;
+    wait.cancel = cancel;
+    while (pending) {
+        ssize_t len;
+
+        len = hev_task_io_socket_recv (fd, buf, MAX_UDP_SIZE, 0, io_yielder,
+                                       &wait);
+        if (len < 0)
+            break;
+
+        for (i = 0; i < num; i++) {
+            if (!qs[i].done && hev_dns_client_parse (&qs[i], buf, len) == 0) {
+                pending--;
+                break;
+            }
+        }
+    }
+
+exit:
+    hev_task_del_fd (task, fd);
+    close (fd);
+    hev_free (buf);
+}
+
+static int
+io_full (int fd, void *buf, size_t size, int write, HevDnsClientWait *wait)
+{
+    size_t pos = 0;
+
+    while (pos < size) {
+        ssize_t len;
+
+        if (write)
+            len = hev_task_io_socket_send (fd, (uint8_t *)buf + pos,
+                                           size - pos, MSG_NOSIGNAL,
+                                           io_yielder, wait);
+        else
+            len = hev_task_io_socket_recv (fd, (uint8_t *)buf + pos,
+                                           size - pos, 0, io_yielder, wait);
+        if (len <= 0)
+            return -1;
+        pos += len;
+    }
+
+    return 0;
+}
+
+static void
+hev_dns_client_tcp (HevDnsClient *self, const struct sockaddr_storage *ss,
+                    HevDnsClientQuery *q, const int *cancel)
+{
+    HevTask *task = hev_task_self ();
+    HevDnsClientWait wait;
+    uint8_t *buf = NULL;
+    uint8_t hdr[2];
+    unsigned int len;
+    int res;
+    int fd;
+
+    fd = hev_task_io_socket_socket (ss->ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return;
+
+    hev_task_add_fd (task, fd, POLLIN | POLLOUT);
+
+    wait.deadline = get_monotonic_ms () + self->timeout;
+    wait.cancel = cancel;
+    res = hev_task_io_socket_connect (fd, (struct sockaddr *)ss, addr_len (ss),
+                                      io_yielder, &wait);
+    if (res < 0)
+        goto exit;
+
+    hdr[0] = q->len >> 8;
+    hdr[1] = q->len;
+    if (io_full (fd, hdr, 2, 1, &wait) < 0 ||
+        io_full (fd, q->req, q->len, 1, &wait) < 0 ||
+        io_full (fd, hdr, 2, 0, &wait) < 0)
+        goto exit;
+
+    len = get16 (hdr);
+    buf = hev_malloc (len);
+    if (!buf || io_full (fd, buf, len, 0, &wait) < 0)
+        goto exit;
+
+    q->done = 0;
+    hev_dns_client_parse (q, buf, len);
+
+exit:
+    if (buf)
+        hev_free (buf);
+    hev_task_del_fd (task, fd);
+    close (fd);
+}
+
+static int
+hev_dns_client_answer (HevDnsClientQuery *qs, int num, HevDnsCacheAnswer *ans,
+                       unsigned int *ttl)
+{
+    int error = EAI_NODATA;
+    int i;
+
+    /* Queries are in order of preference. */
+    for (i = 0; i < num; i++) {
+        if (qs[i].done && qs[i].found) {
+            ans->family = (qs[i].type == TYPE_A) ? AF_INET : AF_INET6;
+            memcpy (ans->addr, qs[i].addr, 16);
+            *ttl = qs[i].ttl;
+            return 0;
+        }
+    }
+
+    *ttl = ~0U;
+    for (i = 0; i < num; i++) {
+        if (qs[i].rcode == RCODE_NXDOMAIN)
+            error = EAI_NONAME;
+        if (qs[i].negative_ttl < *ttl)
+            *ttl = qs[i].negative_ttl;
+    }
+
+    return error;
+}
+
+static int
+hev_dns_client_query (HevDnsClient *self, const char *name, int family,
+                      HevDnsCacheAnswer *ans, unsigned int *ttl,
+                      const int *cancel)
+{
+    HevDnsClientQuery qs[2];
+    unsigned int start = 0;
+    unsigned int a;
+    unsigned int s;
+    int num = 0;
+
+    if (family != AF_INET6) {
+        if (hev_dns_client_build (self, &qs[num++], name, TYPE_A) < 0)
+            return EAI_NONAME;
+    }
+    if (family != AF_INET) {
+        if (hev_dns_client_build (self, &qs[num++], name, TYPE_AAAA) < 0)
+            return EAI_NONAME;
+    }
+
+    if (self->rotate)
+        start = atomic_load_explicit (&self->seq, memory_order_relaxed);
+
+    for (a = 0; a < self->attempts; a++) {
+        for (s = 0; s < self->num_servers; s++) {
+            const struct sockaddr_storage *ss;
+            int done = 0;
+            int i;
+
+            if (cancel && *cancel)
+                return EAI_AGAIN;
+
+            ss = &self->servers[(start + s) % self->num_servers];
+            hev_dns_client_udp (self, ss, qs, num, cancel);
+
+            for (i = 0; i < num; i++) {
+                if (qs[i].done && qs[i].truncated)
+                    hev_dns_client_tcp (self, ss, &qs[i], cancel);
+                if (qs[i].done && qs[i].found)
+                    return hev_dns_client_answer (qs, num, ans, ttl);
+
+                /* Failed answers are asked again of the next server. */
+                if (qs[i].done && !qs[i].truncated &&
+                    (qs[i].rcode == RCODE_NOERROR ||
+                     qs[i].rcode == RCODE_NXDOMAIN))
+                    done++;
+                else
+                    qs[i].done = 0;
+            }
+
+            if (done == num)
+                return hev_dns_client_answer (qs, num, ans, ttl);
+        }
+    }
+
+    return EAI_AGAIN;
+}
+
+int
+hev_dns_client_resolve (HevDnsClient *self, const char *name, int family,
+                        HevDnsCacheAnswer *ans, unsigned int *ttl,
+                        const int *cancel)
+{
+    unsigned int dots = 0;
+    char fqdn[256];
+    int direct = 0;
+    int res;
+    size_t len;
+    size_t i;
+
+    memset (ans, 0, sizeof (HevDnsCacheAnswer));
+    *ttl = 0;
+
+    if (hev_dns_client_hosts (self, name, family, ans) == 0)
+        return 0;
+
+    len = strlen (name);
+    for (i = 0; i < len; i++)
+        dots += name[i] == '.';
+
+    /* Like the libc: names with enough dots are tried as is first. */
+    res = EAI_NONAME;
+    if (len && (name[len - 1] == '.' || dots >= self->ndots)) {
+        res = hev_dns_client_query (self, name, family, ans, ttl, cancel);
+        if (res != EAI_NONAME && res != EAI_NODATA)
+            goto exit;
+        if (name[len - 1] == '.')
+            goto exit;
+        direct = 1;
+    }
+
+    for (i = 0; i < self->num_search; i++) {
+        if (snprintf (fqdn, sizeof (fqdn), "%s.%s", name, self->search[i]) >=
+            sizeof (fqdn))
+            continue;
+
+        res = hev_dns_client_query (self, fqdn, family, ans, ttl, cancel);
+        if (res != EAI_NONAME && res != EAI_NODATA)
+            goto exit;
+    }
+
+    if (len && !direct)
+        res = hev_dns_client_query (self, name, family, ans, ttl, cancel);
+
+exit:
+    ans->error = res;
+    return res;
+}
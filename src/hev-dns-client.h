@@ -0,0 +1,66 @@
+/*
+ ============================================================================
+ Name        : hev-dns-client.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : DNS Client
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_CLIENT_H__
+#define __HEV_DNS_CLIENT_H__
+
+#include "hev-dns-cache.h"
+
+typedef struct _HevDnsClient HevDnsClient;
+
+/**
+ * hev_dns_client_new:
+ * @resolv_conf: resolver config path
+ * @hosts: hosts file path
+ *
+ * Load the name servers, the search list and the options (timeout,
+ * attempts, ndots and rotate) from @resolv_conf, and the static names of
+ * @hosts. The result is immutable and shared by all workers.
+ *
+ * Returns: returns dns client on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevDnsClient *hev_dns_client_new (const char *resolv_conf, const char *hosts);
+
+/**
+ * hev_dns_client_destroy:
+ * @self: a #HevDnsClient
+ *
+ * Destroy the client, after every query is finished.
+ *
+ * Since: 2.14
+ */
+void hev_dns_client_destroy (HevDnsClient *self);
+
+/**
+ * hev_dns_client_resolve:
+ * @self: a #HevDnsClient
+ * @name: host name
+ * @family: AF_INET, AF_INET6 or AF_UNSPEC
+ * @ans: (out): the answer
+ * @ttl: (out): time to live of the answer in seconds
+ * @cancel: (nullable): set by another task, which then wakes the caller,
+ *   to give up with EAI_AGAIN
+ *
+ * Resolve @name on the calling task, over UDP with a TCP retry for
+ * truncated replies. Other tasks keep running while it waits. AF_UNSPEC
+ * asks for both families at once and prefers IPv4. The ttl of a name that
+ * does not exist comes from the SOA record, zero if there is none. Names
+ * of the hosts file have a zero ttl.
+ *
+ * Returns: returns zero on successful, otherwise returns an EAI_* code.
+ *
+ * Since: 2.14
+ */
+int hev_dns_client_resolve (HevDnsClient *self, const char *name, int family,
+                            HevDnsCacheAnswer *ans, unsigned int *ttl,
+                            const int *cancel);
+
+#endif /* __HEV_DNS_CLIENT_H__ */
@@ -0,0 +1,181 @@
+/*
+ ============================================================================
+ Name        : hev-egress-plan.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Egress Plan
+ ============================================================================
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-misc.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-egress-plan.h"
+
+enum
+{
+    ADDR_BIND4,
+    ADDR_BIND6,
+    ADDR_UDP,
+    ADDR_UDP_PUBLIC4,
+    ADDR_UDP_PUBLIC6,
+    ADDR_MAX,
+};
+
+/* Read only once built, shared by all workers. */
+struct _HevEgressPlan
+{
+    unsigned int mark;
+    const char *iface;
+    HevEgressPool *pool;
+
+    const struct sockaddr_in6 *addrs[ADDR_MAX];
+    struct sockaddr_in6 store[ADDR_MAX];
+};
+
+static int
+hev_egress_plan_resolve (HevEgressPlan *self, int idx, const char *addr)
+{
+    int res;
+
+    if (!addr)
+        return 0;
+
+    res = hev_netaddr_resolve (&self->store[idx], addr, NULL);
+    if (res < 0) {
+        LOG_E ("egress plan resolve %s", addr);
+        return -1;
+    }
+
+    self->addrs[idx] = &self->store[idx];
+    return 0;
+}
+
+HevEgressPlan *
+hev_egress_plan_new (void)
+{
+    HevEgressPlan *self;
+    const char *addrs;
+    int res = 0;
+
+    self = hev_malloc0 (sizeof (HevEgressPlan));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p egress plan new", self);
+
+    self->mark = hev_config_get_socket_mark ();
+    self->iface = hev_config_get_bind_interface ();
+
+    res |= hev_egress_plan_resolve (self, ADDR_BIND4,
+                                    hev_config_get_bind_address (AF_INET));
+    res |= hev_egress_plan_resolve (self, ADDR_BIND6,
+                                    hev_config_get_bind_address (AF_INET6));
+    res |= hev_egress_plan_resolve (self, ADDR_UDP,
+                                    hev_config_get_udp_listen_address ());
+    res |= hev_egress_plan_resolve (
+        self, ADDR_UDP_PUBLIC4, hev_config_get_udp_public_address (AF_INET));
+    res |= hev_egress_plan_resolve (
+        self, ADDR_UDP_PUBLIC6, hev_config_get_udp_public_address (AF_INET6));
+    if (res < 0)
+        goto exit;
+
+    addrs = hev_config_get_bind_address_pool ();
+    if (addrs) {
+        int least_used = hev_config_get_bind_address_least_used ();
+
+        self->pool = hev_egress_pool_new (addrs, least_used);
+        if (!self->pool)
+            goto exit;
+    }
+
+    return self;
+
+exit:
+    hev_egress_plan_destroy (self);
+    return NULL;
+}
+
+void
+hev_egress_plan_destroy (HevEgressPlan *self)
+{
+    LOG_D ("%p egress plan destroy", self);
+
+    if (self->pool)
+        hev_egress_pool_destroy (self->pool);
+    hev_free (self);
+}
+
+int
+hev_egress_plan_apply (HevEgressPlan *self, int fd,
+                       const struct sockaddr_in6 *dest, unsigned int mark,
+                       HevEgressSlot **slot)
+{
+    const struct sockaddr_in6 *addr;
+    int family;
+    int res;
+
+    if (IN6_IS_ADDR_V4MAPPED (&dest->sin6_addr))
+        family = AF_INET;
+    else
+        family = AF_INET6;
+
+    addr = self->addrs[family == AF_INET6 ? ADDR_BIND6 : ADDR_BIND4];
+
+    if (self->pool && !*slot) {
+        res = hev_egress_pool_bind (self->pool, fd, family, dest, slot);
+        if (res < 0)
+            return -1;
+        if (res == 0)
+            addr = NULL;
+    }
+
+    if (addr) {
+        /* Ports are picked at connect, per destination. */
+        res = set_sock_bind_no_port (fd);
+        if (res < 0)
+            return -1;
+
+        res = bind (fd, (struct sockaddr *)addr, sizeof (*addr));
+        if (res < 0)
+            return -1;
+    }
+
+    if (self->iface) {
+        res = set_sock_bind (fd, self->iface);
+        if (res < 0)
+            return -1;
+    }
+
+    if (!mark)
+        mark = self->mark;
+
+    if (mark) {
+        res = set_sock_mark (fd, mark);
+        if (res < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+const struct sockaddr_in6 *
+hev_egress_plan_get_udp_address (HevEgressPlan *self)
+{
+    return self->addrs[ADDR_UDP];
+}
+
+const struct sockaddr_in6 *
+hev_egress_plan_get_udp_public_address (HevEgressPlan *self, int family)
+{
+    if (family == AF_INET6)
+        return self->addrs[ADDR_UDP_PUBLIC6];
+
+    return self->addrs[ADDR_UDP_PUBLIC4];
+}
@@ -0,0 +1,89 @@
+/*
+ ============================================================================
+ Name        : hev-egress-plan.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Egress Plan
+ ============================================================================
+ */
+
+#ifndef __HEV_EGRESS_PLAN_H__
+#define __HEV_EGRESS_PLAN_H__
+
+#include <netinet/in.h>
+
+#include "hev-egress-pool.h"
+
+typedef struct _HevEgressPlan HevEgressPlan;
+
+/**
+ * hev_egress_plan_new:
+ *
+ * Resolve the bind and udp addresses of the config once, and gather the
+ * address pool, the bind interface and the socket mark, so that setting up
+ * an outbound socket costs no lookups. The interface stays bound by name,
+ * which the kernel resolves, so it may come and go.
+ *
+ * Returns: returns egress plan on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevEgressPlan *hev_egress_plan_new (void);
+
+/**
+ * hev_egress_plan_destroy:
+ * @self: a #HevEgressPlan
+ *
+ * Destroy the plan, after every slot is released.
+ *
+ * Since: 2.14
+ */
+void hev_egress_plan_destroy (HevEgressPlan *self);
+
+/**
+ * hev_egress_plan_apply:
+ * @self: a #HevEgressPlan
+ * @fd: an unconnected IPv6 socket
+ * @dest: the destination
+ * @mark: the socket mark, or zero for the configured one
+ * @slot: (inout): the pool slot of the session, bound only if %NULL
+ *
+ * Bind @fd to the source address and the interface for @dest, and set
+ * its mark.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_egress_plan_apply (HevEgressPlan *self, int fd,
+                           const struct sockaddr_in6 *dest, unsigned int mark,
+                           HevEgressSlot **slot);
+
+/**
+ * hev_egress_plan_get_udp_address:
+ * @self: a #HevEgressPlan
+ *
+ * Get the resolved udp listen address.
+ *
+ * Returns: (nullable): returns the address, or %NULL if not configured.
+ *
+ * Since: 2.14
+ */
+const struct sockaddr_in6 *
+hev_egress_plan_get_udp_address (HevEgressPlan *self);
+
+/**
+ * hev_egress_plan_get_udp_public_address:
+ * @self: a #HevEgressPlan
+ * @family: AF_INET or AF_INET6
+ *
+ * Get the resolved udp public address of @family.
+ *
+ * Returns: (nullable): returns the address, or %NULL if not configured.
+ *
+ * Since: 2.14
+ */
+const struct sockaddr_in6 *
+hev_egress_plan_get_udp_public_address (HevEgressPlan *self, int family);
+
+#endif /* __HEV_EGRESS_PLAN_H__ */
@@ -0,0 +1,233 @@
+/*
+ ============================================================================
+ Name        : hev-egress-pool.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Egress Source Address Pool
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-misc.h"
+#include "hev-logger.h"
+#include "hev-cidr-trie.h"
+
+#include "hev-egress-pool.h"
+
+/* Counters are bumped by all workers, one slot per cache line. */
+struct _HevEgressSlot
+{
+    atomic_uint used;
+    unsigned int plen;
+    uint8_t addr[16];
+    uint8_t pad[40];
+};
+
+struct _HevEgressPool
+{
+    atomic_uint seq;
+    int least_used;
+    unsigned int num[2];
+
+    HevEgressSlot *slots[2];
+};
+
+static uint64_t
+mix64 (uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static int
+is_v4_mapped (const uint8_t *addr, unsigned int plen)
+{
+    static const uint8_t prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff,
+                                        0xff };
+
+    return plen >= 96 && memcmp (addr, prefix, sizeof (prefix)) == 0;
+}
+
+static int
+hev_egress_pool_add (HevEgressPool *self, const char *str, unsigned int len)
+{
+    HevEgressSlot *slots;
+    unsigned int plen;
+    uint8_t addr[16];
+    int idx;
+
+    if (hev_cidr_trie_parse (str, len, addr, &plen) < 0) {
+        LOG_E ("egress pool address %.*s", len, str);
+        return -1;
+    }
+
+    idx = !is_v4_mapped (addr, plen);
+    slots = realloc (self->slots[idx],
+                     sizeof (HevEgressSlot) * (self->num[idx] + 1));
+    if (!slots)
+        return -1;
+
+    self->slots[idx] = slots;
+    slots = &slots[self->num[idx]++];
+    memset (slots, 0, sizeof (HevEgressSlot));
+    memcpy (slots->addr, addr, 16);
+    slots->plen = plen;
+
+    return 0;
+}
+
+HevEgressPool *
+hev_egress_pool_new (const char *addrs, int least_used)
+{
+    HevEgressPool *self;
+    const char *sep = " \t,";
+
+    self = hev_malloc0 (sizeof (HevEgressPool));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p egress pool new", self);
+
+    self->least_used = least_used;
+
+    for (;;) {
+        unsigned int len;
+
+        addrs += strspn (addrs, sep);
+        len = strcspn (addrs, sep);
+        if (!len)
+            break;
+
+        if (hev_egress_pool_add (self, addrs, len) < 0) {
+            hev_egress_pool_destroy (self);
+            return NULL;
+        }
+
+        addrs += len;
+    }
+
+    LOG_I ("egress pool %u ipv4, %u ipv6 entries", self->num[0],
+           self->num[1]);
+
+    return self;
+}
+
+void
+hev_egress_pool_destroy (HevEgressPool *self)
+{
+    LOG_D ("%p egress pool destroy", self);
+
+    free (self->slots[0]);
+    free (self->slots[1]);
+    hev_free (self);
+}
+
+static HevEgressSlot *
+hev_egress_pool_pick (HevEgressPool *self, int idx, uint64_t hash)
+{
+    HevEgressSlot *slots = self->slots[idx];
+    unsigned int num = self->num[idx];
+    unsigned int min;
+    unsigned int i;
+    unsigned int j;
+
+    i = hash % num;
+    if (!self->least_used)
+        return &slots[i];
+
+    /* Start at the hashed slot, so ties do not pile up on the first. */
+    min = i;
+    for (j = 1; j < num; j++) {
+        unsigned int k = (i + j) % num;
+
+        if (atomic_load_explicit (&slots[k].used, memory_order_relaxed) <
+            atomic_load_explicit (&slots[min].used, memory_order_relaxed))
+            min = k;
+    }
+
+    return &slots[min];
+}
+
+/* Random host bits, the low 64 at most, never all zeros. */
+static void
+fill_host (uint8_t *addr, unsigned int plen, uint64_t bits)
+{
+    unsigned int zero = 1;
+    unsigned int i;
+
+    for (i = (plen > 64) ? plen / 8 : 8; i < 16; i++) {
+        uint8_t mask = (i == plen / 8) ? (0xff >> (plen & 7)) : 0xff;
+
+        addr[i] = (addr[i] & ~mask) | ((bits >> ((15 - i) * 8)) & mask);
+        if (addr[i] & mask)
+            zero = 0;
+    }
+
+    if (zero)
+        addr[15] |= 1;
+}
+
+int
+hev_egress_pool_bind (HevEgressPool *self, int fd, int family,
+                      const struct sockaddr_in6 *dest, HevEgressSlot **slot)
+{
+    struct sockaddr_in6 addr;
+    HevEgressSlot *s;
+    uint64_t hash;
+    uint64_t d[2];
+    int idx;
+    int res;
+
+    idx = family == AF_INET6;
+    if (!self->num[idx])
+        return 1;
+
+    /*
+     * The destination spreads popular targets, the sequence spreads the
+     * connections to one target over the pool.
+     */
+    memcpy (d, &dest->sin6_addr, 16);
+    hash = d[0] ^ mix64 (d[1] ^ dest->sin6_port);
+    hash = mix64 (hash + atomic_fetch_add_explicit (&self->seq, 1,
+                                                    memory_order_relaxed));
+    s = hev_egress_pool_pick (self, idx, hash);
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sin6_family = AF_INET6;
+    memcpy (&addr.sin6_addr, s->addr, 16);
+
+    if (s->plen < 128) {
+        fill_host (addr.sin6_addr.s6_addr, s->plen, mix64 (hash));
+        res = set_sock_freebind (fd);
+        if (res < 0)
+            return -1;
+    }
+
+    res = set_sock_bind_no_port (fd);
+    if (res < 0)
+        return -1;
+
+    res = bind (fd, (struct sockaddr *)&addr, sizeof (addr));
+    if (res < 0)
+        return -1;
+
+    atomic_fetch_add_explicit (&s->used, 1, memory_order_relaxed);
+    *slot = s;
+
+    return 0;
+}
+
+void
+hev_egress_pool_release (HevEgressSlot *slot)
+{
+    atomic_fetch_sub_explicit (&slot->used, 1, memory_order_relaxed);
+}
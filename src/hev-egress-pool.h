@@ -0,0 +1,75 @@
+/*
+ ============================================================================
+ Name        : hev-egress-pool.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Egress Source Address Pool
+ ============================================================================
+ */
+
+#ifndef __HEV_EGRESS_POOL_H__
+#define __HEV_EGRESS_POOL_H__
+
+#include <netinet/in.h>
+
+typedef struct _HevEgressPool HevEgressPool;
+typedef struct _HevEgressSlot HevEgressSlot;
+
+/**
+ * hev_egress_pool_new:
+ * @addrs: addresses and prefixes, separated by spaces or commas
+ * @least_used: pick the address with the fewest sessions instead of
+ *              spreading by hash
+ *
+ * Create a pool of source addresses for outbound sockets. A prefix shorter
+ * than a full address stands for all of its addresses, which are bound
+ * with IP_FREEBIND and must be routed to this host.
+ *
+ * Returns: returns egress pool on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevEgressPool *hev_egress_pool_new (const char *addrs, int least_used);
+
+/**
+ * hev_egress_pool_destroy:
+ * @self: a #HevEgressPool
+ *
+ * Destroy the pool, after every slot is released.
+ *
+ * Since: 2.14
+ */
+void hev_egress_pool_destroy (HevEgressPool *self);
+
+/**
+ * hev_egress_pool_bind:
+ * @self: a #HevEgressPool
+ * @fd: an unconnected IPv6 socket
+ * @family: family of the destination, AF_INET or AF_INET6
+ * @dest: the destination
+ * @slot: (out): the slot to release when the socket is done
+ *
+ * Bind @fd to a source address of @family from the pool. The port is left
+ * to connect time (IP_BIND_ADDRESS_NO_PORT), so the 4-tuple space of each
+ * source address is shared by all destinations instead of being reserved.
+ *
+ * Returns: returns zero if bound, 1 if the pool has no address of @family,
+ *          otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_egress_pool_bind (HevEgressPool *self, int fd, int family,
+                          const struct sockaddr_in6 *dest,
+                          HevEgressSlot **slot);
+
+/**
+ * hev_egress_pool_release:
+ * @slot: a #HevEgressSlot
+ *
+ * Release a slot returned by hev_egress_pool_bind().
+ *
+ * Since: 2.14
+ */
+void hev_egress_pool_release (HevEgressSlot *slot);
+
+#endif /* __HEV_EGRESS_POOL_H__ */
@@ -0,0 +1,346 @@
+/*
+ ============================================================================
+ Name        : hev-handover.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Listener Handover
+ ============================================================================
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-handover.h"
+
+#define HANDOVER_MAGIC (0x48534f35)
+#define HANDOVER_TIMEOUT (10)
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+typedef struct _HevHandoverHead HevHandoverHead;
+
+struct _HevHandover
+{
+    int fd;
+};
+
+struct _HevHandoverHead
+{
+    unsigned int magic;
+    unsigned int num;
+};
+
+static int
+hev_handover_addr (struct sockaddr_un *addr, const char *path)
+{
+    memset (addr, 0, sizeof (*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen (path) >= sizeof (addr->sun_path))
+        return -1;
+
+    strcpy (addr->sun_path, path);
+    return 0;
+}
+
+static void
+hev_handover_set_timeout (int fd)
+{
+    struct timeval tv = { HANDOVER_TIMEOUT, 0 };
+
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+}
+
+/* Only a process of the same user may take or hand over the listeners. */
+static int
+hev_handover_check_peer (int fd)
+{
+    uid_t uid;
+
+#if defined(__linux__)
+    struct ucred cred;
+    socklen_t len = sizeof (cred);
+
+    if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return -1;
+    uid = cred.uid;
+#else
+    gid_t gid;
+
+    if (getpeereid (fd, &uid, &gid) < 0)
+        return -1;
+#endif
+
+    if (uid != geteuid ())
+        return -1;
+
+    return 0;
+}
+
+/*
+ * The path is only taken from a socket nobody listens on any more, or
+ * from the previous owner once it handed over. Anything else is left.
+ */
+static int
+hev_handover_unlink (const struct sockaddr_un *addr, int takeover)
+{
+    struct stat st;
+    int res;
+    int fd;
+
+    if (lstat (addr->sun_path, &st) < 0)
+        return (errno == ENOENT) ? 0 : -1;
+    if (!S_ISSOCK (st.st_mode))
+        return -1;
+
+    if (!takeover) {
+        fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        res = connect (fd, (struct sockaddr *)addr, sizeof (*addr));
+        close (fd);
+        if (res == 0 || errno != ECONNREFUSED)
+            return -1;
+    }
+
+    return unlink (addr->sun_path);
+}
+
+HevHandover *
+hev_handover_new (const char *path, int takeover)
+{
+    struct sockaddr_un addr;
+    HevHandover *self;
+    int res;
+
+    if (hev_handover_addr (&addr, path) < 0) {
+        LOG_E ("handover path %s", path);
+        return NULL;
+    }
+
+    self = hev_malloc0 (sizeof (HevHandover));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p handover new", self);
+
+    self->fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (self->fd < 0) {
+        LOG_E ("%p handover socket", self);
+        goto exit;
+    }
+
+    if (hev_handover_unlink (&addr, takeover) < 0) {
+        LOG_E ("%p handover path %s in use", self, path);
+        goto exit;
+    }
+
+    res = bind (self->fd, (struct sockaddr *)&addr, sizeof (addr));
+    if (res < 0) {
+        LOG_E ("%p handover bind %s", self, path);
+        goto exit;
+    }
+
+    /* Peers are checked too, this keeps others from even connecting. */
+    chmod (path, 0600);
+
+    res = listen (self->fd, 1);
+    if (res < 0) {
+        LOG_E ("%p handover listen", self);
+        goto exit;
+    }
+
+    return self;
+
+exit:
+    hev_handover_destroy (self);
+    return NULL;
+}
+
+void
+hev_handover_destroy (HevHandover *self)
+{
+    LOG_D ("%p handover destroy", self);
+
+    if (self->fd >= 0)
+        close (self->fd);
+    hev_free (self);
+}
+
+int
+hev_handover_accept (HevHandover *self)
+{
+    int fd;
+
+    for (;;) {
+        fd = accept (self->fd, NULL, NULL);
+        if (fd < 0 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        if (fd < 0)
+            return -1;
+
+        if (hev_handover_check_peer (fd) == 0)
+            break;
+
+        LOG_W ("%p handover peer of another user", self);
+        close (fd);
+    }
+
+    hev_handover_set_timeout (fd);
+
+    return fd;
+}
+
+void
+hev_handover_shutdown (HevHandover *self)
+{
+    /* Wakes up a thread blocked in accept. */
+    shutdown (self->fd, SHUT_RDWR);
+}
+
+int
+hev_handover_send (int fd, const int *fds, int num)
+{
+    char buf[CMSG_SPACE (sizeof (int) * HEV_HANDOVER_MAX_FDS)];
+    HevHandoverHead head;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    char ack;
+    int res;
+
+    if (num > HEV_HANDOVER_MAX_FDS)
+        num = HEV_HANDOVER_MAX_FDS;
+
+    head.magic = HANDOVER_MAGIC;
+    head.num = num;
+    iov.iov_base = &head;
+    iov.iov_len = sizeof (head);
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = CMSG_SPACE (sizeof (int) * num);
+
+    memset (buf, 0, sizeof (buf));
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int) * num);
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * num);
+
+    res = sendmsg (fd, &msg, 0);
+    if (res != sizeof (head))
+        return -1;
+
+    /* The peer acks once it is serving, otherwise we keep going. */
+    res = read (fd, &ack, sizeof (ack));
+    if (res != sizeof (ack))
+        return -1;
+
+    return 0;
+}
+
+int
+hev_handover_connect (const char *path)
+{
+    struct sockaddr_un addr;
+    int res;
+    int fd;
+
+    if (hev_handover_addr (&addr, path) < 0)
+        return -1;
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    res = connect (fd, (struct sockaddr *)&addr, sizeof (addr));
+    if (res < 0 || hev_handover_check_peer (fd) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    hev_handover_set_timeout (fd);
+
+    return fd;
+}
+
+int
+hev_handover_recv (int fd, int *fds, int max)
+{
+    char buf[CMSG_SPACE (sizeof (int) * HEV_HANDOVER_MAX_FDS)];
+    HevHandoverHead head;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    int num = 0;
+    int res;
+
+    iov.iov_base = &head;
+    iov.iov_len = sizeof (head);
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof (buf);
+
+    res = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC);
+    if (res != sizeof (head))
+        return -1;
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+        int *data;
+        int n;
+        int i;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        data = (int *)CMSG_DATA (cmsg);
+        n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+        for (i = 0; i < n; i++) {
+            if (num < max && head.magic == HANDOVER_MAGIC)
+                fds[num++] = data[i];
+            else
+                close (data[i]);
+        }
+    }
+
+    if (head.magic != HANDOVER_MAGIC)
+        return -1;
+
+    return num;
+}
+
+int
+hev_handover_ack (int fd)
+{
+    char ack = 'k';
+    int res;
+
+    res = write (fd, &ack, sizeof (ack));
+    if (res != sizeof (ack))
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ ============================================================================
+ Name        : hev-handover.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Listener Handover
+ ============================================================================
+ */
+
+#ifndef __HEV_HANDOVER_H__
+#define __HEV_HANDOVER_H__
+
+#define HEV_HANDOVER_MAX_FDS (250)
+
+typedef struct _HevHandover HevHandover;
+
+HevHandover *hev_handover_new (const char *path, int takeover);
+void hev_handover_destroy (HevHandover *self);
+
+int hev_handover_accept (HevHandover *self);
+void hev_handover_shutdown (HevHandover *self);
+
+int hev_handover_send (int fd, const int *fds, int num);
+int hev_handover_connect (const char *path);
+int hev_handover_recv (int fd, int *fds, int max);
+int hev_handover_ack (int fd);
+
+#endif /* __HEV_HANDOVER_H__ */
@@ -19,6 +19,8 @@
 #include "hev-config.h"
 #include "hev-config-const.h"
 #include "hev-logger.h"
+#include "hev-auth-file.h"
+#include "hev-auth-hash.h"
 #include "hev-socks5-proxy.h"
 
 #include "hev-main.h"
@@ -33,6 +35,8 @@ static void
 show_help (const char *self_path)
 {
     printf ("%s CONFIG_PATH\n", self_path);
+    printf ("%s --compile-auth AUTH_FILE DB_FILE\n", self_path);
+    printf ("%s --hash-password < PASSWORD\n", self_path);
     printf ("Version: %u.%u.%u %s\n", MAJOR_VERSION, MINOR_VERSION,
             MICRO_VERSION, COMMIT_ID);
 }
@@ -43,6 +47,31 @@ sigint_handler (int signum)
     hev_socks5_proxy_stop ();
 }
 
+static int
+hash_password (void)
+{
+    char pass[256 + 2];
+    char out[128];
+    size_t len;
+
+    if (!fgets (pass, sizeof (pass), stdin))
+        return -1;
+
+    len = strcspn (pass, "\r\n");
+    if (!len || len > 255) {
+        fprintf (stderr, "Invalid password length\n");
+        return -1;
+    }
+
+    if (hev_auth_hash_make (pass, len, out, sizeof (out)) < 0) {
+        fprintf (stderr, "Hash password failed\n");
+        return -1;
+    }
+
+    printf ("%s\n", out);
+    return 0;
+}
+
 static int
 hev_socks5_server_main_inner (void)
 {
@@ -59,6 +88,12 @@ hev_socks5_server_main_inner (void)
     timeout = hev_config_get_misc_connect_timeout ();
     hev_socks5_set_connect_timeout (timeout);
     timeout = hev_config_get_misc_tcp_read_write_timeout ();
+    /*
+     * The worker timer wheels own the idle deadline of tcp sessions
+     * instead, associations leave them for the udp timeout.
+     */
+    if (hev_config_get_misc_timer_wheel ())
+        timeout = -1;
     hev_socks5_set_tcp_timeout (timeout);
     timeout = hev_config_get_misc_udp_read_write_timeout ();
     hev_socks5_set_udp_timeout (timeout);
@@ -131,17 +166,34 @@ hev_socks5_server_quit (void)
     hev_socks5_proxy_stop ();
 }
 
+void
+hev_socks5_server_set_workers (int num)
+{
+    hev_socks5_proxy_set_workers (num);
+}
+
 WEAK int
 main (int argc, char *argv[])
 {
     int res;
 
+    if (argc == 4 && strcmp (argv[1], "--compile-auth") == 0) {
+        hev_logger_init (HEV_LOGGER_INFO, "stderr");
+        res = hev_auth_file_compile (argv[2], argv[3]);
+        hev_logger_fini ();
+        return (res < 0) ? -1 : 0;
+    }
+
+    if (argc == 2 && strcmp (argv[1], "--hash-password") == 0)
+        return hash_password ();
+
     if (argc < 2 || strcmp (argv[1], "--version") == 0) {
         show_help (argv[0]);
         return -1;
     }
 
     signal (SIGINT, sigint_handler);
+    hev_socks5_proxy_set_standalone (1);
 
     res = hev_socks5_server_main_from_file (argv[1]);
     if (res < 0)
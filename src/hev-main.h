@@ -51,6 +51,17 @@ int hev_socks5_server_main_from_str (const unsigned char *config_str,
  */
 void hev_socks5_server_quit (void);
 
+/**
+ * hev_socks5_server_set_workers:
+ * @num: number of workers
+ *
+ * Add or drain workers at runtime, up to main.max-workers. Removed workers
+ * stop accepting and exit when their sessions are gone.
+ *
+ * Since: 2.14.0
+ */
+void hev_socks5_server_set_workers (int num);
+
 #ifdef __cplusplus
 }
 #endif
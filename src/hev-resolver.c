@@ -0,0 +1,473 @@
+/*
+ ============================================================================
+ Name        : hev-resolver.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Resolver
+ ============================================================================
+ */
+
+/*
+ * The core reaches the resolver through the build flags, which must be
+ * set for every source: without them names would silently bypass the
+ * acls and the cache.
+ */
+#ifndef hev_task_dns_getaddrinfo
+#error "RESOLVER_CFLAGS of build.mk are missing"
+#endif
+
+/* The only caller of the real resolver. */
+#undef hev_task_dns_getaddrinfo
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <hev-task-dns.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-resolver.h"
+
+#define NAME_BUCKETS (4096)
+
+typedef struct _HevResolverThread HevResolverThread;
+typedef struct _HevResolverPrefetch HevResolverPrefetch;
+
+struct _HevResolverThread
+{
+    HevResolverName *names[NAME_BUCKETS];
+    HevResolverPrefetch *prefetches;
+};
+
+struct _HevResolverPrefetch
+{
+    HevResolverPrefetch *next;
+    HevTask *task;
+    HevDnsCacheKey key;
+    int cancel;
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+static HevDnsCache *cache;
+static HevDnsClient *client;
+static unsigned int cache_ttl;
+static unsigned int cache_negative_ttl;
+static unsigned int wait_timeout;
+
+static void
+hev_resolver_thread_free (void *data)
+{
+    hev_free (data);
+}
+
+static void
+hev_resolver_init (void)
+{
+    pthread_key_create (&thread_key, hev_resolver_thread_free);
+}
+
+static HevResolverThread *
+hev_resolver_thread (int create)
+{
+    HevResolverThread *rt;
+
+    pthread_once (&once, hev_resolver_init);
+    rt = pthread_getspecific (thread_key);
+    if (!rt && create) {
+        rt = hev_malloc0 (sizeof (HevResolverThread));
+        if (rt)
+            pthread_setspecific (thread_key, rt);
+    }
+
+    return rt;
+}
+
+static HevResolverName **
+hev_resolver_bucket (HevResolverThread *rt, HevTask *task)
+{
+    uint64_t h = (uintptr_t)task;
+
+    h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+    return &rt->names[(h >> 32) % NAME_BUCKETS];
+}
+
+static void
+hev_resolver_fill (HevDnsCacheAnswer *ans, int ret, struct addrinfo *res)
+{
+    struct addrinfo *ai;
+
+    memset (ans, 0, sizeof (HevDnsCacheAnswer));
+    ans->error = ret;
+
+    for (ai = ret ? NULL : res; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            struct sockaddr_in *sa = (struct sockaddr_in *)ai->ai_addr;
+
+            memcpy (ans->addr, &sa->sin_addr, 4);
+            break;
+        } else if (ai->ai_family == AF_INET6) {
+            struct sockaddr_in6 *sa = (struct sockaddr_in6 *)ai->ai_addr;
+
+            memcpy (ans->addr, &sa->sin6_addr, 16);
+            break;
+        }
+    }
+
+    if (ai)
+        ans->family = ai->ai_family;
+    else if (!ret)
+        ans->error = EAI_NONAME;
+}
+
+static unsigned int
+hev_resolver_negative_ttl (int error)
+{
+    /* Only answers from the name servers, not local failures. */
+    if (error == EAI_NONAME)
+        return cache_negative_ttl;
+#ifdef EAI_NODATA
+    if (error == EAI_NODATA)
+        return cache_negative_ttl;
+#endif
+
+    return 0;
+}
+
+static int
+hev_resolver_answer (const HevDnsCacheAnswer *ans, const char *service,
+                     const struct addrinfo *hints, struct addrinfo **res)
+{
+    struct addrinfo h = { 0 };
+    char addr[INET6_ADDRSTRLEN];
+
+    if (ans->error)
+        return ans->error;
+
+    if (hints) {
+        h.ai_flags = hints->ai_flags;
+        h.ai_family = hints->ai_family;
+        h.ai_socktype = hints->ai_socktype;
+        h.ai_protocol = hints->ai_protocol;
+    }
+
+    /*
+     * Built by the libc from the numeric address, so that callers free it
+     * with freeaddrinfo as usual. Nothing is looked up.
+     */
+    h.ai_flags |= AI_NUMERICHOST;
+    inet_ntop (ans->family, ans->addr, addr, sizeof (addr));
+
+    return getaddrinfo (addr, service, &h, res);
+}
+
+static int
+hev_resolver_numeric (const char *node, const char *service,
+                      const struct addrinfo *hints, struct addrinfo **res)
+{
+    struct addrinfo h = { 0 };
+
+    if (hints) {
+        h.ai_flags = hints->ai_flags;
+        h.ai_family = hints->ai_family;
+        h.ai_socktype = hints->ai_socktype;
+        h.ai_protocol = hints->ai_protocol;
+    }
+
+    h.ai_flags |= AI_NUMERICHOST;
+    return getaddrinfo (node, service, &h, res);
+}
+
+/*
+ * Resolve with the native client if set, otherwise with the system
+ * resolver. Fills @ans and @ttl for the cache, and @res if asked for.
+ */
+static int
+hev_resolver_fetch (const char *node, int family, const char *service,
+                    const struct addrinfo *hints, struct addrinfo **res,
+                    HevDnsCacheAnswer *ans, unsigned int *ttl,
+                    const int *cancel)
+{
+    struct addrinfo *ai = NULL;
+    unsigned int nttl;
+    int ret;
+
+    if (client) {
+        ret = hev_dns_client_resolve (client, node, family, ans, ttl, cancel);
+        if (ret) {
+            nttl = hev_resolver_negative_ttl (ret);
+            if (!*ttl || *ttl > nttl)
+                *ttl = nttl;
+        } else if (*ttl > cache_ttl) {
+            *ttl = cache_ttl;
+        }
+
+        if (!res)
+            return ret;
+        return hev_resolver_answer (ans, service, hints, res);
+    }
+
+    ret = hev_task_dns_getaddrinfo (node, service, hints, &ai);
+    hev_resolver_fill (ans, ret, ai);
+
+    /* The system resolver does not tell record ttls. */
+    *ttl = ans->error ? hev_resolver_negative_ttl (ans->error) : cache_ttl;
+
+    if (res)
+        *res = ai;
+    else if (ret == 0)
+        freeaddrinfo (ai);
+
+    return ret;
+}
+
+static void
+hev_resolver_prefetch_entry (void *data)
+{
+    struct addrinfo hints = { 0 };
+    HevResolverPrefetch *p = data;
+    HevResolverPrefetch **pp;
+    HevResolverThread *rt;
+    HevDnsCacheAnswer ans;
+    unsigned int ttl;
+    int ret;
+
+    hints.ai_family = p->key.family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    ret = hev_resolver_fetch (p->key.name, p->key.family, NULL, &hints, NULL,
+                              &ans, &ttl, &p->cancel);
+    if (!p->cancel || ret != EAI_AGAIN)
+        hev_dns_cache_store (cache, &p->key, &ans, ttl);
+
+    rt = hev_resolver_thread (0);
+    for (pp = &rt->prefetches; *pp; pp = &(*pp)->next) {
+        if (*pp == p) {
+            *pp = p->next;
+            break;
+        }
+    }
+
+    hev_free (p);
+}
+
+static void
+hev_resolver_prefetch (const HevDnsCacheKey *key)
+{
+    HevResolverPrefetch *p;
+    HevResolverThread *rt;
+
+    rt = hev_resolver_thread (1);
+    if (!rt)
+        return;
+
+    p = hev_malloc0 (sizeof (HevResolverPrefetch));
+    if (!p)
+        return;
+
+    p->task = hev_task_new (-1);
+    if (!p->task) {
+        hev_free (p);
+        return;
+    }
+
+    LOG_D ("resolver prefetch %s", key->name);
+
+    /* Listed on the thread, so that its worker can cancel it on exit. */
+    memcpy (&p->key, key, sizeof (HevDnsCacheKey));
+    p->next = rt->prefetches;
+    rt->prefetches = p;
+
+    hev_task_run (p->task, hev_resolver_prefetch_entry, p);
+}
+
+static int
+hev_resolver_resolve (const char *node, const char *service,
+                      const struct addrinfo *hints, struct addrinfo **res,
+                      const int *cancel)
+{
+    HevDnsCacheQuery *query = NULL;
+    HevDnsCacheAnswer ans;
+    HevDnsCacheKey key;
+    unsigned int ttl;
+    int family = 0;
+    int leader;
+    int ret;
+
+    if (hints) {
+        if (hints->ai_flags & AI_CANONNAME)
+            goto bypass;
+        family = hints->ai_family;
+    }
+
+    if ((!cache && !client) || !node)
+        goto bypass;
+    if (family != AF_UNSPEC && family != AF_INET && family != AF_INET6)
+        goto bypass;
+
+    /* Addresses never reach the name servers. */
+    if (client) {
+        ret = hev_resolver_numeric (node, service, hints, res);
+        if (ret != EAI_NONAME)
+            return ret;
+    }
+
+    if (hev_dns_cache_key (&key, node, family) < 0)
+        goto bypass;
+
+    if (cache) {
+        ret = hev_dns_cache_lookup (cache, &key, &ans);
+        if (ret == 0) {
+            if (ans.refresh)
+                hev_resolver_prefetch (&key);
+            return hev_resolver_answer (&ans, service, hints, res);
+        }
+
+        query = hev_dns_cache_join (cache, &key, &leader);
+        if (!leader) {
+            if (hev_dns_cache_wait (query, &ans, wait_timeout, cancel) < 0)
+                return EAI_AGAIN;
+            return hev_resolver_answer (&ans, service, hints, res);
+        }
+    }
+
+    ret = hev_resolver_fetch (node, family, service, hints, res, &ans, &ttl,
+                              cancel);
+
+    if (cache) {
+        hev_dns_cache_store (cache, &key, &ans, ttl);
+        if (query)
+            hev_dns_cache_finish (cache, query, &ans);
+    }
+
+    return ret;
+
+bypass:
+    return hev_task_dns_getaddrinfo (node, service, hints, res);
+}
+
+int
+hev_resolver_getaddrinfo (const char *node, const char *service,
+                          const struct addrinfo *hints, struct addrinfo **res)
+{
+    HevResolverName *rn;
+    size_t len;
+    int ret;
+
+    rn = hev_resolver_find (hev_task_self ());
+
+    ret = hev_resolver_resolve (node, service, hints, res,
+                                rn ? &rn->cancel : NULL);
+    if (ret || !node || !rn)
+        return ret;
+
+    /* Kept for the binder or the sender that runs next on this task. */
+    len = strlen (node);
+    if (len >= sizeof (rn->name)) {
+        rn->len = -1;
+        return ret;
+    }
+
+    memcpy (rn->name, node, len + 1);
+    rn->len = len;
+
+    return ret;
+}
+
+int
+hev_resolver_attach (HevResolverName *rn)
+{
+    HevResolverThread *rt;
+    HevResolverName **bucket;
+
+    rt = hev_resolver_thread (1);
+    if (!rt)
+        return -1;
+
+    rn->task = hev_task_self ();
+    rn->len = 0;
+
+    bucket = hev_resolver_bucket (rt, rn->task);
+    rn->next = *bucket;
+    *bucket = rn;
+
+    return 0;
+}
+
+void
+hev_resolver_detach (HevResolverName *rn)
+{
+    HevResolverThread *rt;
+    HevResolverName **pn;
+
+    rt = hev_resolver_thread (0);
+    if (!rt)
+        return;
+
+    pn = hev_resolver_bucket (rt, rn->task);
+    for (; *pn; pn = &(*pn)->next) {
+        if (*pn == rn) {
+            *pn = rn->next;
+            break;
+        }
+    }
+}
+
+HevResolverName *
+hev_resolver_find (HevTask *task)
+{
+    HevResolverThread *rt;
+    HevResolverName *rn;
+
+    rt = hev_resolver_thread (0);
+    if (!rt)
+        return NULL;
+
+    rn = *hev_resolver_bucket (rt, task);
+    for (; rn; rn = rn->next) {
+        if (rn->task == task)
+            return rn;
+    }
+
+    return NULL;
+}
+
+void
+hev_resolver_cancel (void)
+{
+    HevResolverThread *rt;
+    HevResolverPrefetch *p;
+
+    rt = hev_resolver_thread (0);
+    if (!rt)
+        return;
+
+    for (p = rt->prefetches; p; p = p->next) {
+        p->cancel = 1;
+        hev_task_wakeup (p->task);
+    }
+}
+
+void
+hev_resolver_set_cache (HevDnsCache *c, unsigned int ttl,
+                        unsigned int negative_ttl, unsigned int timeout)
+{
+    LOG_D ("resolver set cache");
+
+    cache = c;
+    cache_ttl = ttl;
+    cache_negative_ttl = negative_ttl;
+    wait_timeout = timeout;
+}
+
+void
+hev_resolver_set_client (HevDnsClient *c)
+{
+    LOG_D ("resolver set client");
+
+    client = c;
+}
@@ -0,0 +1,127 @@
+/*
+ ============================================================================
+ Name        : hev-resolver.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Resolver
+ ============================================================================
+ */
+
+#ifndef __HEV_RESOLVER_H__
+#define __HEV_RESOLVER_H__
+
+#include <netdb.h>
+#include <hev-task.h>
+
+#include "hev-dns-cache.h"
+#include "hev-dns-client.h"
+
+typedef struct _HevResolverName HevResolverName;
+
+struct _HevResolverName
+{
+    HevResolverName *next;
+    HevTask *task;
+    /* 0: no name, -1: a name too long to keep */
+    int len;
+    /* Set by the terminator of the task, lookups then give up. */
+    int cancel;
+    char name[256];
+};
+
+/**
+ * hev_resolver_getaddrinfo:
+ * @node: host name
+ * @service: service name
+ * @hints: hints
+ * @res: (out): results
+ *
+ * Resolve a name on the calling task. The build routes every call to
+ * hev_task_dns_getaddrinfo here, including those of the socks5 core, so
+ * the names clients ask for are recorded in the #HevResolverName of the
+ * task, and answered from the cache and the native client if they are
+ * set.
+ *
+ * Returns: returns zero on successful, otherwise returns an error code.
+ *
+ * Since: 2.14
+ */
+int hev_resolver_getaddrinfo (const char *node, const char *service,
+                              const struct addrinfo *hints,
+                              struct addrinfo **res);
+
+/**
+ * hev_resolver_attach:
+ * @rn: a #HevResolverName
+ *
+ * Attach @rn to the calling task, for the thread the task runs on. Every
+ * name the task resolves is then recorded in @rn, and stays there until
+ * its owner resets @len. The record belongs to the owner of @rn, nothing
+ * is shared with other tasks.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_resolver_attach (HevResolverName *rn);
+
+/**
+ * hev_resolver_detach:
+ * @rn: a #HevResolverName
+ *
+ * Detach @rn from its task, on the thread it was attached on.
+ *
+ * Since: 2.14
+ */
+void hev_resolver_detach (HevResolverName *rn);
+
+/**
+ * hev_resolver_find:
+ * @task: a #HevTask
+ *
+ * Find the record attached to @task on the calling thread.
+ *
+ * Returns: returns the record, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevResolverName *hev_resolver_find (HevTask *task);
+
+/**
+ * hev_resolver_cancel:
+ *
+ * Cancel the prefetches started on the calling thread. They end soon
+ * after, as ordinary tasks of the thread.
+ *
+ * Since: 2.14
+ */
+void hev_resolver_cancel (void);
+
+/**
+ * hev_resolver_set_cache:
+ * @cache: (nullable): a #HevDnsCache
+ * @ttl: time to live of answers in seconds, the bound of record ttls
+ * @negative_ttl: time to live of names that do not exist in seconds
+ * @timeout: longest wait for the query of another lookup in milliseconds
+ *
+ * Set the cache lookups go through. A cached name is answered with its
+ * first address, and concurrent lookups of a name share one query. Only
+ * call it before workers start or after they are gone.
+ *
+ * Since: 2.14
+ */
+void hev_resolver_set_cache (HevDnsCache *cache, unsigned int ttl,
+                             unsigned int negative_ttl, unsigned int timeout);
+
+/**
+ * hev_resolver_set_client:
+ * @client: (nullable): a #HevDnsClient
+ *
+ * Set the native client that replaces the system resolver for names.
+ * Only call it before workers start or after they are gone.
+ *
+ * Since: 2.14
+ */
+void hev_resolver_set_client (HevDnsClient *client);
+
+#endif /* __HEV_RESOLVER_H__ */
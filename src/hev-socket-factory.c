@@ -25,14 +25,20 @@
 struct _HevSocketFactory
 {
     struct sockaddr_in6 addr;
+    int tcp_defer_accept;
     int tcp_fastopen;
     int ipv6_only;
+    int backlog;
     int fd;
+
+    int *fds;
+    int fds_num;
+    int fds_pos;
 };
 
 HevSocketFactory *
 hev_socket_factory_new (const char *addr, const char *port, int ipv6_only,
-                        int tcp_fastopen)
+                        int tcp_fastopen, int tcp_defer_accept, int backlog)
 {
     HevSocketFactory *self;
     int res;
@@ -52,8 +58,10 @@ hev_socket_factory_new (const char *addr, const char *port, int ipv6_only,
         return NULL;
     }
 
+    self->tcp_defer_accept = tcp_defer_accept;
     self->tcp_fastopen = tcp_fastopen;
     self->ipv6_only = ipv6_only;
+    self->backlog = backlog;
     self->fd = -1;
 
     return self;
@@ -66,19 +74,61 @@ hev_socket_factory_destroy (HevSocketFactory *self)
 
     if (self->fd >= 0)
         close (self->fd);
+    for (; self->fds_pos < self->fds_num; self->fds_pos++)
+        close (self->fds[self->fds_pos]);
+    if (self->fds)
+        hev_free (self->fds);
     hev_free (self);
 }
 
+int
+hev_socket_factory_adopt (HevSocketFactory *self, int *fds, int num)
+{
+    int i;
+
+    LOG_D ("socket factory adopt");
+
+    self->fds = hev_malloc (sizeof (int) * num);
+    if (!self->fds) {
+        for (i = 0; i < num; i++)
+            close (fds[i]);
+        return -1;
+    }
+
+    for (i = 0; i < num; i++) {
+        struct sockaddr_in6 addr;
+        socklen_t len = sizeof (addr);
+        int res;
+
+        /* Only listeners for the configured address are reused. */
+        res = getsockname (fds[i], (struct sockaddr *)&addr, &len);
+        if (res < 0 || addr.sin6_family != AF_INET6 ||
+            addr.sin6_port != self->addr.sin6_port ||
+            memcmp (&addr.sin6_addr, &self->addr.sin6_addr,
+                    sizeof (addr.sin6_addr))) {
+            LOG_W ("socket factory adopt mismatch");
+            close (fds[i]);
+            continue;
+        }
+
+        self->fds[self->fds_num++] = fds[i];
+    }
+
+    return self->fds_num;
+}
+
 int
 hev_socket_factory_get (HevSocketFactory *self)
 {
-    int qlen = 100;
     int one = 1;
     int res;
     int fd;
 
     LOG_D ("socket factory get");
 
+    if (self->fds_pos < self->fds_num)
+        return self->fds[self->fds_pos++];
+
     if (self->fd >= 0)
         return dup (self->fd);
 
@@ -115,12 +165,23 @@ hev_socket_factory_get (HevSocketFactory *self)
     }
 
     if (self->tcp_fastopen) {
-        res = setsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof (qlen));
+        res = setsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN, &self->tcp_fastopen,
+                          sizeof (self->tcp_fastopen));
         if (res < 0)
             LOG_W ("socket factory fastopen");
     }
 
-    res = listen (fd, 100);
+#ifdef TCP_DEFER_ACCEPT
+    if (self->tcp_defer_accept) {
+        res = setsockopt (fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                          &self->tcp_defer_accept,
+                          sizeof (self->tcp_defer_accept));
+        if (res < 0)
+            LOG_W ("socket factory defer accept");
+    }
+#endif
+
+    res = listen (fd, self->backlog);
     if (res < 0) {
         LOG_E ("socket factory listen");
         goto exit_close;
@@ -13,9 +13,11 @@
 typedef struct _HevSocketFactory HevSocketFactory;
 
 HevSocketFactory *hev_socket_factory_new (const char *addr, const char *port,
-                                          int ipv6_only, int tcp_fastopen);
+                                          int ipv6_only, int tcp_fastopen,
+                                          int tcp_defer_accept, int backlog);
 void hev_socket_factory_destroy (HevSocketFactory *self);
 
 int hev_socket_factory_get (HevSocketFactory *self);
+int hev_socket_factory_adopt (HevSocketFactory *self, int *fds, int num);
 
 #endif /* __HEV_SOCKET_FACTORY_H__ */
@@ -8,21 +8,37 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdatomic.h>
 
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#endif
+
 #include <hev-task.h>
 #include <hev-task-system.h>
 #include <hev-memory-allocator.h>
 #include <hev-socks5-authenticator.h>
 
+#include "hev-list.h"
+#include "hev-misc.h"
 #include "hev-config.h"
 #include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-handover.h"
+#include "hev-resolver.h"
+#include "hev-auth-file.h"
+#include "hev-user-acct.h"
 #include "hev-socks5-worker.h"
+#include "hev-socks5-session.h"
 #include "hev-socket-factory.h"
 #include "hev-socks5-user-mark.h"
 
@@ -38,127 +54,749 @@ enum
     SYNC_STOP = 1 << 5,
 };
 
+#define MAX_CPUS (1024)
+#define SCALE_INTERVAL (5000)
+#define SCALE_UP_LOAD (75)
+#define SCALE_DOWN_LOAD (25)
+
 typedef struct _HevSocks5WorkerData HevSocks5WorkerData;
 
 struct _HevSocks5WorkerData
 {
     HevSocks5Worker *worker;
+    HevListNode node;
     pthread_t thread;
+    int64_t cpu_time;
+    int done;
+    int cpu;
+    int fd;
     int ts;
 };
 
 static atomic_int tsync;
-static HevSocks5WorkerData *worker_list;
+static HevSocks5WorkerData **worker_list;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_int worker_num;
+static atomic_int worker_refs;
+static HevList drain_list;
+static HevSocketFactory *factory;
+static int cpus[MAX_CPUS];
+static int ncpus;
+
+static int handover_done;
+static pthread_t handover_thread;
+static HevHandover *handover;
+
+static int scale_run;
+static int scale_target;
+static int64_t scale_time;
+static pthread_t scale_thread;
+static pthread_cond_t scale_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t scale_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static HevSocks5Authenticator *auth;
+static HevAuthFile *auth_file;
+static HevSourceAcl *source_acl;
+static HevDestAcl *dest_acl;
+static HevEgressPlan *egress_plan;
+static HevDnsCache *dns_cache;
+static HevDnsClient *dns_client;
+static pthread_mutex_t auth_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t ctrl_thread;
+static int ctrl_fds[2] = { -1, -1 };
+static int ctrl_sfd = -1;
+static int ctrl_hooked;
+static int standalone;
+static struct sigaction ctrl_action;
+#if defined(__linux__)
+static sigset_t ctrl_mask;
+#endif
+
+static struct
+{
+    unsigned long reloads;
+    unsigned long last_usecs;
+    unsigned long grace_usecs;
+    unsigned long grace_max_usecs;
+} reload_stats;
+
+static int stats_run;
+static pthread_t stats_thread;
+static pthread_cond_t stats_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The worker list is read from signal handlers, so readers only pin it
+ * with a counter. Writers publish a new count and sleep on the counter
+ * until the last old reader wakes them.
+ */
+static int
+hev_socks5_proxy_workers_get (void)
+{
+    atomic_fetch_add (&worker_refs, 1);
+    return atomic_load (&worker_num);
+}
 
 static void
-hev_socks5_proxy_load_file (HevSocks5Authenticator *auth, const char *file)
+hev_socks5_proxy_workers_put (void)
 {
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    FILE *fp;
+    if (atomic_fetch_sub (&worker_refs, 1) == 1)
+        futex_wake (&worker_refs);
+}
 
-    fp = fopen (file, "r");
-    if (!fp) {
-        hev_object_unref (HEV_OBJECT (auth));
-        return;
+static void
+hev_socks5_proxy_workers_set (int num)
+{
+    int refs;
+
+    atomic_store (&worker_num, num);
+    while ((refs = atomic_load (&worker_refs)))
+        futex_wait (&worker_refs, refs);
+}
+
+static HevSocks5Authenticator *
+hev_socks5_proxy_auth_new (void)
+{
+    HevSocks5Authenticator *auth;
+    HevSocks5UserMark *user;
+    const char *name, *pass;
+
+    name = hev_config_get_auth_username ();
+    pass = hev_config_get_auth_password ();
+
+    auth = hev_socks5_authenticator_new ();
+    if (!auth)
+        return NULL;
+
+    user = hev_socks5_user_mark_new (name, strlen (name), pass, strlen (pass),
+                                     0);
+    if (user)
+        hev_socks5_authenticator_add (auth, HEV_SOCKS5_USER (user));
+
+    return auth;
+}
+
+static int
+hev_socks5_proxy_auth_init (void)
+{
+    const char *file, *name, *pass;
+
+    file = hev_config_get_auth_file ();
+    name = hev_config_get_auth_username ();
+    pass = hev_config_get_auth_password ();
+
+    if (!file && !name && !pass)
+        return 0;
+
+    if (!file) {
+        auth = hev_socks5_proxy_auth_new ();
+        return auth ? 0 : -1;
     }
 
-    while ((nread = getline (&line, &len, fp)) != -1) {
-        HevSocks5UserMark *user;
-        unsigned int nlen;
-        unsigned int plen;
-        char name[256];
-        char pass[256];
-        long mark = 0;
-        int res;
+    auth = hev_socks5_authenticator_new ();
+    if (!auth)
+        return -1;
 
-        res = sscanf (line, "%255s %255s %lx\n", name, pass, &mark);
-        if (res < 2) {
-            LOG_E ("socks5 proxy user/pass format");
-            continue;
+    auth_file = hev_auth_file_new (auth);
+    if (!auth_file)
+        return -1;
+
+    /* Start with no users rather than without authentication. */
+    if (hev_auth_file_diff (auth_file, file) < 0)
+        LOG_E ("socks5 proxy open auth file %s", file);
+    if (hev_auth_file_apply (auth_file) < 0)
+        return -1;
+
+    hev_socks5_session_set_auth_table (hev_auth_file_get_table (auth_file));
+
+    return 0;
+}
+
+static int
+hev_socks5_proxy_acl_init (void)
+{
+    const char *file;
+
+    file = hev_config_get_acl_source_file ();
+
+    /* Unlike users, a broken rule set must not open the door. */
+    if (file) {
+        source_acl = hev_source_acl_new (file);
+        if (!source_acl) {
+            LOG_E ("socks5 proxy open source acl %s", file);
+            return -1;
         }
+        hev_socks5_worker_set_source_acl (source_acl);
+    }
 
-        nlen = strlen (name);
-        plen = strlen (pass);
-        user = hev_socks5_user_mark_new (name, nlen, pass, plen, mark);
-        if (!user) {
-            LOG_E ("socks5 proxy user new");
-            continue;
+    file = hev_config_get_acl_destination_file ();
+    if (file) {
+        dest_acl = hev_dest_acl_new (file);
+        if (!dest_acl) {
+            LOG_E ("socks5 proxy open dest acl %s", file);
+            return -1;
         }
-        res = hev_socks5_authenticator_add (auth, HEV_SOCKS5_USER (user));
-        if (res < 0) {
-            LOG_E ("socks5 proxy user conflict");
-            hev_object_unref (HEV_OBJECT (user));
+        hev_socks5_session_set_dest_acl (dest_acl);
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_proxy_egress_init (void)
+{
+    egress_plan = hev_egress_plan_new ();
+    if (!egress_plan) {
+        LOG_E ("socks5 proxy egress plan");
+        return -1;
+    }
+
+    hev_socks5_session_set_egress_plan (egress_plan);
+
+    return 0;
+}
+
+static int
+hev_socks5_proxy_dns_init (void)
+{
+    unsigned int size;
+    unsigned int ttl;
+    unsigned int nttl;
+    int timeout;
+    int prefetch;
+
+    if (hev_config_get_dns_native ()) {
+        const char *conf = hev_config_get_dns_resolv_conf ();
+        const char *hosts = hev_config_get_dns_hosts_file ();
+
+        dns_client = hev_dns_client_new (conf, hosts);
+        if (!dns_client) {
+            LOG_E ("socks5 proxy dns client");
+            return -1;
         }
+        hev_resolver_set_client (dns_client);
     }
 
-    free (line);
-    fclose (fp);
+    size = hev_config_get_dns_cache_size ();
+    if (!size)
+        return 0;
+
+    prefetch = hev_config_get_dns_cache_prefetch ();
+    dns_cache = hev_dns_cache_new (size, prefetch);
+    if (!dns_cache) {
+        LOG_E ("socks5 proxy dns cache");
+        return -1;
+    }
+
+    ttl = hev_config_get_dns_cache_ttl ();
+    nttl = hev_config_get_dns_cache_negative_ttl ();
+    timeout = hev_config_get_misc_connect_timeout ();
+    hev_resolver_set_cache (dns_cache, ttl, nttl, timeout);
+
+    return 0;
+}
+
+static void
+hev_socks5_proxy_ctrl_unhook (void)
+{
+    if (ctrl_hooked) {
+        sigaction (SIGUSR1, &ctrl_action, NULL);
+        ctrl_hooked = 0;
+    }
+}
+
+static void
+hev_socks5_proxy_ctrl_close (void)
+{
+    hev_socks5_proxy_ctrl_unhook ();
+
+#if defined(__linux__)
+    if (ctrl_sfd >= 0) {
+        struct sigaction sa = { 0 };
+        struct sigaction old;
+        sigset_t set;
+
+        /* Signals still queued were meant for us, drop them on unblock. */
+        sigemptyset (&set);
+        sigaddset (&set, SIGUSR1);
+        sa.sa_handler = SIG_IGN;
+        sigemptyset (&sa.sa_mask);
+        sigaction (SIGUSR1, &sa, &old);
+        if (!sigismember (&ctrl_mask, SIGUSR1))
+            pthread_sigmask (SIG_UNBLOCK, &set, NULL);
+        sigaction (SIGUSR1, &old, NULL);
+        close (ctrl_sfd);
+        ctrl_sfd = -1;
+    }
+#endif
+
+    if (ctrl_fds[0] >= 0)
+        close (ctrl_fds[0]);
+    if (ctrl_fds[1] >= 0)
+        close (ctrl_fds[1]);
+    ctrl_fds[0] = -1;
+    ctrl_fds[1] = -1;
 }
 
 static void
 hev_socks5_proxy_load (void)
 {
-    HevSocks5Authenticator *auth;
-    const char *file, *name, *pass;
-    int workers;
-    int i;
+    HevSocks5Authenticator *next = NULL;
+    HevSourceAcl *sacl = NULL;
+    HevDestAcl *dacl = NULL;
+    unsigned long usecs;
+    unsigned long grace;
+    const char *file;
+    int64_t begin;
+    int64_t end;
 
     LOG_D ("socks5 proxy load");
 
-    file = hev_config_get_auth_file ();
-    name = hev_config_get_auth_username ();
-    pass = hev_config_get_auth_password ();
+    if (!auth && !source_acl && !dest_acl)
+        return;
 
-    if (!file && !name && !pass)
+    /* The stats thread walks the user list too. */
+    pthread_mutex_lock (&auth_mutex);
+    begin = get_monotonic_us ();
+    if (source_acl) {
+        file = hev_config_get_acl_source_file ();
+        sacl = hev_source_acl_new (file);
+        if (!sacl) {
+            LOG_E ("socks5 proxy open source acl %s", file);
+            goto exit;
+        }
+    }
+
+    if (dest_acl) {
+        file = hev_config_get_acl_destination_file ();
+        dacl = hev_dest_acl_new (file);
+        if (!dacl) {
+            LOG_E ("socks5 proxy open dest acl %s", file);
+            goto exit;
+        }
+    }
+
+    if (auth_file) {
+        file = hev_config_get_auth_file ();
+        if (hev_auth_file_diff (auth_file, file) < 0) {
+            LOG_E ("socks5 proxy open auth file %s", file);
+            goto exit;
+        }
+        if (hev_auth_file_apply (auth_file) < 0)
+            goto exit;
+    } else if (auth) {
+        next = hev_socks5_proxy_auth_new ();
+        if (!next) {
+            LOG_E ("socks5 proxy auth");
+            goto exit;
+        }
+    }
+
+    /*
+     * Workers keep serving while the new state is published. What it
+     * replaces is only freed once every worker has been through its event
+     * task, so no session is in the middle of a lookup any longer.
+     */
+    if (auth_file)
+        hev_socks5_session_set_auth_table (hev_auth_file_get_table (auth_file));
+    if (next) {
+        int workers;
+        int i;
+
+        workers = hev_socks5_proxy_workers_get ();
+        for (i = 0; i < workers; i++) {
+            hev_socks5_worker_set_auth (worker_list[i]->worker, next);
+            hev_socks5_worker_reload (worker_list[i]->worker);
+        }
+        hev_socks5_proxy_workers_put ();
+
+        hev_object_unref (HEV_OBJECT (auth));
+        auth = next;
+    }
+    if (sacl) {
+        source_acl = sacl;
+        sacl = hev_socks5_worker_set_source_acl (sacl);
+    }
+    if (dacl) {
+        dest_acl = dacl;
+        dacl = hev_socks5_session_set_dest_acl (dacl);
+    }
+
+    grace = get_monotonic_us ();
+    hev_socks5_worker_synchronize ();
+    end = get_monotonic_us ();
+    if (auth_file)
+        hev_auth_file_release (auth_file);
+    pthread_mutex_unlock (&auth_mutex);
+
+    if (sacl)
+        hev_source_acl_destroy (sacl);
+    if (dacl)
+        hev_dest_acl_destroy (dacl);
+
+    grace = end - grace;
+    usecs = end - begin;
+    WRITE_ONCE (reload_stats.reloads, reload_stats.reloads + 1);
+    WRITE_ONCE (reload_stats.last_usecs, usecs);
+    WRITE_ONCE (reload_stats.grace_usecs, grace);
+    if (grace > reload_stats.grace_max_usecs)
+        WRITE_ONCE (reload_stats.grace_max_usecs, grace);
+
+    LOG_I ("socks5 proxy reloaded in %lu us, grace period %lu us", usecs,
+           grace);
+    return;
+
+exit:
+    pthread_mutex_unlock (&auth_mutex);
+    if (sacl)
+        hev_source_acl_destroy (sacl);
+    if (dacl)
+        hev_dest_acl_destroy (dacl);
+}
+
+static void
+sigint_handler (int signum)
+{
+    char val = 0;
+    ssize_t res;
+
+    /* Reloads block on workers, so only wake the control thread here. */
+    res = write (ctrl_fds[1], &val, sizeof (val));
+    (void)res;
+}
+
+static int
+hev_socks5_proxy_ctrl_signal (void)
+{
+#if defined(__linux__)
+    struct signalfd_siginfo info;
+    ssize_t res;
+
+    if (ctrl_sfd < 0)
+        return 0;
+
+    /* Every queued SIGUSR1 is folded into one reload. */
+    do {
+        res = read (ctrl_sfd, &info, sizeof (info));
+    } while (res == sizeof (info));
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void *
+ctrl_thread_handler (void *data)
+{
+    struct pollfd pfds[2];
+    sigset_t set;
+
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    pfds[0].fd = ctrl_fds[0];
+    pfds[0].events = POLLIN;
+    pfds[1].fd = ctrl_sfd;
+    pfds[1].events = POLLIN;
+
+    for (;;) {
+        char val[64];
+        ssize_t res;
+
+        res = poll (pfds, (ctrl_sfd < 0) ? 1 : 2, -1);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            break;
+
+        if (pfds[1].revents & POLLIN && hev_socks5_proxy_ctrl_signal ())
+            hev_socks5_proxy_load ();
+
+        if (!pfds[0].revents)
+            continue;
+
+        res = read (ctrl_fds[0], val, sizeof (val));
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            break;
+
+        hev_socks5_proxy_load ();
+    }
+
+    return NULL;
+}
+
+/*
+ * SIGUSR1 is taken off the workers: the handler only writes to a pipe,
+ * and the control thread does the reload. The standalone server on Linux
+ * owns the process, so there it stays blocked in every thread and is read
+ * from a signalfd. Both are undone on stop, for library callers.
+ */
+static void
+hev_socks5_proxy_ctrl_start (void)
+{
+    int res;
+
+    if (!auth && !source_acl && !dest_acl)
         return;
 
-    auth = hev_socks5_authenticator_new ();
-    if (!auth)
+    if (pipe (ctrl_fds) < 0) {
+        LOG_E ("socks5 proxy control pipe");
+        goto exit;
+    }
+
+    fcntl (ctrl_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (ctrl_fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl (ctrl_fds[1], F_SETFL, O_NONBLOCK);
+
+#if defined(__linux__)
+    if (standalone) {
+        sigset_t set;
+
+        sigemptyset (&set);
+        sigaddset (&set, SIGUSR1);
+        pthread_sigmask (SIG_BLOCK, &set, &ctrl_mask);
+
+        ctrl_sfd = signalfd (-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (ctrl_sfd < 0) {
+            LOG_W ("socks5 proxy control signalfd");
+            pthread_sigmask (SIG_SETMASK, &ctrl_mask, NULL);
+        }
+    }
+#endif
+
+    res = pthread_create (&ctrl_thread, NULL, ctrl_thread_handler, NULL);
+    if (res != 0) {
+        LOG_E ("socks5 proxy control thread");
+        goto exit;
+    }
+
+    if (ctrl_sfd < 0) {
+        struct sigaction sa = { 0 };
+
+        sa.sa_handler = sigint_handler;
+        sigemptyset (&sa.sa_mask);
+        sigaction (SIGUSR1, &sa, &ctrl_action);
+        ctrl_hooked = 1;
+    }
+    return;
+
+exit:
+    hev_socks5_proxy_ctrl_close ();
+}
+
+static void
+hev_socks5_proxy_ctrl_stop (void)
+{
+    if (ctrl_fds[1] < 0)
         return;
 
-    if (file) {
-        hev_socks5_proxy_load_file (auth, file);
-    } else {
-        HevSocks5UserMark *user;
+    hev_socks5_proxy_ctrl_unhook ();
+    close (ctrl_fds[1]);
+    ctrl_fds[1] = -1;
+    pthread_join (ctrl_thread, NULL);
+    hev_socks5_proxy_ctrl_close ();
+}
+
+static void
+hev_socks5_proxy_write_stats (FILE *fp, const char *prefix,
+                              HevSocks5WorkerStats *stats)
+{
+    char key[64];
+
+    fprintf (fp, "%s.task-pool-hits %lu\n", prefix, stats->task_pool_hits);
+    fprintf (fp, "%s.task-pool-misses %lu\n", prefix, stats->task_pool_misses);
+    fprintf (fp, "%s.task-pool-trims %lu\n", prefix, stats->task_pool_trims);
+    fprintf (fp, "%s.session-pool-hits %lu\n", prefix,
+             stats->session_pool_hits);
+    fprintf (fp, "%s.session-pool-misses %lu\n", prefix,
+             stats->session_pool_misses);
+    fprintf (fp, "%s.session-pool-trims %lu\n", prefix,
+             stats->session_pool_trims);
+    fprintf (fp, "%s.accept-pauses %lu\n", prefix, stats->accept_pauses);
+    fprintf (fp, "%s.session-rejects %lu\n", prefix, stats->session_rejects);
+    fprintf (fp, "%s.accept-errors %lu\n", prefix, stats->accept_errors);
+    fprintf (fp, "%s.accept-drops %lu\n", prefix, stats->accept_drops);
+    fprintf (fp, "%s.session-timeouts %lu\n", prefix,
+             stats->session_timeouts);
+    fprintf (fp, "%s.acl-drops %lu\n", prefix, stats->acl_drops);
+    fprintf (fp, "%s.acl-denies %lu\n", prefix, stats->acl_denies);
+
+    snprintf (key, sizeof (key), "%s.connect-setup-usecs", prefix);
+    hev_histogram_write (&stats->connect_setup, fp, key);
+    snprintf (key, sizeof (key), "%s.connect-bind-usecs", prefix);
+    hev_histogram_write (&stats->connect_bind, fp, key);
+}
 
-        user = hev_socks5_user_mark_new (name, strlen (name), pass,
-                                         strlen (pass), 0);
-        if (user)
-            hev_socks5_authenticator_add (auth, HEV_SOCKS5_USER (user));
+static void
+hev_socks5_proxy_dump_stats (const char *file)
+{
+    HevSocks5WorkerStats total = { 0 };
+    char path[1024 + 8];
+    int workers;
+    FILE *fp;
+    int i;
+
+    snprintf (path, sizeof (path), "%s.tmp", file);
+    fp = fopen (path, "w");
+    if (!fp) {
+        LOG_E ("socks5 proxy open stats file %s", path);
+        return;
     }
 
-    workers = hev_config_get_workers ();
+    workers = hev_socks5_proxy_workers_get ();
     for (i = 0; i < workers; i++) {
-        HevSocks5Worker *worker = worker_list[i].worker;
-        hev_socks5_worker_set_auth (worker, auth);
-        hev_socks5_worker_reload (worker);
+        HevSocks5WorkerStats stats;
+        char prefix[32];
+
+        hev_socks5_worker_get_stats (worker_list[i]->worker, &stats);
+        snprintf (prefix, sizeof (prefix), "worker.%d", i);
+        hev_socks5_proxy_write_stats (fp, prefix, &stats);
+
+        total.task_pool_hits += stats.task_pool_hits;
+        total.task_pool_misses += stats.task_pool_misses;
+        total.task_pool_trims += stats.task_pool_trims;
+        total.session_pool_hits += stats.session_pool_hits;
+        total.session_pool_misses += stats.session_pool_misses;
+        total.session_pool_trims += stats.session_pool_trims;
+        total.accept_pauses += stats.accept_pauses;
+        total.session_rejects += stats.session_rejects;
+        total.accept_errors += stats.accept_errors;
+        total.accept_drops += stats.accept_drops;
+        total.session_timeouts += stats.session_timeouts;
+        total.acl_drops += stats.acl_drops;
+        total.acl_denies += stats.acl_denies;
+        hev_histogram_read (&stats.connect_setup, &total.connect_setup);
+        hev_histogram_read (&stats.connect_bind, &total.connect_bind);
+    }
+    hev_socks5_proxy_workers_put ();
+
+    hev_socks5_proxy_write_stats (fp, "total", &total);
+
+    fprintf (fp, "reload.count %lu\n", READ_ONCE (reload_stats.reloads));
+    fprintf (fp, "reload.last-usecs %lu\n",
+             READ_ONCE (reload_stats.last_usecs));
+    fprintf (fp, "reload.grace-usecs %lu\n",
+             READ_ONCE (reload_stats.grace_usecs));
+    fprintf (fp, "reload.grace-max-usecs %lu\n",
+             READ_ONCE (reload_stats.grace_max_usecs));
+
+    if (dns_cache) {
+        HevDnsCacheStats dns;
+
+        hev_dns_cache_get_stats (dns_cache, &dns);
+        fprintf (fp, "dns-cache.hits %lu\n", dns.hits);
+        fprintf (fp, "dns-cache.negative-hits %lu\n", dns.negative_hits);
+        fprintf (fp, "dns-cache.misses %lu\n", dns.misses);
+        fprintf (fp, "dns-cache.coalesced %lu\n", dns.coalesced);
+        fprintf (fp, "dns-cache.prefetches %lu\n", dns.prefetches);
     }
 
-    hev_object_unref (HEV_OBJECT (auth));
+    if (auth_file) {
+        pthread_mutex_lock (&auth_mutex);
+        hev_user_acct_dump (fp, auth_file);
+        pthread_mutex_unlock (&auth_mutex);
+    }
+    fclose (fp);
+
+    if (rename (path, file) < 0)
+        LOG_E ("socks5 proxy rename stats file %s", file);
+}
+
+static void *
+stats_thread_handler (void *data)
+{
+    const char *file = data;
+    int interval;
+
+    interval = hev_config_get_misc_stats_interval ();
+
+    pthread_mutex_lock (&stats_mutex);
+    while (stats_run) {
+        struct timespec ts;
+
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_sec += interval / 1000;
+        ts.tv_nsec += (interval % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait (&stats_cond, &stats_mutex, &ts);
+        pthread_mutex_unlock (&stats_mutex);
+        hev_socks5_proxy_dump_stats (file);
+        pthread_mutex_lock (&stats_mutex);
+    }
+    pthread_mutex_unlock (&stats_mutex);
+
+    return NULL;
 }
 
 static void
-sigint_handler (int signum)
+hev_socks5_proxy_stats_start (void)
+{
+    const char *file;
+    int res;
+
+    file = hev_config_get_misc_stats_file ();
+    if (!file)
+        return;
+
+    stats_run = 1;
+    res = pthread_create (&stats_thread, NULL, stats_thread_handler,
+                          (void *)file);
+    if (res != 0) {
+        LOG_E ("socks5 proxy stats thread");
+        stats_run = 0;
+    }
+}
+
+static void
+hev_socks5_proxy_stats_stop (void)
+{
+    pthread_mutex_lock (&stats_mutex);
+    if (!stats_run) {
+        pthread_mutex_unlock (&stats_mutex);
+        return;
+    }
+    stats_run = 0;
+    pthread_cond_signal (&stats_cond);
+    pthread_mutex_unlock (&stats_mutex);
+
+    pthread_join (stats_thread, NULL);
+}
+
+static void
+hev_socks5_proxy_release (int flags)
 {
-    hev_socks5_proxy_load ();
+    pthread_mutex_lock (&start_mutex);
+    atomic_fetch_or (&tsync, flags);
+    pthread_cond_broadcast (&start_cond);
+    pthread_mutex_unlock (&start_mutex);
 }
 
 static void *
 work_thread_handler (void *data)
 {
-    HevSocks5Worker *worker = data;
+    HevSocks5WorkerData *wd = data;
     int res;
 
-retry:
-    res = atomic_load (&tsync);
-    if (res & SYNC_ABRT) {
-        goto exit;
-    } else if (!(res & SYNC_CONT)) {
-        usleep (500);
-        goto retry;
+    pthread_mutex_lock (&start_mutex);
+    for (;;) {
+        res = atomic_load (&tsync);
+        if (res & (SYNC_CONT | SYNC_ABRT))
+            break;
+        pthread_cond_wait (&start_cond, &start_mutex);
     }
+    pthread_mutex_unlock (&start_mutex);
+
+    if (res & SYNC_ABRT)
+        goto exit;
 
     res = hev_task_system_init ();
     if (res < 0) {
@@ -166,24 +804,464 @@ retry:
         goto exit;
     }
 
-    hev_socks5_worker_start (worker);
+    if (wd->cpu >= 0 && set_thread_cpu_affinity (wd->cpu) < 0)
+        LOG_W ("socks5 proxy worker cpu affinity %d", wd->cpu);
+
+    hev_socks5_worker_start (wd->worker);
 
     hev_task_system_run ();
 
+    hev_socks5_worker_exit (wd->worker);
     hev_task_system_fini ();
 exit:
+    WRITE_ONCE (wd->done, 1);
     return NULL;
 }
 
+static void
+hev_socks5_proxy_steer (int workers)
+{
+    HevSocks5WorkerData *wd = worker_list[0];
+    int res;
+
+    if (!hev_config_get_listen_cpu_steering () || !ncpus || workers < 2)
+        return;
+
+    /* The program is shared by the whole reuseport group. */
+    res = set_sock_reuseport_steering (wd->fd, cpus, ncpus, workers);
+    if (res < 0)
+        LOG_W ("socks5 proxy reuseport cpu steering");
+}
+
+static HevSocks5WorkerData *
+hev_socks5_proxy_worker_new (int index)
+{
+    HevSocks5WorkerData *wd;
+    int cpu;
+    int fd;
+
+    wd = hev_malloc0 (sizeof (HevSocks5WorkerData));
+    if (!wd) {
+        LOG_E ("socks5 proxy worker data %d", index);
+        return NULL;
+    }
+
+    fd = hev_socket_factory_get (factory);
+    if (fd < 0) {
+        LOG_E ("socks5 proxy socket factory get");
+        hev_free (wd);
+        return NULL;
+    }
+
+    cpu = ncpus ? cpus[index % ncpus] : index;
+    wd->cpu = (hev_config_get_cpu_affinity () && ncpus) ? cpu : -1;
+    wd->cpu_time = -1;
+    wd->fd = fd;
+
+    if (hev_config_get_listen_incoming_cpu () &&
+        set_sock_incoming_cpu (fd, cpu) < 0)
+        LOG_W ("socks5 proxy worker %d incoming cpu", index);
+
+    wd->worker = hev_socks5_worker_new (fd);
+    if (!wd->worker) {
+        LOG_E ("socks5 proxy worker %d", index);
+        close (fd);
+        hev_free (wd);
+        return NULL;
+    }
+
+    if (auth)
+        hev_socks5_worker_set_auth (wd->worker, auth);
+
+    return wd;
+}
+
+static int
+hev_socks5_proxy_worker_start (HevSocks5WorkerData *wd)
+{
+    int res;
+
+    res = pthread_create (&wd->thread, NULL, work_thread_handler, wd);
+    if (res != 0)
+        return -1;
+
+    wd->ts = 1;
+    return 0;
+}
+
+static void
+hev_socks5_proxy_worker_destroy (HevSocks5WorkerData *wd)
+{
+    if (wd->ts)
+        pthread_join (wd->thread, NULL);
+    if (wd->worker)
+        hev_socks5_worker_destroy (wd->worker);
+    hev_free (wd);
+}
+
+static void
+hev_socks5_proxy_scale_up (void)
+{
+    HevSocks5WorkerData *wd;
+    int num;
+
+    /* A reload must either see the worker or be seen by it. */
+    pthread_mutex_lock (&auth_mutex);
+    num = atomic_load (&worker_num);
+    wd = hev_socks5_proxy_worker_new (num);
+    if (!wd)
+        goto exit;
+
+    if (hev_socks5_proxy_worker_start (wd) < 0) {
+        LOG_E ("socks5 proxy worker %d thread", num);
+        hev_socks5_proxy_worker_destroy (wd);
+        goto exit;
+    }
+
+    worker_list[num] = wd;
+    hev_socks5_proxy_workers_set (num + 1);
+    pthread_mutex_unlock (&auth_mutex);
+    hev_socks5_proxy_steer (num + 1);
+
+    LOG_I ("socks5 proxy worker %d added", num);
+    return;
+
+exit:
+    pthread_mutex_unlock (&auth_mutex);
+}
+
+static void
+hev_socks5_proxy_scale_down (void)
+{
+    HevSocks5WorkerData *wd;
+    int num;
+
+    num = atomic_load (&worker_num) - 1;
+    wd = worker_list[num];
+    hev_socks5_proxy_workers_set (num);
+    worker_list[num] = NULL;
+
+    /*
+     * Steer away from the last socket before it leaves the group, the
+     * kernel moves the last socket into a closed slot, so the remaining
+     * indexes stay in place.
+     */
+    hev_socks5_proxy_steer (num);
+    hev_socks5_worker_drain (wd->worker);
+    hev_list_add_tail (&drain_list, &wd->node);
+
+    LOG_I ("socks5 proxy worker %d draining", num);
+}
+
+static void
+hev_socks5_proxy_reap (int wait)
+{
+    HevListNode *node = hev_list_first (&drain_list);
+
+    while (node) {
+        HevSocks5WorkerData *wd;
+
+        wd = container_of (node, HevSocks5WorkerData, node);
+        node = hev_list_node_next (node);
+
+        if (wait && !READ_ONCE (handover_done))
+            hev_socks5_worker_stop (wd->worker);
+        else if (!wait && !READ_ONCE (wd->done))
+            continue;
+
+        hev_list_del (&drain_list, &wd->node);
+        hev_socks5_proxy_worker_destroy (wd);
+    }
+}
+
+static int
+hev_socks5_proxy_load_average (void)
+{
+    int64_t cpu_sum = 0;
+    int64_t now;
+    int workers;
+    int valid = 0;
+    int i;
+
+    now = get_monotonic_ms ();
+    workers = atomic_load (&worker_num);
+    for (i = 0; i < workers; i++) {
+        HevSocks5WorkerData *wd = worker_list[i];
+        int64_t time;
+
+        time = get_thread_cpu_time (wd->thread);
+        if (time < 0)
+            continue;
+
+        if (wd->cpu_time >= 0 && scale_time) {
+            cpu_sum += time - wd->cpu_time;
+            valid++;
+        }
+        wd->cpu_time = time;
+    }
+
+    if (!valid || now <= scale_time) {
+        scale_time = now;
+        return -1;
+    }
+
+    /* Average busy percentage of one worker thread since last sample. */
+    cpu_sum /= 1000000 * valid;
+    cpu_sum = cpu_sum * 100 / (now - scale_time);
+    scale_time = now;
+
+    return cpu_sum;
+}
+
+static void
+hev_socks5_proxy_scale (int target)
+{
+    int workers;
+    int load;
+
+    workers = atomic_load (&worker_num);
+
+    if (READ_ONCE (handover_done))
+        return;
+
+    if (target) {
+        while (workers < target) {
+            hev_socks5_proxy_scale_up ();
+            if (workers == atomic_load (&worker_num))
+                break;
+            workers++;
+        }
+        for (; workers > target; workers--)
+            hev_socks5_proxy_scale_down ();
+        scale_time = 0;
+        return;
+    }
+
+    if (!hev_config_get_auto_scale ())
+        return;
+
+    load = hev_socks5_proxy_load_average ();
+    if (load < 0)
+        return;
+
+    if (load > SCALE_UP_LOAD && workers < hev_config_get_max_workers ())
+        hev_socks5_proxy_scale_up ();
+    else if (load < SCALE_DOWN_LOAD && workers > hev_config_get_workers ())
+        hev_socks5_proxy_scale_down ();
+    else
+        return;
+
+    scale_time = 0;
+}
+
+static void *
+scale_thread_handler (void *data)
+{
+    sigset_t set;
+
+    /* Readers in signal handlers must never run on the writer thread. */
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock (&scale_mutex);
+    while (scale_run) {
+        struct timespec ts;
+        int target;
+
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_sec += SCALE_INTERVAL / 1000;
+        pthread_cond_timedwait (&scale_cond, &scale_mutex, &ts);
+        if (!scale_run)
+            break;
+
+        target = scale_target;
+        scale_target = 0;
+        pthread_mutex_unlock (&scale_mutex);
+        hev_socks5_proxy_reap (0);
+        hev_socks5_proxy_scale (target);
+        pthread_mutex_lock (&scale_mutex);
+    }
+    pthread_mutex_unlock (&scale_mutex);
+
+    hev_socks5_proxy_reap (1);
+
+    return NULL;
+}
+
+static void *
+handover_thread_handler (void *data)
+{
+    sigset_t set;
+
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+        int fds[HEV_HANDOVER_MAX_FDS];
+        int workers;
+        int res;
+        int fd;
+        int n;
+        int i;
+
+        fd = hev_handover_accept (handover);
+        if (fd < 0)
+            break;
+
+        /*
+         * The send blocks on the peer, so it runs on dups rather than
+         * with the worker list pinned.
+         */
+        workers = hev_socks5_proxy_workers_get ();
+        for (n = 0; n < workers && n < HEV_HANDOVER_MAX_FDS; n++) {
+            fds[n] = dup (worker_list[n]->fd);
+            if (fds[n] < 0)
+                break;
+        }
+        hev_socks5_proxy_workers_put ();
+
+        res = -1;
+        if (n == workers || n == HEV_HANDOVER_MAX_FDS)
+            res = hev_handover_send (fd, fds, n);
+        for (i = 0; i < n; i++)
+            close (fds[i]);
+
+        if (res == 0) {
+            /* The listeners live on in the new process, serve the rest. */
+            LOG_I ("socks5 proxy handed over, draining");
+            WRITE_ONCE (handover_done, 1);
+            workers = hev_socks5_proxy_workers_get ();
+            for (i = 0; i < workers; i++)
+                hev_socks5_worker_drain (worker_list[i]->worker);
+            hev_socks5_proxy_workers_put ();
+        }
+        close (fd);
+
+        if (res == 0)
+            break;
+
+        LOG_W ("socks5 proxy handover aborted");
+    }
+
+    return NULL;
+}
+
+static int
+hev_socks5_proxy_handover_recv (int *conn)
+{
+    int fds[HEV_HANDOVER_MAX_FDS];
+    const char *path;
+    int num;
+    int fd;
+
+    path = hev_config_get_misc_handover_socket ();
+    if (!path)
+        return 0;
+
+    fd = hev_handover_connect (path);
+    if (fd < 0)
+        return 0;
+
+    num = hev_handover_recv (fd, fds, HEV_HANDOVER_MAX_FDS);
+    if (num <= 0) {
+        LOG_W ("socks5 proxy handover receive");
+        close (fd);
+        return 0;
+    }
+
+    num = hev_socket_factory_adopt (factory, fds, num);
+    if (num <= 0) {
+        close (fd);
+        return 0;
+    }
+
+    LOG_I ("socks5 proxy adopted %d listeners", num);
+    *conn = fd;
+
+    return num;
+}
+
+static void
+hev_socks5_proxy_handover_start (int conn)
+{
+    const char *path;
+    int res;
+
+    /* Let the previous process drain before the path is taken over. */
+    if (conn >= 0) {
+        if (hev_handover_ack (conn) < 0)
+            LOG_W ("socks5 proxy handover ack");
+        close (conn);
+    }
+
+    path = hev_config_get_misc_handover_socket ();
+    if (!path)
+        return;
+
+    handover = hev_handover_new (path, conn >= 0);
+    if (!handover)
+        return;
+
+    res = pthread_create (&handover_thread, NULL, handover_thread_handler,
+                          NULL);
+    if (res != 0) {
+        LOG_E ("socks5 proxy handover thread");
+        hev_handover_destroy (handover);
+        handover = NULL;
+    }
+}
+
+static void
+hev_socks5_proxy_handover_stop (void)
+{
+    if (!handover)
+        return;
+
+    hev_handover_shutdown (handover);
+    pthread_join (handover_thread, NULL);
+    hev_handover_destroy (handover);
+    handover = NULL;
+}
+
+static void
+hev_socks5_proxy_scale_start (void)
+{
+    int res;
+
+    scale_run = 1;
+    res = pthread_create (&scale_thread, NULL, scale_thread_handler, NULL);
+    if (res != 0) {
+        LOG_E ("socks5 proxy scale thread");
+        scale_run = 0;
+    }
+}
+
+static void
+hev_socks5_proxy_scale_stop (void)
+{
+    pthread_mutex_lock (&scale_mutex);
+    if (!scale_run) {
+        pthread_mutex_unlock (&scale_mutex);
+        return;
+    }
+    scale_run = 0;
+    pthread_cond_signal (&scale_cond);
+    pthread_mutex_unlock (&scale_mutex);
+
+    pthread_join (scale_thread, NULL);
+}
+
 int
 hev_socks5_proxy_init (void)
 {
-    HevSocketFactory *factory;
     const char *listen_addr;
     const char *listen_port;
+    int tcp_defer_accept;
     int tcp_fastopen;
     int ipv6_only;
+    int backlog;
     int workers;
+    int conn = -1;
     int res;
     int i;
 
@@ -192,7 +1270,22 @@ hev_socks5_proxy_init (void)
     listen_addr = hev_config_get_listen_address ();
     listen_port = hev_config_get_listen_port ();
     ipv6_only = hev_config_get_listen_ipv6_only ();
-    tcp_fastopen = hev_config_get_tcp_fastopen ();
+    tcp_fastopen = 0;
+    if (hev_config_get_tcp_fastopen ())
+        tcp_fastopen = hev_config_get_tcp_fastopen_qlen ();
+    tcp_defer_accept = hev_config_get_tcp_defer_accept ();
+    backlog = hev_config_get_listen_backlog ();
+
+    ncpus = 0;
+    if (hev_config_get_listen_incoming_cpu () ||
+        hev_config_get_listen_cpu_steering () ||
+        hev_config_get_cpu_affinity ()) {
+        ncpus = get_allowed_cpus (cpus, MAX_CPUS);
+        if (ncpus <= 0) {
+            LOG_W ("socks5 proxy allowed cpus");
+            ncpus = 0;
+        }
+    }
 
     res = hev_task_system_init ();
     if (res < 0) {
@@ -201,14 +1294,35 @@ hev_socks5_proxy_init (void)
     }
 
     factory = hev_socket_factory_new (listen_addr, listen_port, ipv6_only,
-                                      tcp_fastopen);
+                                      tcp_fastopen, tcp_defer_accept, backlog);
     if (!factory) {
         LOG_E ("socks5 proxy socket factory");
         goto exit;
     }
 
-    workers = hev_config_get_workers ();
-    worker_list = hev_malloc0 (sizeof (HevSocks5WorkerData) * workers);
+    res = hev_socks5_proxy_auth_init ();
+    if (res < 0) {
+        LOG_E ("socks5 proxy auth");
+        goto exit;
+    }
+
+    res = hev_socks5_proxy_acl_init ();
+    if (res < 0)
+        goto exit;
+
+    res = hev_socks5_proxy_egress_init ();
+    if (res < 0)
+        goto exit;
+
+    res = hev_socks5_proxy_dns_init ();
+    if (res < 0)
+        goto exit;
+
+    /* Before any worker thread, which inherit the signal mask. */
+    hev_socks5_proxy_ctrl_start ();
+
+    workers = hev_config_get_max_workers ();
+    worker_list = hev_malloc0 (sizeof (HevSocks5WorkerData *) * workers);
     if (!worker_list) {
         LOG_E ("socks5 proxy worker list");
         goto exit;
@@ -216,51 +1330,49 @@ hev_socks5_proxy_init (void)
 
     atomic_fetch_and (&tsync, ~(SYNC_CONT | SYNC_ABRT));
 
-    for (i = 0; i < workers; i++) {
-        HevSocks5Worker *worker;
-        int fd;
+    /* Keep every adopted listener so queued connections are served. */
+    workers = hev_socks5_proxy_handover_recv (&conn);
+    if (workers < hev_config_get_workers ())
+        workers = hev_config_get_workers ();
+    if (workers > hev_config_get_max_workers ())
+        workers = hev_config_get_max_workers ();
 
-        fd = hev_socket_factory_get (factory);
-        if (fd < 0) {
-            LOG_E ("socks5 proxy socket factory get");
-            goto exit;
-        }
+    for (i = 0; i < workers; i++) {
+        HevSocks5WorkerData *wd;
 
-        worker = hev_socks5_worker_new (fd);
-        if (!worker) {
-            LOG_E ("socks5 proxy worker %d", i);
-            close (fd);
+        wd = hev_socks5_proxy_worker_new (i);
+        if (!wd)
             goto exit;
-        }
-        worker_list[i].worker = worker;
+        worker_list[i] = wd;
+        atomic_store (&worker_num, i + 1);
 
-        /* Skip worker 0 */
-        if (i == 0)
+        /* Skip worker 0, it runs on this thread */
+        if (i == 0) {
+            wd->thread = pthread_self ();
             continue;
+        }
 
-        res = pthread_create (&worker_list[i].thread, NULL, work_thread_handler,
-                              worker);
-        if (res != 0) {
+        res = hev_socks5_proxy_worker_start (wd);
+        if (res < 0) {
             LOG_E ("socks5 proxy worker %d thread", i);
             goto exit;
         }
-        worker_list[i].ts = 1;
     }
 
-    hev_socket_factory_destroy (factory);
-    factory = NULL;
+    hev_socks5_proxy_steer (workers);
 
-    hev_socks5_proxy_load ();
+    hev_socks5_proxy_stats_start ();
+    hev_socks5_proxy_scale_start ();
     signal (SIGPIPE, SIG_IGN);
-    signal (SIGUSR1, sigint_handler);
+    hev_socks5_proxy_handover_start (conn);
     atomic_fetch_or (&tsync, SYNC_SEND);
 
     return 0;
 
 exit:
-    atomic_fetch_or (&tsync, SYNC_ABRT);
-    if (factory)
-        hev_socket_factory_destroy (factory);
+    if (conn >= 0)
+        close (conn);
+    hev_socks5_proxy_release (SYNC_ABRT);
     hev_socks5_proxy_fini ();
     return -1;
 }
@@ -272,44 +1384,112 @@ hev_socks5_proxy_fini (void)
 
     LOG_D ("socks5 proxy fini");
 
-retry:
-    res = atomic_fetch_and (&tsync, ~(SYNC_SEND | SYNC_STOP | SYNC_SENT));
-    if (res & SYNC_WAIT) {
-        usleep (500);
-        goto retry;
+    /* Wait out a stop running in a signal handler on another thread. */
+    for (;;) {
+        res = atomic_fetch_and (&tsync, ~(SYNC_SEND | SYNC_STOP | SYNC_SENT));
+        if (!(res & SYNC_WAIT))
+            break;
+        futex_wait (&tsync, res & ~(SYNC_SEND | SYNC_STOP | SYNC_SENT));
     }
 
+    /* Threads still parked before run must not wait forever. */
+    hev_socks5_proxy_release (SYNC_ABRT);
+
+    hev_socks5_proxy_handover_stop ();
+    hev_socks5_proxy_ctrl_stop ();
+    hev_socks5_proxy_stats_stop ();
+    hev_socks5_proxy_scale_stop ();
+
     if (worker_list) {
-        int workers = hev_config_get_workers ();
+        int workers = atomic_load (&worker_num);
         int i;
 
-        for (i = 0; i < workers; i++) {
-            if (worker_list[i].ts)
-                pthread_join (worker_list[i].thread, NULL);
-            if (worker_list[i].worker)
-                hev_socks5_worker_destroy (worker_list[i].worker);
-        }
+        hev_socks5_proxy_workers_set (0);
+
+        /*
+         * Workers added after the stop fan-out have not seen it. After a
+         * handover they are draining and exit on their own.
+         */
+        for (i = 0; i < workers && !READ_ONCE (handover_done); i++)
+            hev_socks5_worker_stop (worker_list[i]->worker);
+
+        for (i = 0; i < workers; i++)
+            hev_socks5_proxy_worker_destroy (worker_list[i]);
 
         hev_free (worker_list);
         worker_list = NULL;
     }
 
+    if (auth_file) {
+        hev_socks5_session_set_auth_table (NULL);
+        hev_auth_file_destroy (auth_file);
+        auth_file = NULL;
+    }
+
+    if (source_acl) {
+        hev_socks5_worker_set_source_acl (NULL);
+        hev_source_acl_destroy (source_acl);
+        source_acl = NULL;
+    }
+
+    if (dest_acl) {
+        hev_socks5_session_set_dest_acl (NULL);
+        hev_dest_acl_destroy (dest_acl);
+        dest_acl = NULL;
+    }
+
+    if (egress_plan) {
+        hev_socks5_session_set_egress_plan (NULL);
+        hev_egress_plan_destroy (egress_plan);
+        egress_plan = NULL;
+    }
+
+    if (dns_cache) {
+        hev_resolver_set_cache (NULL, 0, 0, 0);
+        hev_dns_cache_destroy (dns_cache);
+        dns_cache = NULL;
+    }
+
+    if (dns_client) {
+        hev_resolver_set_client (NULL);
+        hev_dns_client_destroy (dns_client);
+        dns_client = NULL;
+    }
+
+    if (auth) {
+        hev_object_unref (HEV_OBJECT (auth));
+        auth = NULL;
+    }
+
+    if (factory) {
+        hev_socket_factory_destroy (factory);
+        factory = NULL;
+    }
+
     hev_task_system_fini ();
 }
 
 void
 hev_socks5_proxy_run (void)
 {
+    int cpu;
+
     LOG_D ("socks5 proxy run");
 
     if (atomic_fetch_and (&tsync, ~SYNC_STOP) & SYNC_STOP)
         return;
 
-    atomic_fetch_or (&tsync, SYNC_CONT);
+    hev_socks5_proxy_release (SYNC_CONT);
+
+    cpu = worker_list[0]->cpu;
+    if (cpu >= 0 && set_thread_cpu_affinity (cpu) < 0)
+        LOG_W ("socks5 proxy worker cpu affinity %d", cpu);
 
-    hev_socks5_worker_start (worker_list[0].worker);
+    hev_socks5_worker_start (worker_list[0]->worker);
 
     hev_task_system_run ();
+
+    hev_socks5_worker_exit (worker_list[0]->worker);
 }
 
 void
@@ -319,11 +1499,11 @@ hev_socks5_proxy_stop (void)
 
     LOG_D ("socks5 proxy stop");
 
-retry:
-    res = atomic_fetch_or (&tsync, SYNC_WAIT);
-    if (res & SYNC_WAIT) {
-        usleep (500);
-        goto retry;
+    for (;;) {
+        res = atomic_fetch_or (&tsync, SYNC_WAIT);
+        if (!(res & SYNC_WAIT))
+            break;
+        futex_wait (&tsync, res);
     }
 
     if (res & SYNC_SEND) {
@@ -331,13 +1511,37 @@ retry:
         if (!(res & SYNC_SENT)) {
             int workers;
             int i;
-            workers = hev_config_get_workers ();
+            workers = hev_socks5_proxy_workers_get ();
             for (i = 0; i < workers; i++)
-                hev_socks5_worker_stop (worker_list[i].worker);
+                hev_socks5_worker_stop (worker_list[i]->worker);
+            hev_socks5_proxy_workers_put ();
         }
     } else {
         atomic_fetch_or (&tsync, SYNC_STOP | SYNC_ABRT);
     }
 
     atomic_fetch_and (&tsync, ~SYNC_WAIT);
+    futex_wake (&tsync);
+}
+
+void
+hev_socks5_proxy_set_standalone (int value)
+{
+    standalone = value;
+}
+
+void
+hev_socks5_proxy_set_workers (int num)
+{
+    int max = hev_config_get_max_workers ();
+
+    if (num < 1)
+        num = 1;
+    if (num > max)
+        num = max;
+
+    pthread_mutex_lock (&scale_mutex);
+    scale_target = num;
+    pthread_cond_signal (&scale_cond);
+    pthread_mutex_unlock (&scale_mutex);
 }
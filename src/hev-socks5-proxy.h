@@ -16,4 +16,12 @@ void hev_socks5_proxy_fini (void);
 void hev_socks5_proxy_run (void);
 void hev_socks5_proxy_stop (void);
 
+void hev_socks5_proxy_set_workers (int num);
+
+/*
+ * The standalone server owns the signal state of the process, library
+ * callers keep theirs.
+ */
+void hev_socks5_proxy_set_standalone (int value);
+
 #endif /* __HEV_SOCKS5_PROXY_H__ */
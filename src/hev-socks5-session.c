@@ -7,27 +7,73 @@
  ============================================================================
  */
 
+/*
+ * Datagrams the core relays to remote hosts come through here, see the
+ * RESOLVER_CFLAGS of build.mk, and so do its user lookups, see AUTH_CFLAGS.
+ */
+#ifndef hev_task_io_socket_sendto
+#error "RESOLVER_CFLAGS of build.mk are missing"
+#endif
+
+#ifndef hev_socks5_authenticator_get
+#error "AUTH_CFLAGS of build.mk are missing"
+#endif
+
+#undef hev_task_io_socket_sendto
+#undef hev_socks5_authenticator_get
+
 #include <stdlib.h>
 #include <string.h>
 
+#include <hev-task-io-socket.h>
 #include <hev-memory-allocator.h>
 
 #include "hev-misc.h"
+#include "hev-compiler.h"
 #include "hev-logger.h"
 #include "hev-config.h"
+#include "hev-resolver.h"
 #include "hev-socks5-user-mark.h"
 
 #include "hev-socks5-session.h"
 
+static HevDestAcl *dest_acl;
+static HevAuthTable *auth_table;
+static HevEgressPlan *egress_plan;
+
+/*
+ * Published by the control thread while workers run. The acquire pairs
+ * with the exchange of the setter, so the contents are seen complete.
+ */
+static HevDestAcl *
+hev_socks5_session_dest_acl (void)
+{
+    atomic_intptr_t *ptr = (atomic_intptr_t *)&dest_acl;
+
+    return (HevDestAcl *)atomic_load_explicit (ptr, memory_order_acquire);
+}
+
 HevSocks5Session *
-hev_socks5_session_new (int fd)
+hev_socks5_session_new (int fd, HevSocks5SessionPool *pool)
 {
     HevSocks5Session *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevSocks5Session));
-    if (!self)
-        return NULL;
+    if (pool && pool->num) {
+        pool->num--;
+        if (pool->low > pool->num)
+            pool->low = pool->num;
+        pool->hits++;
+        self = pool->items[pool->num];
+        /* Constructors expect zeroed memory, as from hev_malloc0. */
+        memset (self, 0, sizeof (HevSocks5Session));
+    } else {
+        if (pool)
+            pool->misses++;
+        self = hev_malloc0 (sizeof (HevSocks5Session));
+        if (!self)
+            return NULL;
+    }
 
     res = hev_socks5_session_construct (self, fd);
     if (res < 0) {
@@ -35,71 +81,338 @@ hev_socks5_session_new (int fd)
         return NULL;
     }
 
+    self->pool = pool;
+
     LOG_D ("%p socks5 session new", self);
 
     return self;
 }
 
+int
+hev_socks5_session_pool_init (HevSocks5SessionPool *pool, int max)
+{
+    memset (pool, 0, sizeof (HevSocks5SessionPool));
+
+    if (max <= 0)
+        return 0;
+
+    pool->items = hev_malloc (sizeof (void *) * max);
+    if (!pool->items)
+        return -1;
+
+    pool->max = max;
+
+    return 0;
+}
+
+void
+hev_socks5_session_pool_fini (HevSocks5SessionPool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->num; i++)
+        hev_free (pool->items[i]);
+
+    if (pool->items)
+        hev_free (pool->items);
+    pool->items = NULL;
+    pool->num = 0;
+    pool->max = 0;
+}
+
+void
+hev_socks5_session_pool_trim (HevSocks5SessionPool *pool)
+{
+    int i;
+
+    if (!pool->low)
+        return;
+
+    for (i = 0; i < pool->low; i++)
+        hev_free (pool->items[i]);
+
+    pool->num -= pool->low;
+    memmove (pool->items, &pool->items[pool->low],
+             sizeof (void *) * pool->num);
+    pool->trims += pool->low;
+    pool->low = pool->num;
+}
+
+void
+hev_socks5_session_free (void *ptr)
+{
+    HevSocks5SessionPool *pool;
+
+    /* The class is still set once the destructors of the chain are done. */
+    if (HEV_OBJECT (ptr)->klass != HEV_SOCKS5_SESSION_TYPE) {
+        hev_free (ptr);
+        return;
+    }
+
+    pool = HEV_SOCKS5_SESSION (ptr)->pool;
+    if (!pool || pool->num >= pool->max) {
+        hev_free (ptr);
+        return;
+    }
+
+    pool->items[pool->num++] = ptr;
+}
+
 void
 hev_socks5_session_terminate (HevSocks5Session *self)
 {
     LOG_D ("%p socks5 session terminate", self);
 
     hev_socks5_set_timeout (HEV_SOCKS5 (self), 0);
+    self->target.cancel = 1;
     hev_task_wakeup (self->task);
 }
 
+static unsigned int
+hev_socks5_session_rate_share (unsigned int rate, unsigned int num)
+{
+    if (!rate)
+        return ~0U;
+
+    rate /= num ? num : 1;
+    return rate ? rate : 1;
+}
+
 static int
-hev_socks5_session_bind (HevSocks5 *self, int fd, const struct sockaddr *dest)
+hev_socks5_session_admit (HevSocks5Session *self)
 {
     HevSocks5Server *srv = HEV_SOCKS5_SERVER (self);
-    const char *saddr;
-    const char *iface;
-    int mark = 0;
-    int family;
+    HevSocks5UserMark *user;
+    unsigned int max;
+    unsigned int num;
+
+    if (self->counted || !srv->user)
+        return 0;
+
+    user = HEV_SOCKS5_USER_MARK (srv->user);
+
+    /*
+     * Runs once per session, right after authentication. The counters are
+     * shared by all workers: one relaxed atomic per session is cheaper than
+     * reconciling per-worker shards, and the caps hold exactly. The second
+     * and its connect count share one word, so a reset can not drop the
+     * connects of other workers.
+     */
+    max = user->limit.connects;
+    if (!max)
+        max = hev_config_get_auth_max_connects ();
+    if (max) {
+        uint32_t sec = get_monotonic_ms () / 1000;
+        uint64_t prev;
+        uint64_t next;
+
+        prev = atomic_load_explicit (&user->connects, memory_order_relaxed);
+        do {
+            /* A worker whose clock is behind counts into the newer second. */
+            if ((int32_t)(sec - (uint32_t)(prev >> 32)) <= 0)
+                next = prev + 1;
+            else
+                next = ((uint64_t)sec << 32) | 1;
+            if ((uint32_t)next > max)
+                goto reject;
+        } while (!atomic_compare_exchange_weak_explicit (
+            &user->connects, &prev, next, memory_order_relaxed,
+            memory_order_relaxed));
+    }
+
+    num = atomic_fetch_add_explicit (&user->sessions, 1, memory_order_relaxed);
+    self->counted = 1;
+    hev_user_acct_meter_init (&self->meter);
+
+    max = user->limit.sessions;
+    if (!max)
+        max = hev_config_get_auth_max_sessions ();
+    if (max && num >= max)
+        goto reject;
+
+    return 0;
+
+reject:
+    atomic_fetch_add_explicit (&user->stats.session_rejects, 1,
+                               memory_order_relaxed);
+    LOG_D ("%p socks5 session user limit", self);
+    return -1;
+}
+
+static void
+hev_socks5_session_set_active (HevSocks5Session *self,
+                               HevSocks5UserMark *user, int active)
+{
+    if (active == self->active)
+        return;
+
+    if (active)
+        atomic_fetch_add_explicit (&user->actives, 1, memory_order_relaxed);
+    else
+        atomic_fetch_sub_explicit (&user->actives, 1, memory_order_relaxed);
+    self->active = active;
+}
+
+void
+hev_socks5_session_pace (HevSocks5Session *self)
+{
+    HevSocks5UserMark *user;
+    unsigned int down;
+    unsigned int num;
+    unsigned int up;
+
+    if (self->remote_fd < 0)
+        return;
+
+    user = HEV_SOCKS5_USER_MARK (HEV_SOCKS5_SERVER (self)->user);
+    if (!user->limit.rate_up && !user->limit.rate_down)
+        return;
+
+    /*
+     * Shares only change with the active count of the user, so sessions
+     * of users whose count is unchanged cost no syscall. An idle session
+     * gets the share it would have once it wakes up.
+     */
+    num = atomic_load_explicit (&user->actives, memory_order_relaxed);
+    num += !self->active;
+    if (num == self->pace_num)
+        return;
+
+    up = hev_socks5_session_rate_share (user->limit.rate_up, num);
+    down = hev_socks5_session_rate_share (user->limit.rate_down, num);
+
+    /* Upload is sent on the remote socket, download on the client one. */
+    if (up != self->rate_up) {
+        if (set_sock_pacing_rate (self->remote_fd, up) < 0)
+            return;
+        self->rate_up = up;
+    }
+
+    if (down != self->rate_down) {
+        if (set_sock_pacing_rate (HEV_SOCKS5 (self)->fd, down) < 0)
+            return;
+        self->rate_down = down;
+    }
+
+    self->pace_num = num;
+}
+
+void
+hev_socks5_session_account (HevSocks5Session *self, HevUserAcct *acct,
+                            int done)
+{
+    HevSocks5UserMark *user;
+    int fd = -1;
     int res;
 
-    LOG_D ("%p socks5 session bind", self);
+    if (!self->counted)
+        return;
 
-    if (IN6_IS_ADDR_V4MAPPED (&((struct sockaddr_in6 *)dest)->sin6_addr))
-        family = AF_INET;
+    /* UDP associations are counted by time only. */
+    if (!self->udp)
+        fd = HEV_SOCKS5 (self)->fd;
+
+    user = HEV_SOCKS5_USER_MARK (HEV_SOCKS5_SERVER (self)->user);
+    res = hev_user_acct_sample (acct, user, &self->meter, fd, done);
+
+    /*
+     * Paced sessions without traffic since the last sample no longer
+     * dilute the shares of the busy ones, the counters read here anyway
+     * tell them apart.
+     */
+    if (!done && self->remote_fd >= 0 &&
+        (user->limit.rate_up || user->limit.rate_down))
+        hev_socks5_session_set_active (self, user, res);
+}
+
+static int
+hev_socks5_session_check (HevSocks5Session *self,
+                          const struct sockaddr_in6 *dest)
+{
+    HevSocks5User *user = HEV_SOCKS5_SERVER (self)->user;
+    HevDestAcl *acl = hev_socks5_session_dest_acl ();
+    const char *name = NULL;
+    int res;
+
+    /*
+     * Set by the resolver if the client asked for a domain, and used by
+     * one destination only. A name that could not be kept is denied, the
+     * rules for it are unknown.
+     */
+    if (self->target.len > 0)
+        name = self->target.name;
+    res = self->target.len;
+    self->target.len = 0;
+    if (res < 0)
+        goto deny;
+
+    if (user)
+        res = hev_dest_acl_check (acl, user->name, user->name_len, name,
+                                  dest);
     else
-        family = AF_INET6;
+        res = hev_dest_acl_check (acl, NULL, 0, name, dest);
 
-    saddr = hev_config_get_bind_address (family);
-    iface = hev_config_get_bind_interface ();
+    if (res < 0)
+        goto deny;
 
-    if (saddr) {
-        struct sockaddr_in6 addr;
+    return 0;
 
-        memset (&addr, 0, sizeof (addr));
-        res = hev_netaddr_resolve (&addr, saddr, NULL);
-        if (res < 0)
-            return -1;
+deny:
+    LOG_D ("%p socks5 session acl deny", self);
+    self->denied = 1;
+    return -1;
+}
 
-        res = bind (fd, (struct sockaddr *)&addr, sizeof (addr));
-        if (res < 0)
-            return -1;
-    }
+static int
+hev_socks5_session_bind (HevSocks5 *self, int fd, const struct sockaddr *dest)
+{
+    HevSocks5Server *srv = HEV_SOCKS5_SERVER (self);
+    HevSocks5Session *s = HEV_SOCKS5_SESSION (self);
+    unsigned int mark = 0;
+    int64_t start;
+    int res;
+
+    LOG_D ("%p socks5 session bind", self);
 
-    if (iface) {
-        res = set_sock_bind (fd, iface);
+    start = get_monotonic_us ();
+
+    /* Datagrams are checked one by one when they are sent. */
+    if (hev_socks5_session_dest_acl () && !s->udp) {
+        res = hev_socks5_session_check (s, (struct sockaddr_in6 *)dest);
         if (res < 0)
             return -1;
     }
 
     if (srv->user) {
         HevSocks5UserMark *user = HEV_SOCKS5_USER_MARK (srv->user);
-        mark = user->mark;
-    }
 
-    if (!mark)
-        mark = hev_config_get_socket_mark ();
+        mark = user->mark;
 
-    if (mark) {
-        res = set_sock_mark (fd, mark);
+        res = hev_socks5_session_admit (s);
         if (res < 0)
             return -1;
+
+        /* Rates are enforced by kernel pacing, on TCP sessions only. */
+        if (!s->udp && s->remote_fd < 0) {
+            s->remote_fd = fd;
+            if (user->limit.rate_up || user->limit.rate_down)
+                hev_socks5_session_set_active (s, user, 1);
+            hev_socks5_session_pace (s);
+        }
+    }
+
+    res = hev_egress_plan_apply (egress_plan, fd, (struct sockaddr_in6 *)dest,
+                                 mark, &s->egress);
+    if (res < 0)
+        return -1;
+
+    /* The first outbound socket marks the end of the setup. */
+    if (s->setup_hist) {
+        int64_t now = get_monotonic_us ();
+
+        hev_histogram_add (s->setup_hist, now - s->start_us);
+        hev_histogram_add (s->bind_hist, now - start);
+        s->setup_hist = NULL;
     }
 
     return 0;
@@ -109,11 +422,12 @@ static int
 hev_socks5_session_udp_bind (HevSocks5Server *self, int sock,
                              struct sockaddr_in6 *src)
 {
+    const struct sockaddr_in6 *paddr;
     struct sockaddr_in6 *dst = src;
     struct sockaddr_in6 addr;
-    const char *saddr;
     socklen_t alen;
     int ipv6_only;
+    int timeout;
     int one = 1;
     int family;
     int sport;
@@ -122,8 +436,12 @@ hev_socks5_session_udp_bind (HevSocks5Server *self, int sock,
 
     LOG_D ("%p socks5 session udp bind", self);
 
+    res = hev_socks5_session_admit (HEV_SOCKS5_SESSION (self));
+    if (res < 0)
+        return -1;
+
     fd = HEV_SOCKS5 (self)->fd;
-    saddr = hev_config_get_udp_listen_address ();
+    paddr = hev_egress_plan_get_udp_address (egress_plan);
     sport = hev_config_get_udp_listen_port ();
     ipv6_only = hev_config_get_listen_ipv6_only ();
 
@@ -139,14 +457,15 @@ hev_socks5_session_udp_bind (HevSocks5Server *self, int sock,
             return -1;
     }
 
-    memset (&addr, 0, sizeof (addr));
-    alen = sizeof (struct sockaddr_in6);
-    if (saddr)
-        res = hev_netaddr_resolve (&addr, saddr, NULL);
-    else
+    if (paddr) {
+        memcpy (&addr, paddr, sizeof (addr));
+    } else {
+        memset (&addr, 0, sizeof (addr));
+        alen = sizeof (struct sockaddr_in6);
         res = getsockname (fd, (struct sockaddr *)&addr, &alen);
-    if (res < 0)
-        return -1;
+        if (res < 0)
+            return -1;
+    }
 
     addr.sin6_port = htons (sport);
     res = bind (sock, (struct sockaddr *)&addr, sizeof (struct sockaddr_in6));
@@ -168,6 +487,19 @@ hev_socks5_session_udp_bind (HevSocks5Server *self, int sock,
         return -1;
 
     HEV_SOCKS5 (self)->udp_associated = !!dst->sin6_port;
+    HEV_SOCKS5_SESSION (self)->udp = 1;
+    HEV_SOCKS5_SESSION (self)->udp_fd = sock;
+
+    /*
+     * The idle wheel only sees the tcp socket, which is quiet while
+     * datagrams flow. Associations are timed by the core instead.
+     */
+    if (HEV_SOCKS5_SESSION (self)->wheel) {
+        timeout = hev_config_get_misc_udp_read_write_timeout ();
+        hev_timer_wheel_del (HEV_SOCKS5_SESSION (self)->wheel,
+                             &HEV_SOCKS5_SESSION (self)->timer);
+        hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+    }
 
     alen = sizeof (struct sockaddr_in6);
     res = getsockname (sock, (struct sockaddr *)src, &alen);
@@ -179,13 +511,11 @@ hev_socks5_session_udp_bind (HevSocks5Server *self, int sock,
     else
         family = AF_INET6;
 
-    saddr = hev_config_get_udp_public_address (family);
-    if (saddr) {
+    paddr = hev_egress_plan_get_udp_public_address (egress_plan, family);
+    if (paddr) {
         sport = src->sin6_port;
-        res = hev_netaddr_resolve (src, saddr, NULL);
+        memcpy (src, paddr, sizeof (struct sockaddr_in6));
         src->sin6_port = sport;
-        if (res < 0)
-            return -1;
     }
 
     return 0;
@@ -205,6 +535,12 @@ hev_socks5_session_construct (HevSocks5Session *self, int fd)
 
     HEV_OBJECT (self)->klass = HEV_SOCKS5_SESSION_TYPE;
 
+    self->udp_fd = -1;
+    self->remote_fd = -1;
+    self->rate_up = ~0U;
+    self->rate_down = ~0U;
+    self->start_us = get_monotonic_us ();
+
     addr_family = hev_config_get_address_family ();
     hev_socks5_set_addr_family (HEV_SOCKS5 (self), addr_family);
 
@@ -218,9 +554,149 @@ hev_socks5_session_destruct (HevObject *base)
 
     LOG_D ("%p socks5 session destruct", self);
 
+    if (self->egress)
+        hev_egress_pool_release (self->egress);
+
+    if (self->counted) {
+        HevSocks5UserMark *user;
+
+        user = HEV_SOCKS5_USER_MARK (HEV_SOCKS5_SERVER (self)->user);
+        atomic_fetch_sub_explicit (&user->sessions, 1, memory_order_relaxed);
+        if (self->active)
+            atomic_fetch_sub_explicit (&user->actives, 1,
+                                       memory_order_relaxed);
+    }
+
+    if (self->pin)
+        hev_object_unref (HEV_OBJECT (self->pin));
+
     HEV_SOCKS5_SERVER_TYPE->destruct (base);
 }
 
+int
+hev_socks5_session_run (HevSocks5Session *self)
+{
+    int res;
+
+    /* Without the record domain rules could not be enforced. */
+    res = hev_resolver_attach (&self->target);
+    if (res < 0) {
+        LOG_E ("%p socks5 session resolver attach", self);
+        return -1;
+    }
+
+    res = hev_socks5_server_run (HEV_SOCKS5_SERVER (self));
+    hev_resolver_detach (&self->target);
+
+    return res;
+}
+
+ssize_t
+hev_socks5_session_sendto (int fd, const void *buf, size_t len, int flags,
+                           const struct sockaddr *addr, socklen_t addr_len,
+                           HevTaskIOYielder yielder, void *yielder_data)
+{
+    HevResolverName *rn = NULL;
+
+    if (addr && hev_socks5_session_dest_acl ())
+        rn = hev_resolver_find (hev_task_self ());
+
+    if (rn) {
+        HevSocks5Session *s = container_of (rn, HevSocks5Session, target);
+        struct sockaddr_in6 dest;
+
+        /* Replies to the client go out on its own socket. */
+        if (s->udp && fd != s->udp_fd) {
+            if (addr->sa_family == AF_INET) {
+                const struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+
+                memset (&dest, 0, sizeof (dest));
+                dest.sin6_family = AF_INET6;
+                dest.sin6_port = sin->sin_port;
+                dest.sin6_addr.s6_addr[10] = 0xff;
+                dest.sin6_addr.s6_addr[11] = 0xff;
+                memcpy (&dest.sin6_addr.s6_addr[12], &sin->sin_addr, 4);
+            } else {
+                memcpy (&dest, addr, sizeof (dest));
+            }
+
+            /* Dropped as a firewall would, the association goes on. */
+            if (hev_socks5_session_check (s, &dest) < 0)
+                return len;
+        }
+    }
+
+    return hev_task_io_socket_sendto (fd, buf, len, flags, addr, addr_len,
+                                      yielder, yielder_data);
+}
+
+HevSocks5User *
+hev_socks5_session_get_user (HevSocks5Authenticator *auth, const char *name,
+                             unsigned int name_len)
+{
+    atomic_intptr_t *ptr = (atomic_intptr_t *)&auth_table;
+    HevResolverName *rn;
+    HevSocks5Session *s;
+    HevSocks5User *user;
+    HevAuthTable *table;
+
+    table = (HevAuthTable *)atomic_load_explicit (ptr, memory_order_acquire);
+    if (!table)
+        return hev_socks5_authenticator_get (auth, name, name_len);
+
+    user = hev_auth_table_get (table, name, name_len);
+    if (!user)
+        return NULL;
+
+    /*
+     * Users of the table are only kept alive by the authenticator of the
+     * control thread, until the grace period of the reload that drops
+     * them. The session keeps its own reference from here on.
+     */
+    rn = hev_resolver_find (hev_task_self ());
+    if (!rn) {
+        LOG_E ("socks5 session get user outside of a session");
+        return NULL;
+    }
+
+    s = container_of (rn, HevSocks5Session, target);
+    if (s->pin)
+        hev_object_unref (HEV_OBJECT (s->pin));
+    s->pin = HEV_SOCKS5_USER (hev_object_ref (HEV_OBJECT (user)));
+
+    return user;
+}
+
+HevAuthTable *
+hev_socks5_session_set_auth_table (HevAuthTable *table)
+{
+    atomic_intptr_t *ptr = (atomic_intptr_t *)&auth_table;
+
+    LOG_D ("socks5 session set auth table");
+
+    return (HevAuthTable *)atomic_exchange_explicit (ptr, (intptr_t)table,
+                                                     memory_order_acq_rel);
+}
+
+HevDestAcl *
+hev_socks5_session_set_dest_acl (HevDestAcl *acl)
+{
+    atomic_intptr_t *ptr = (atomic_intptr_t *)&dest_acl;
+
+    LOG_D ("socks5 session set dest acl");
+
+    return (HevDestAcl *)atomic_exchange_explicit (ptr, (intptr_t)acl,
+                                                   memory_order_acq_rel);
+}
+
+void
+hev_socks5_session_set_egress_plan (HevEgressPlan *plan)
+{
+    LOG_D ("socks5 session set egress plan");
+
+    egress_plan = plan;
+}
+
 HevObjectClass *
 hev_socks5_session_class (void)
 {
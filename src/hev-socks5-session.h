@@ -11,10 +11,18 @@
 #define __HEV_SOCKS5_SESSION_H__
 
 #include <hev-task.h>
+#include <hev-task-io.h>
 #include <hev-socks5-server.h>
 #include <hev-socks5-authenticator.h>
 
 #include "hev-list.h"
+#include "hev-resolver.h"
+#include "hev-auth-table.h"
+#include "hev-dest-acl.h"
+#include "hev-egress-plan.h"
+#include "hev-user-acct.h"
+#include "hev-histogram.h"
+#include "hev-timer-wheel.h"
 
 #define HEV_SOCKS5_SESSION(p) ((HevSocks5Session *)p)
 #define HEV_SOCKS5_SESSION_CLASS(p) ((HevSocks5SessionClass *)p)
@@ -22,14 +30,36 @@
 
 typedef struct _HevSocks5Session HevSocks5Session;
 typedef struct _HevSocks5SessionClass HevSocks5SessionClass;
+typedef struct _HevSocks5SessionPool HevSocks5SessionPool;
 
 struct _HevSocks5Session
 {
     HevSocks5Server base;
 
     HevListNode node;
+    HevTimerWheelNode timer;
+    HevTimerWheel *wheel;
     HevTask *task;
+    HevSocks5SessionPool *pool;
+    HevSocks5User *pin;
     void *data;
+    int udp;
+    int udp_fd;
+    int denied;
+    HevResolverName target;
+
+    int counted;
+    int active;
+    int remote_fd;
+    unsigned int pace_num;
+    unsigned int rate_up;
+    unsigned int rate_down;
+    HevUserAcctMeter meter;
+    HevEgressSlot *egress;
+
+    int64_t start_us;
+    HevHistogram *setup_hist;
+    HevHistogram *bind_hist;
 };
 
 struct _HevSocks5SessionClass
@@ -37,12 +67,206 @@ struct _HevSocks5SessionClass
     HevSocks5ServerClass base;
 };
 
+struct _HevSocks5SessionPool
+{
+    int max;
+    int num;
+    int low;
+    void **items;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long trims;
+};
+
 HevObjectClass *hev_socks5_session_class (void);
 
 int hev_socks5_session_construct (HevSocks5Session *self, int fd);
 
-HevSocks5Session *hev_socks5_session_new (int fd);
+/**
+ * hev_socks5_session_new:
+ * @fd: the client socket
+ * @pool: (nullable): a #HevSocks5SessionPool
+ *
+ * Create a session, reusing the memory of a finished one from @pool if
+ * there is any. The session goes back to @pool once its last reference is
+ * gone, unless @pool is full.
+ *
+ * Returns: a new #HevSocks5Session, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevSocks5Session *hev_socks5_session_new (int fd, HevSocks5SessionPool *pool);
+
+/**
+ * hev_socks5_session_pool_init:
+ * @pool: a #HevSocks5SessionPool
+ * @max: the most finished sessions kept
+ *
+ * Initialize a pool of finished sessions, only used by the calling thread.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_socks5_session_pool_init (HevSocks5SessionPool *pool, int max);
+
+/**
+ * hev_socks5_session_pool_fini:
+ * @pool: a #HevSocks5SessionPool
+ *
+ * Free the sessions kept by @pool. Every session of @pool must be gone.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_session_pool_fini (HevSocks5SessionPool *pool);
+
+/**
+ * hev_socks5_session_pool_trim:
+ * @pool: a #HevSocks5SessionPool
+ *
+ * Free the sessions that stayed in @pool since the last trim, below its
+ * low-water mark.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_session_pool_trim (HevSocks5SessionPool *pool);
+
+/**
+ * hev_socks5_session_free:
+ * @ptr: memory of an object
+ *
+ * Stands in for hev_free in the object code of the socks5 core, see the
+ * OBJECT_CFLAGS of build.mk. Sessions go back to their pool, anything else
+ * is freed.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_session_free (void *ptr);
 
 void hev_socks5_session_terminate (HevSocks5Session *self);
 
+/**
+ * hev_socks5_session_run:
+ * @self: a #HevSocks5Session
+ *
+ * Run the session on the calling task. The names the core resolves for it
+ * are recorded in the session, for the destination acl.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_socks5_session_run (HevSocks5Session *self);
+
+/**
+ * hev_socks5_session_sendto:
+ * @fd: a socket
+ * @buf: data
+ * @len: length of @buf
+ * @flags: flags of sendto
+ * @addr: (nullable): destination address
+ * @addr_len: length of @addr
+ * @yielder: a #HevTaskIOYielder
+ * @yielder_data: data of @yielder
+ *
+ * Stands in for hev_task_io_socket_sendto in the whole build. Datagrams
+ * of UDP associations to remote hosts are checked against the
+ * destination acl, and denied ones are dropped.
+ *
+ * Returns: returns the number of bytes sent, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+ssize_t hev_socks5_session_sendto (int fd, const void *buf, size_t len,
+                                   int flags, const struct sockaddr *addr,
+                                   socklen_t addr_len,
+                                   HevTaskIOYielder yielder,
+                                   void *yielder_data);
+
+/**
+ * hev_socks5_session_pace:
+ * @self: a #HevSocks5Session
+ *
+ * Re-apply the share of its user's rate limit, which is split evenly over
+ * the active sessions of that user. Does nothing for unlimited sessions,
+ * and for those whose share is unchanged.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_session_pace (HevSocks5Session *self);
+
+/**
+ * hev_socks5_session_account:
+ * @self: a #HevSocks5Session
+ * @acct: the accounting shard of the worker
+ * @done: whether the session has ended
+ *
+ * Add the traffic of an authenticated session since the last call to
+ * @acct. A paced session without traffic since then is no longer active,
+ * until it has traffic again. Does nothing for sessions without a user.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_session_account (HevSocks5Session *self, HevUserAcct *acct,
+                                 int done);
+
+/**
+ * hev_socks5_session_set_dest_acl:
+ * @acl: (nullable): a #HevDestAcl
+ *
+ * Publish the destination acl checked by the binder of every session.
+ * Sessions may still use the previous acl until every worker has passed
+ * hev_socks5_worker_synchronize().
+ *
+ * Returns: returns the previous acl.
+ *
+ * Since: 2.14
+ */
+HevDestAcl *hev_socks5_session_set_dest_acl (HevDestAcl *acl);
+
+/**
+ * hev_socks5_session_get_user:
+ * @auth: the authenticator of the session
+ * @name: user name
+ * @name_len: length of user name
+ *
+ * Stands in for hev_socks5_authenticator_get in the whole build, see the
+ * AUTH_CFLAGS of build.mk. Users are looked up in the published table if
+ * there is one, otherwise in @auth. The user is kept until the session
+ * is gone, so a reload may drop it in the meantime.
+ *
+ * Returns: returns the user, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevSocks5User *hev_socks5_session_get_user (HevSocks5Authenticator *auth,
+                                            const char *name,
+                                            unsigned int name_len);
+
+/**
+ * hev_socks5_session_set_auth_table:
+ * @table: (nullable): a #HevAuthTable
+ *
+ * Publish the table users are looked up in. Sessions may still use the
+ * previous table until every worker has passed
+ * hev_socks5_worker_synchronize().
+ *
+ * Returns: returns the previous table.
+ *
+ * Since: 2.14
+ */
+HevAuthTable *hev_socks5_session_set_auth_table (HevAuthTable *table);
+
+/**
+ * hev_socks5_session_set_egress_plan:
+ * @plan: (nullable): a #HevEgressPlan
+ *
+ * Set the plan outbound sockets are set up by. Only call it before
+ * workers start or after they are gone.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_session_set_egress_plan (HevEgressPlan *plan);
+
 #endif /* __HEV_SOCKS5_SESSION_H__ */
@@ -9,11 +9,28 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+
+#include <hev-task.h>
 
 #include "hev-logger.h"
+#include "hev-resolver.h"
+#include "hev-auth-hash.h"
 
 #include "hev-socks5-user-mark.h"
 
+struct _HevSocks5UserArena
+{
+    atomic_int ref_count;
+    unsigned int used;
+    unsigned int users;
+    size_t offset;
+    size_t size;
+    char *strings;
+
+    HevSocks5UserMark list[];
+};
+
 HevSocks5UserMark *
 hev_socks5_user_mark_new (const char *name, unsigned int name_len,
                           const char *pass, unsigned int pass_len,
@@ -55,10 +72,41 @@ hev_socks5_user_mark_construct (HevSocks5UserMark *self, const char *name,
     HEV_OBJECT (self)->klass = HEV_SOCKS5_USER_MARK_TYPE;
 
     self->mark = mark;
+    self->arena = NULL;
+    atomic_init (&self->sessions, 0);
+    atomic_init (&self->actives, 0);
+    atomic_init (&self->connects, 0);
+    atomic_init (&self->tries, 0);
+    atomic_init (&self->stats.bytes_up, 0);
+    atomic_init (&self->stats.bytes_down, 0);
+    atomic_init (&self->stats.sessions, 0);
+    atomic_init (&self->stats.session_msecs, 0);
+    atomic_init (&self->stats.session_rejects, 0);
+    memset (&self->limit, 0, sizeof (self->limit));
 
     return 0;
 }
 
+static int
+hev_socks5_user_mark_checker (HevSocks5User *base, const char *pass,
+                              unsigned int pass_len)
+{
+    HevSocks5UserClass *kptr = HEV_SOCKS5_USER_CLASS (HEV_SOCKS5_USER_TYPE);
+
+    if (hev_auth_hash_is_hashed (base->pass, base->pass_len)) {
+        HevSocks5UserMark *self = HEV_SOCKS5_USER_MARK (base);
+        HevResolverName *rn;
+
+        /* The record of the session task is canceled by its terminator. */
+        rn = hev_resolver_find (hev_task_self ());
+        return hev_auth_hash_check (base->pass, base->pass_len, pass,
+                                    pass_len, &self->tries,
+                                    rn ? &rn->cancel : NULL);
+    }
+
+    return kptr->checker (base, pass, pass_len);
+}
+
 static void
 hev_socks5_user_mark_destruct (HevObject *base)
 {
@@ -66,6 +114,12 @@ hev_socks5_user_mark_destruct (HevObject *base)
 
     LOG_D ("%p socks5 user mark destruct", self);
 
+    /* Name, password and the object itself belong to the arena. */
+    if (self->arena) {
+        hev_socks5_user_arena_unref (self->arena);
+        return;
+    }
+
     HEV_SOCKS5_USER_TYPE->destruct (base);
 }
 
@@ -81,7 +135,89 @@ hev_socks5_user_mark_class (void)
 
         okptr->name = "HevSocks5UserMark";
         okptr->destruct = hev_socks5_user_mark_destruct;
+        HEV_SOCKS5_USER_CLASS (kptr)->checker = hev_socks5_user_mark_checker;
     }
 
     return okptr;
 }
+
+HevSocks5UserArena *
+hev_socks5_user_arena_new (unsigned int users, size_t size)
+{
+    HevSocks5UserArena *self;
+    size_t head;
+
+    head = sizeof (HevSocks5UserArena);
+    head += sizeof (HevSocks5UserMark) * users;
+
+    self = malloc (head + size);
+    if (!self)
+        return NULL;
+
+    atomic_init (&self->ref_count, 1);
+    self->used = 0;
+    self->users = users;
+    self->offset = 0;
+    self->size = size;
+    self->strings = (char *)self + head;
+
+    LOG_D ("%p socks5 user arena new", self);
+
+    return self;
+}
+
+void
+hev_socks5_user_arena_unref (HevSocks5UserArena *self)
+{
+    if (atomic_fetch_sub_explicit (&self->ref_count, 1, memory_order_acq_rel) >
+        1)
+        return;
+
+    LOG_D ("%p socks5 user arena free", self);
+
+    free (self);
+}
+
+HevSocks5UserMark *
+hev_socks5_user_arena_alloc (HevSocks5UserArena *self, const char *name,
+                             unsigned int name_len, const char *pass,
+                             unsigned int pass_len, unsigned int mark)
+{
+    HevSocks5UserMark *user;
+    HevSocks5User *base;
+
+    if (self->used >= self->users)
+        return NULL;
+    if ((self->size - self->offset) < ((size_t)name_len + pass_len))
+        return NULL;
+
+    user = &self->list[self->used++];
+    memset (user, 0, sizeof (HevSocks5UserMark));
+    base = &user->base;
+
+    /*
+     * hev_socks5_user_construct would duplicate both strings on the heap,
+     * so the base is set up in place and the strings point into the arena.
+     */
+    if (hev_object_construct (HEV_OBJECT (user)) < 0)
+        return NULL;
+
+    HEV_OBJECT (user)->klass = HEV_SOCKS5_USER_MARK_TYPE;
+
+    base->name_len = name_len;
+    base->pass_len = pass_len;
+
+    base->name = self->strings + self->offset;
+    memcpy (base->name, name, name_len);
+    self->offset += name_len;
+
+    base->pass = self->strings + self->offset;
+    memcpy (base->pass, pass, pass_len);
+    self->offset += pass_len;
+
+    user->mark = mark;
+    user->arena = self;
+    atomic_fetch_add_explicit (&self->ref_count, 1, memory_order_relaxed);
+
+    return user;
+}
@@ -10,6 +10,10 @@
 #ifndef __HEV_SOCKS5_USER_MARK_H__
 #define __HEV_SOCKS5_USER_MARK_H__
 
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "hev-list.h"
 #include "hev-socks5-user.h"
 
 #ifdef __cplusplus
@@ -22,12 +26,47 @@ extern "C" {
 
 typedef struct _HevSocks5UserMark HevSocks5UserMark;
 typedef struct _HevSocks5UserMarkClass HevSocks5UserMarkClass;
+typedef struct _HevSocks5UserArena HevSocks5UserArena;
+typedef struct _HevSocks5UserLimit HevSocks5UserLimit;
+typedef struct _HevSocks5UserStats HevSocks5UserStats;
+
+struct _HevSocks5UserLimit
+{
+    /* bytes per second, 0: unlimited */
+    unsigned int rate_up;
+    unsigned int rate_down;
+    /* 0: the global default */
+    unsigned int sessions;
+    unsigned int connects;
+};
+
+struct _HevSocks5UserStats
+{
+    /* sessions counts ended ones, the others include live sessions */
+    atomic_ullong bytes_up;
+    atomic_ullong bytes_down;
+    atomic_ullong sessions;
+    atomic_ullong session_msecs;
+    atomic_ulong session_rejects;
+};
 
 struct _HevSocks5UserMark
 {
     HevSocks5User base;
 
     unsigned int mark;
+    unsigned int gen;
+    atomic_uint sessions;
+    /* paced TCP sessions, less those idle at their last stats sample */
+    atomic_uint actives;
+    /* current second << 32 | connects in it */
+    atomic_ullong connects;
+    /* current second << 32 | uncached password hashes in it */
+    atomic_ullong tries;
+    HevSocks5UserLimit limit;
+    HevSocks5UserStats stats;
+    HevListNode node;
+    HevSocks5UserArena *arena;
 };
 
 struct _HevSocks5UserMarkClass
@@ -47,6 +86,55 @@ HevSocks5UserMark *hev_socks5_user_mark_new (const char *name,
                                              unsigned int pass_len,
                                              unsigned int mark);
 
+/**
+ * hev_socks5_user_arena_new:
+ * @users: the maximum number of users
+ * @size: the total bytes of all names and passwords
+ *
+ * Create a user arena. The user objects and their strings are carved out of
+ * one contiguous block, which is released after the last user is gone.
+ *
+ * Returns: returns user arena on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevSocks5UserArena *hev_socks5_user_arena_new (unsigned int users,
+                                               size_t size);
+
+/**
+ * hev_socks5_user_arena_unref:
+ * @self: a #HevSocks5UserArena
+ *
+ * Drop the creator reference of the arena. Users allocated from the arena
+ * keep it alive on their own.
+ *
+ * Since: 2.14
+ */
+void hev_socks5_user_arena_unref (HevSocks5UserArena *self);
+
+/**
+ * hev_socks5_user_arena_alloc:
+ * @self: a #HevSocks5UserArena
+ * @name: user name
+ * @name_len: length of user name
+ * @pass: password
+ * @pass_len: length of password
+ * @mark: socket mark
+ *
+ * Allocate a user with mark from the arena. The strings are copied into the
+ * arena.
+ *
+ * Returns: returns user on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevSocks5UserMark *hev_socks5_user_arena_alloc (HevSocks5UserArena *self,
+                                                const char *name,
+                                                unsigned int name_len,
+                                                const char *pass,
+                                                unsigned int pass_len,
+                                                unsigned int mark);
+
 #ifdef __cplusplus
 }
 #endif
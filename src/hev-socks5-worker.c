@@ -7,59 +7,155 @@
  ============================================================================
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <sys/ioctl.h>
 
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
 #include <hev-memory-allocator.h>
 
+#include "hev-misc.h"
 #include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-compiler.h"
+#include "hev-user-acct.h"
+#include "hev-resolver.h"
+#include "hev-timer-wheel.h"
 #include "hev-socks5-session.h"
+#include "hev-uring-acceptor.h"
 
 #include "hev-socks5-worker.h"
 
 enum
 {
     SYNC_SEND = 1 << 0,
-    SYNC_WAIT = 1 << 1,
-    SYNC_STOP = 1 << 2,
-    SYNC_LOAD = 1 << 3,
-    SYNC_SENT_S = 1 << 4,
-    SYNC_SENT_R = 1 << 5,
+    SYNC_BUSY = 1 << 1,
+};
+
+enum
+{
+    EVENT_STOP = 1 << 0,
+    EVENT_LOAD = 1 << 1,
+    EVENT_DRAIN = 1 << 2,
+    EVENT_SYNC = 1 << 3,
 };
 
+enum
+{
+    DRAIN_NONE = 0,
+    DRAIN_WAIT,
+    DRAIN_DONE,
+};
+
+#define TASK_POOL_TRIM_INTERVAL (10000)
+#define OVERLOAD_POLL_INTERVAL (100)
+#define ACCEPT_BACKOFF_MIN (1)
+#define ACCEPT_BACKOFF_MAX (1000)
+#define TIMER_WHEEL_TICK (1000)
+#define PACE_INTERVAL (1000)
+
 struct _HevSocks5Worker
 {
     int fd;
+    int reserve_fd;
     int event_fds[2];
 
     int run;
+    int drain;
     atomic_int tsync;
+    atomic_int events;
+
+    int accept_batch;
+    int accept_count;
+    int accept_backoff;
+    int session_num;
+    int session_max;
+    int session_max_all;
+    int overload_reject;
+    int paused;
+    int stack_size;
+    int task_pool_max;
+    int task_pool_num;
+    int task_pool_low;
+    int64_t task_pool_trim;
+    HevTask **task_pool;
+    HevSocks5SessionPool session_pool;
+
+    int idle_timeout;
+    HevTimerWheel timer_wheel;
+
+    HevSocks5WorkerStats stats;
 
     HevTask *task_event;
+    HevTask *task_timer;
+    HevTask *task_user;
     HevTask *task_worker;
+    HevUserAcct *acct;
+    int acct_interval;
+    HevUringAcceptor *uring;
     HevList session_set;
+    HevListNode gate_node;
     HevSocks5Authenticator *auth_curr;
     HevSocks5Authenticator *auth_next;
+
+    int gate_in;
+    int gate_sync;
 };
 
+static atomic_int session_num_all;
+static HevSourceAcl *source_acl;
+
+/*
+ * Shared state such as the acls and the auth table is published while
+ * workers run. A worker in its event task has no session in the middle of
+ * a lookup, so once every running worker has been there, nothing uses the
+ * previous state any longer and it can be freed.
+ */
+static int gate_waits;
+static HevList gate_list;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t gate_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
     HevSocks5Worker *self = data;
 
     hev_task_yield (type);
+    self->accept_count = 0;
 
     return READ_ONCE (self->run) ? 0 : -1;
 }
 
+static int
+task_io_aborter (HevTaskYieldType type, void *data)
+{
+    return -1;
+}
+
+static int
+event_io_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5Worker *self = data;
+
+    hev_task_yield (type);
+
+    /* A drained worker leaves once its last session is gone. */
+    return (self->drain == DRAIN_DONE && !self->session_num) ? -1 : 0;
+}
+
 static void
 hev_socks5_worker_load (HevSocks5Worker *self)
 {
@@ -79,16 +175,343 @@ hev_socks5_worker_load (HevSocks5Worker *self)
     self->auth_curr = HEV_SOCKS5_AUTHENTICATOR (prev);
 }
 
+static HevTask *
+hev_socks5_worker_task_new (HevSocks5Worker *self)
+{
+    while (self->task_pool_num) {
+        HevTask *task;
+
+        self->task_pool_num--;
+        if (self->task_pool_low > self->task_pool_num)
+            self->task_pool_low = self->task_pool_num;
+
+        /*
+         * A task is pooled from its own entry, so it is only ready to run
+         * again once that returned. Its session closed every fd it had
+         * added, and nothing else is left in the task.
+         */
+        task = self->task_pool[self->task_pool_num];
+        if (hev_task_get_state (task) == HEV_TASK_STOPPED) {
+            self->stats.task_pool_hits++;
+            return task;
+        }
+
+        LOG_W ("%p works worker task %p not stopped", self, task);
+        hev_task_unref (task);
+    }
+
+    self->stats.task_pool_misses++;
+    return hev_task_new (self->stack_size);
+}
+
+static void
+hev_socks5_worker_task_trim (HevSocks5Worker *self)
+{
+    int64_t now;
+    int i;
+
+    now = get_monotonic_ms ();
+    if ((now - self->task_pool_trim) < TASK_POOL_TRIM_INTERVAL)
+        return;
+
+    self->task_pool_trim = now;
+    hev_socks5_session_pool_trim (&self->session_pool);
+    if (!self->task_pool_low)
+        return;
+
+    LOG_D ("%p works worker trim %d tasks", self, self->task_pool_low);
+
+    /* Tasks below the low-water mark were idle for a whole interval. */
+    for (i = 0; i < self->task_pool_low; i++)
+        hev_task_unref (self->task_pool[i]);
+
+    self->task_pool_num -= self->task_pool_low;
+    memmove (self->task_pool, &self->task_pool[self->task_pool_low],
+             sizeof (HevTask *) * self->task_pool_num);
+    self->stats.task_pool_trims += self->task_pool_low;
+    self->task_pool_low = self->task_pool_num;
+}
+
+static void
+hev_socks5_worker_task_free (HevSocks5Worker *self, HevTask *task)
+{
+    hev_socks5_worker_task_trim (self);
+
+    if (self->task_pool_num >= self->task_pool_max)
+        return;
+
+    /* Keep the task alive after it exits so it can be run again. */
+    hev_task_ref (task);
+    self->task_pool[self->task_pool_num++] = task;
+}
+
 static void
 hev_socks5_session_task_entry (void *data)
 {
     HevSocks5Session *s = data;
     HevSocks5Worker *self = s->data;
 
-    hev_socks5_server_run (HEV_SOCKS5_SERVER (s));
+    hev_socks5_session_run (s);
+    if (s->denied)
+        self->stats.acl_denies++;
+    if (self->acct)
+        hev_socks5_session_account (s, self->acct, 1);
 
+    hev_timer_wheel_del (&self->timer_wheel, &s->timer);
     hev_list_del (&self->session_set, &s->node);
+    hev_socks5_worker_task_free (self, s->task);
     hev_object_unref (HEV_OBJECT (s));
+
+    self->session_num--;
+    if (self->session_max_all)
+        atomic_fetch_sub_explicit (&session_num_all, 1, memory_order_relaxed);
+    if (self->paused)
+        hev_task_wakeup (self->task_worker);
+    if (self->drain == DRAIN_DONE && !self->session_num)
+        hev_task_wakeup (self->task_event);
+}
+
+static int
+hev_socks5_worker_overloaded (HevSocks5Worker *self, int resume)
+{
+    int num;
+    int max;
+
+    /* Resume only after dropping below 7/8 of a limit. */
+    max = self->session_max;
+    if (max) {
+        num = self->session_num;
+        if (resume)
+            num += max >> 3;
+        if (num >= max)
+            return 1;
+    }
+
+    max = self->session_max_all;
+    if (max) {
+        num = atomic_load_explicit (&session_num_all, memory_order_relaxed);
+        if (resume)
+            num += max >> 3;
+        if (num >= max)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+hev_socks5_worker_pause (HevSocks5Worker *self, int fd)
+{
+    HevTask *task = hev_task_self ();
+
+    LOG_I ("%p works worker pause accept", self);
+
+    self->stats.accept_pauses++;
+    if (self->uring)
+        hev_uring_acceptor_pause (self->uring);
+    hev_task_del_fd (task, fd);
+
+    self->paused = 1;
+    while (READ_ONCE (self->run) && hev_socks5_worker_overloaded (self, 1))
+        hev_task_sleep (OVERLOAD_POLL_INTERVAL);
+    self->paused = 0;
+
+    hev_task_add_fd (task, fd, POLLIN);
+
+    LOG_I ("%p works worker resume accept", self);
+
+    return READ_ONCE (self->run) ? 0 : -1;
+}
+
+static int
+hev_socks5_worker_backoff (HevSocks5Worker *self, int fd)
+{
+    HevTask *task = hev_task_self ();
+    int timeout;
+
+    timeout = self->accept_backoff * 2;
+    if (timeout < ACCEPT_BACKOFF_MIN)
+        timeout = ACCEPT_BACKOFF_MIN;
+    if (timeout > ACCEPT_BACKOFF_MAX)
+        timeout = ACCEPT_BACKOFF_MAX;
+    self->accept_backoff = timeout;
+
+    /* New connections must not cut the backoff short. */
+    hev_task_del_fd (task, fd);
+    while (READ_ONCE (self->run) && timeout > 0)
+        timeout = hev_task_sleep (timeout);
+    hev_task_add_fd (task, fd, POLLIN);
+
+    return READ_ONCE (self->run) ? 0 : -1;
+}
+
+static int
+hev_socks5_worker_accept_error (HevSocks5Worker *self, int fd)
+{
+    int err = errno;
+    int nfd;
+
+    self->stats.accept_errors++;
+
+    switch (err) {
+    case EINTR:
+    case EPROTO:
+    case ECONNABORTED:
+        return 0;
+    }
+
+    if (!self->accept_backoff)
+        LOG_E ("socks5 proxy accept");
+
+    if ((err == EMFILE || err == ENFILE) && self->reserve_fd >= 0) {
+        /* Free a slot to accept and drop the connection at the head. */
+        close (self->reserve_fd);
+        nfd = accept (self->fd, NULL, NULL);
+        if (nfd >= 0) {
+            close (nfd);
+            self->stats.accept_drops++;
+        }
+        self->reserve_fd = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    return hev_socks5_worker_backoff (self, fd);
+}
+
+static int
+hev_socks5_worker_filter (HevSocks5Worker *self, int fd,
+                          struct sockaddr_in6 *addr, socklen_t alen)
+{
+    atomic_intptr_t *ptr = (atomic_intptr_t *)&source_acl;
+    HevSourceAcl *acl;
+
+    acl = (HevSourceAcl *)atomic_load_explicit (ptr, memory_order_acquire);
+    if (!acl)
+        return 0;
+
+    /* The io_uring acceptor does not report the peer address. */
+    if (!alen) {
+        alen = sizeof (*addr);
+        if (getpeername (fd, (struct sockaddr *)addr, &alen) < 0)
+            return 0;
+    }
+
+    if (hev_source_acl_check (acl, (struct sockaddr *)addr) == 0)
+        return 0;
+
+    close (fd);
+    self->stats.acl_drops++;
+    return -1;
+}
+
+static void
+hev_socks5_worker_spawn (HevSocks5Worker *self, int fd)
+{
+    HevSocks5Session *s;
+    HevTask *task;
+
+    s = hev_socks5_session_new (fd, &self->session_pool);
+    if (!s) {
+        close (fd);
+        return;
+    }
+
+    task = hev_socks5_worker_task_new (self);
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (s));
+        return;
+    }
+
+    if (self->auth_curr)
+        hev_socks5_server_set_auth (HEV_SOCKS5_SERVER (s), self->auth_curr);
+
+    s->task = task;
+    s->data = self;
+    s->setup_hist = &self->stats.connect_setup;
+    s->bind_hist = &self->stats.connect_bind;
+    hev_list_add_tail (&self->session_set, &s->node);
+    if (self->task_timer) {
+        s->wheel = &self->timer_wheel;
+        hev_timer_wheel_add (&self->timer_wheel, &s->timer,
+                             get_monotonic_ms () + self->idle_timeout);
+    }
+    hev_task_run (task, hev_socks5_session_task_entry, s);
+
+    self->session_num++;
+    if (self->session_max_all)
+        atomic_fetch_add_explicit (&session_num_all, 1, memory_order_relaxed);
+}
+
+static void
+hev_socks5_worker_terminate (HevSocks5Worker *self)
+{
+    HevListNode *node;
+
+    node = hev_list_first (&self->session_set);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5Session *s;
+
+        s = container_of (node, HevSocks5Session, node);
+        hev_socks5_session_terminate (s);
+    }
+
+    hev_resolver_cancel ();
+}
+
+static void
+hev_socks5_worker_flush (HevSocks5Worker *self)
+{
+    struct sockaddr_in6 addr;
+    socklen_t alen;
+    int nfd;
+
+    /*
+     * Serve connections already queued on this listener before it leaves
+     * the reuseport group, closing it would reset them.
+     */
+    if (self->uring) {
+        hev_uring_acceptor_pause (self->uring);
+        while ((nfd = hev_uring_acceptor_flush (self->uring)) >= 0)
+            if (hev_socks5_worker_filter (self, nfd, &addr, 0) == 0)
+                hev_socks5_worker_spawn (self, nfd);
+    }
+
+    for (;;) {
+        alen = sizeof (addr);
+        nfd = hev_task_io_socket_accept (self->fd, (struct sockaddr *)&addr,
+                                         &alen, task_io_aborter, NULL);
+        if (nfd < 0)
+            break;
+        if (hev_socks5_worker_filter (self, nfd, &addr, alen) == 0)
+            hev_socks5_worker_spawn (self, nfd);
+    }
+}
+
+static void
+hev_socks5_worker_reject (HevSocks5Worker *self, int fd)
+{
+    static const unsigned char rep[] = { 0x05, 0xff };
+
+    /* No acceptable methods: the client gives up without a handshake. */
+    if (write (fd, rep, sizeof (rep)) < 0) {
+        /* ignore return value */
+    }
+
+    close (fd);
+    self->stats.session_rejects++;
+}
+
+static int
+hev_socks5_worker_accept (HevSocks5Worker *self, struct sockaddr_in6 *addr,
+                          socklen_t *alen)
+{
+    if (self->uring) {
+        *alen = 0;
+        return hev_uring_acceptor_accept (self->uring, task_io_yielder, self);
+    }
+
+    *alen = sizeof (*addr);
+    return hev_task_io_socket_accept (self->fd, (struct sockaddr *)addr, alen,
+                                      task_io_yielder, self);
 }
 
 static void
@@ -96,59 +519,183 @@ hev_socks5_worker_task_entry (void *data)
 {
     HevTask *task = hev_task_self ();
     HevSocks5Worker *self = data;
-    HevListNode *node;
-    int stack_size;
     int fd;
 
     LOG_D ("socks5 worker task run");
 
-    fd = self->fd;
+    if (hev_config_get_misc_io_uring ())
+        self->uring = hev_uring_acceptor_new (self->fd);
+
+    if (self->uring)
+        fd = hev_uring_acceptor_get_fd (self->uring);
+    else
+        fd = self->fd;
+
     hev_task_add_fd (task, fd, POLLIN);
-    stack_size = hev_config_get_misc_task_stack_size ();
 
     for (;;) {
-        HevSocks5Session *s;
-        HevTask *task;
+        struct sockaddr_in6 addr;
+        socklen_t alen;
         int nfd;
 
-        nfd = hev_task_io_socket_accept (fd, NULL, NULL, task_io_yielder, self);
+        if (!self->overload_reject && hev_socks5_worker_overloaded (self, 0)) {
+            if (hev_socks5_worker_pause (self, fd) < 0)
+                break;
+        }
+
+        nfd = hev_socks5_worker_accept (self, &addr, &alen);
         if (nfd == -1) {
-            LOG_E ("socks5 proxy accept");
+            if (hev_socks5_worker_accept_error (self, fd) < 0)
+                break;
             continue;
         } else if (nfd < 0) {
             break;
         }
 
-        s = hev_socks5_session_new (nfd);
-        if (!s) {
-            close (nfd);
-            continue;
+        if (self->accept_backoff) {
+            LOG_I ("socks5 proxy accept recovered");
+            self->accept_backoff = 0;
         }
 
-        task = hev_task_new (stack_size);
-        if (!task) {
-            hev_object_unref (HEV_OBJECT (s));
+        if (hev_socks5_worker_filter (self, nfd, &addr, alen) < 0)
+            continue;
+
+        if (self->overload_reject && hev_socks5_worker_overloaded (self, 0)) {
+            hev_socks5_worker_reject (self, nfd);
             continue;
         }
 
-        if (self->auth_curr)
-            hev_socks5_server_set_auth (HEV_SOCKS5_SERVER (s), self->auth_curr);
+        hev_socks5_worker_spawn (self, nfd);
 
-        s->task = task;
-        s->data = self;
-        hev_list_add_tail (&self->session_set, &s->node);
-        hev_task_run (task, hev_socks5_session_task_entry, s);
+        /* Let accepted sessions run before draining more connections. */
+        if (++self->accept_count >= self->accept_batch) {
+            if (task_io_yielder (HEV_TASK_YIELD, self) < 0)
+                break;
+        }
     }
 
-    node = hev_list_first (&self->session_set);
-    for (; node; node = hev_list_node_next (node)) {
-        HevSocks5Session *s;
+    hev_task_del_fd (task, fd);
 
-        s = container_of (node, HevSocks5Session, node);
-        hev_socks5_session_terminate (s);
+    if (self->drain)
+        hev_socks5_worker_flush (self);
+    else
+        hev_socks5_worker_terminate (self);
+
+    if (self->uring) {
+        hev_uring_acceptor_destroy (self->uring);
+        self->uring = NULL;
     }
 
-    hev_task_del_fd (task, fd);
+    if (self->drain) {
+        close (self->fd);
+        self->fd = -1;
+        self->drain = DRAIN_DONE;
+        hev_task_wakeup (self->task_event);
+    }
+}
+
+static void
+hev_socks5_timer_task_entry (void *data)
+{
+    HevSocks5Worker *self = data;
+
+    LOG_D ("socks5 timer task run");
+
+    while (READ_ONCE (self->run) || self->drain) {
+        HevTimerWheelNode *node;
+        int64_t now;
+
+        hev_task_sleep (TIMER_WHEEL_TICK);
+
+        /*
+         * The relay runs without a per-I/O timer. Expired sessions are
+         * checked for recent traffic on the client socket and re-armed
+         * for the rest of their idle time, or terminated.
+         */
+        now = get_monotonic_ms ();
+        while ((node = hev_timer_wheel_pop (&self->timer_wheel, now))) {
+            HevSocks5Session *s;
+            int idle;
+
+            s = container_of (node, HevSocks5Session, timer);
+
+            /* An unknown idle time is taken as activity, not as idle. */
+            idle = get_sock_idle_time (HEV_SOCKS5 (s)->fd);
+            if (idle < 0)
+                idle = 0;
+            if (idle < self->idle_timeout) {
+                hev_timer_wheel_add (&self->timer_wheel, node,
+                                     now + self->idle_timeout - idle);
+                continue;
+            }
+
+            LOG_D ("%p socks5 session idle timeout", s);
+            self->stats.session_timeouts++;
+            hev_socks5_session_terminate (s);
+        }
+    }
+}
+
+static void
+hev_socks5_user_task_entry (void *data)
+{
+    HevSocks5Worker *self = data;
+    int64_t acct_time;
+
+    LOG_D ("socks5 user task run");
+
+    acct_time = get_monotonic_ms () + self->acct_interval;
+
+    /*
+     * A user's rate is shared by its active TCP sessions on every worker.
+     * The shares follow the active count of the user on the next pass, so
+     * the kernel pacing holds the limit without any per-packet work here.
+     * Only sessions of users whose count changed are paced again.
+     *
+     * Live sessions are also sampled into the accounting shard once per
+     * stats interval, which is then merged into the user totals. The
+     * sample is also what marks paced sessions idle or active.
+     */
+    while (READ_ONCE (self->run) || self->drain) {
+        HevListNode *node;
+        int acct = 0;
+        int64_t now;
+
+        hev_task_sleep (PACE_INTERVAL);
+
+        now = get_monotonic_ms ();
+        if (self->acct && now >= acct_time) {
+            acct_time = now + self->acct_interval;
+            acct = 1;
+        }
+
+        node = hev_list_first (&self->session_set);
+        for (; node; node = hev_list_node_next (node)) {
+            HevSocks5Session *s;
+
+            s = container_of (node, HevSocks5Session, node);
+            hev_socks5_session_pace (s);
+            if (acct)
+                hev_socks5_session_account (s, self->acct, 0);
+        }
+
+        if (acct)
+            hev_user_acct_flush (self->acct);
+    }
+}
+
+static void
+hev_socks5_worker_sync (HevSocks5Worker *self)
+{
+    LOG_D ("%p socks5 worker sync", self);
+
+    pthread_mutex_lock (&gate_mutex);
+    if (self->gate_sync) {
+        self->gate_sync = 0;
+        if (--gate_waits == 0)
+            pthread_cond_broadcast (&gate_cond);
+    }
+    pthread_mutex_unlock (&gate_mutex);
 }
 
 static void
@@ -162,29 +709,44 @@ hev_socks5_event_task_entry (void *data)
 
     hev_task_add_fd (task, self->event_fds[0], POLLIN);
 
-    res = atomic_fetch_and (&self->tsync, ~SYNC_LOAD);
-    if (res & SYNC_LOAD)
-        hev_socks5_worker_load (self);
-
     for (;;) {
-        char val;
+        uint64_t val[8];
 
-        res = hev_task_io_read (self->event_fds[0], &val, sizeof (val), NULL,
-                                NULL);
-        if (res < sizeof (val))
-            continue;
-
-        if (val == 'r') {
-            atomic_fetch_and (&self->tsync, ~SYNC_SENT_R);
+        /* Events posted before the task started are handled here too. */
+        res = atomic_exchange (&self->events, 0);
+        if (res & EVENT_LOAD)
             hev_socks5_worker_load (self);
-        } else {
-            atomic_fetch_and (&self->tsync, ~SYNC_SENT_S);
+        if (res & EVENT_SYNC)
+            hev_socks5_worker_sync (self);
+        if (res & EVENT_STOP)
             break;
+
+        if ((res & EVENT_DRAIN) && !self->drain) {
+            LOG_D ("%p socks5 worker drain", self);
+            self->drain = DRAIN_WAIT;
+            WRITE_ONCE (self->run, 0);
+            hev_task_wakeup (self->task_worker);
         }
+
+        if (self->drain == DRAIN_DONE && !self->session_num)
+            break;
+
+        hev_task_io_read (self->event_fds[0], val, sizeof (val),
+                          event_io_yielder, self);
     }
 
     WRITE_ONCE (self->run, 0);
-    hev_task_wakeup (self->task_worker);
+
+    /* The worker task is gone after a drain, so end its sessions here. */
+    if (self->drain == DRAIN_DONE)
+        hev_socks5_worker_terminate (self);
+    else if (!self->drain)
+        hev_task_wakeup (self->task_worker);
+
+    self->drain = DRAIN_NONE;
+    if (self->task_timer)
+        hev_task_wakeup (self->task_timer);
+    hev_task_wakeup (self->task_user);
 
     hev_task_del_fd (task, self->event_fds[0]);
 }
@@ -206,12 +768,54 @@ hev_socks5_worker_new (int fd)
     self->event_fds[0] = -1;
     self->event_fds[1] = -1;
 
+    self->reserve_fd = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (self->reserve_fd < 0)
+        LOG_W ("socks5 worker reserve fd");
+
+    self->accept_batch = hev_config_get_misc_accept_batch ();
+    self->session_max = hev_config_get_misc_max_worker_sessions ();
+    self->session_max_all = hev_config_get_misc_max_sessions ();
+    self->overload_reject = hev_config_get_misc_overload_reject ();
+    self->stack_size = hev_config_get_misc_task_stack_size ();
+    self->task_pool_max = hev_config_get_misc_task_pool_size ();
+    self->task_pool_trim = get_monotonic_ms ();
+
+    if (self->task_pool_max > 0) {
+        self->task_pool = hev_malloc (sizeof (HevTask *) * self->task_pool_max);
+        if (!self->task_pool) {
+            LOG_E ("socks5 worker task pool");
+            goto exit;
+        }
+    }
+
+    res = hev_socks5_session_pool_init (&self->session_pool,
+                                        self->task_pool_max);
+    if (res < 0) {
+        LOG_E ("socks5 worker session pool");
+        goto exit;
+    }
+
+#if defined(__linux__)
+    res = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (res < 0) {
+        LOG_E ("socks5 worker eventfd");
+        goto exit;
+    }
+    self->event_fds[0] = res;
+#else
     res = socketpair (PF_LOCAL, SOCK_STREAM, 0, self->event_fds);
     if (res < 0) {
         LOG_E ("socks5 worker eventfd");
         goto exit;
     }
 
+    res = ioctl (self->event_fds[1], FIONBIO, (char *)&nonblock);
+    if (res < 0) {
+        LOG_E ("socks5 worker eventfd non-blocking");
+        goto exit;
+    }
+#endif
+
     res = ioctl (self->event_fds[0], FIONBIO, (char *)&nonblock);
     if (res < 0) {
         LOG_E ("socks5 worker eventfd non-blocking");
@@ -230,6 +834,31 @@ hev_socks5_worker_new (int fd)
         goto exit;
     }
 
+    self->task_user = hev_task_new (-1);
+    if (!self->task_user) {
+        LOG_E ("socks5 worker task user");
+        goto exit;
+    }
+
+    /* Accounting is only kept for the stats file. */
+    if (hev_config_get_misc_stats_file ()) {
+        self->acct_interval = hev_config_get_misc_stats_interval ();
+        self->acct = hev_user_acct_new ();
+        if (!self->acct) {
+            LOG_E ("socks5 worker user acct");
+            goto exit;
+        }
+    }
+
+    if (hev_config_get_misc_timer_wheel ()) {
+        self->idle_timeout = hev_config_get_misc_tcp_read_write_timeout ();
+        self->task_timer = hev_task_new (-1);
+        if (!self->task_timer) {
+            LOG_E ("socks5 worker task timer");
+            goto exit;
+        }
+    }
+
     self->fd = fd;
     atomic_fetch_or (&self->tsync, SYNC_SEND);
 
@@ -243,26 +872,46 @@ exit:
 void
 hev_socks5_worker_destroy (HevSocks5Worker *self)
 {
+    int res;
+
     LOG_D ("%p works worker destroy", self);
 
-retry:
-    if (atomic_fetch_and (&self->tsync, ~SYNC_SEND) & SYNC_WAIT) {
-        usleep (500);
-        goto retry;
-    }
+    /* Close the channel and sleep until in-flight senders are done. */
+    atomic_fetch_and (&self->tsync, ~SYNC_SEND);
+    while ((res = atomic_load (&self->tsync)))
+        futex_wait (&self->tsync, res);
+
+    hev_socks5_worker_exit (self);
 
     if (self->auth_curr)
         hev_object_unref (HEV_OBJECT (self->auth_curr));
     if (self->auth_next)
         hev_object_unref (HEV_OBJECT (self->auth_next));
 
+    if (self->task_pool) {
+        int i;
+
+        for (i = 0; i < self->task_pool_num; i++)
+            hev_task_unref (self->task_pool[i]);
+        hev_free (self->task_pool);
+    }
+    hev_socks5_session_pool_fini (&self->session_pool);
+
     if (self->task_worker)
         hev_task_unref (self->task_worker);
     if (self->task_event)
         hev_task_unref (self->task_event);
+    if (self->task_timer)
+        hev_task_unref (self->task_timer);
+    if (self->task_user)
+        hev_task_unref (self->task_user);
+    if (self->acct)
+        hev_user_acct_destroy (self->acct);
 
     if (self->fd >= 0)
         close (self->fd);
+    if (self->reserve_fd >= 0)
+        close (self->reserve_fd);
     if (self->event_fds[0] >= 0)
         close (self->event_fds[0]);
     if (self->event_fds[1] >= 0)
@@ -276,54 +925,87 @@ hev_socks5_worker_start (HevSocks5Worker *self)
 {
     LOG_D ("%p works worker start", self);
 
-    if (atomic_fetch_and (&self->tsync, ~SYNC_STOP) & SYNC_STOP)
+    if (atomic_load (&self->events) & EVENT_STOP)
         return;
 
+    pthread_mutex_lock (&gate_mutex);
+    hev_list_add_tail (&gate_list, &self->gate_node);
+    self->gate_in = 1;
+    pthread_mutex_unlock (&gate_mutex);
+
     WRITE_ONCE (self->run, 1);
     hev_task_ref (self->task_event);
     hev_task_run (self->task_event, hev_socks5_event_task_entry, self);
+    if (self->task_timer) {
+        hev_timer_wheel_init (&self->timer_wheel, TIMER_WHEEL_TICK,
+                              get_monotonic_ms ());
+        hev_task_ref (self->task_timer);
+        hev_task_run (self->task_timer, hev_socks5_timer_task_entry, self);
+    }
+    hev_task_ref (self->task_user);
+    hev_task_run (self->task_user, hev_socks5_user_task_entry, self);
     hev_task_ref (self->task_worker);
     hev_task_run (self->task_worker, hev_socks5_worker_task_entry, self);
 }
 
+void
+hev_socks5_worker_exit (HevSocks5Worker *self)
+{
+    LOG_D ("%p works worker exit", self);
+
+    pthread_mutex_lock (&gate_mutex);
+    if (self->gate_in) {
+        hev_list_del (&gate_list, &self->gate_node);
+        self->gate_in = 0;
+    }
+    if (self->gate_sync) {
+        self->gate_sync = 0;
+        if (--gate_waits == 0)
+            pthread_cond_broadcast (&gate_cond);
+    }
+    pthread_mutex_unlock (&gate_mutex);
+}
+
+static void
+hev_socks5_worker_notify (HevSocks5Worker *self)
+{
+    int fd = self->event_fds[0];
+    int res;
+
+#if defined(__linux__)
+    uint64_t val = 1;
+#else
+    char val = 'e';
+
+    fd = self->event_fds[1];
+#endif
+
+    res = write (fd, &val, sizeof (val));
+    assert (res > 0 && "socks5 worker write event");
+    (void)res;
+}
+
+/*
+ * Events are a bounded queue of one slot per type, so repeated reloads
+ * coalesce. Only the sender that fills an empty queue rings the doorbell.
+ * This runs from signal handlers, hence atomics and write(2) only.
+ */
 static void
 hev_socks5_worker_send (HevSocks5Worker *self, int type)
 {
-    char val;
-    int sent;
     int res;
 
-    switch (type) {
-    case SYNC_STOP:
-        sent = SYNC_SENT_S;
-        val = 's';
-        break;
-    case SYNC_LOAD:
-        sent = SYNC_SENT_R;
-        val = 'r';
-        break;
-    default:
+    res = atomic_fetch_or (&self->events, type);
+    if (res)
         return;
-    }
 
-retry:
-    res = atomic_fetch_or (&self->tsync, SYNC_WAIT);
-    if (res & SYNC_WAIT) {
-        usleep (500);
-        goto retry;
-    }
+    res = atomic_fetch_add (&self->tsync, SYNC_BUSY);
+    if (res & SYNC_SEND)
+        hev_socks5_worker_notify (self);
 
-    if (res & SYNC_SEND) {
-        res = atomic_fetch_or (&self->tsync, sent);
-        if (!(res & sent)) {
-            res = write (self->event_fds[1], &val, sizeof (val));
-            assert (res > 0 && "socks5 worker write event");
-        }
-    } else {
-        atomic_fetch_or (&self->tsync, type);
-    }
-
-    atomic_fetch_and (&self->tsync, ~SYNC_WAIT);
+    /* The last sender out of a closed channel wakes the destructor. */
+    if (atomic_fetch_sub (&self->tsync, SYNC_BUSY) == SYNC_BUSY)
+        futex_wake (&self->tsync);
 }
 
 void
@@ -331,7 +1013,15 @@ hev_socks5_worker_stop (HevSocks5Worker *self)
 {
     LOG_D ("%p works worker stop", self);
 
-    hev_socks5_worker_send (self, SYNC_STOP);
+    hev_socks5_worker_send (self, EVENT_STOP);
+}
+
+void
+hev_socks5_worker_drain (HevSocks5Worker *self)
+{
+    LOG_D ("%p works worker drain", self);
+
+    hev_socks5_worker_send (self, EVENT_DRAIN);
 }
 
 void
@@ -339,7 +1029,42 @@ hev_socks5_worker_reload (HevSocks5Worker *self)
 {
     LOG_D ("%p works worker reload", self);
 
-    hev_socks5_worker_send (self, SYNC_LOAD);
+    hev_socks5_worker_send (self, EVENT_LOAD);
+}
+
+void
+hev_socks5_worker_synchronize (void)
+{
+    HevListNode *node;
+
+    LOG_D ("socks5 worker synchronize");
+
+    pthread_mutex_lock (&gate_mutex);
+    node = hev_list_first (&gate_list);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5Worker *worker;
+
+        worker = container_of (node, HevSocks5Worker, gate_node);
+        if (!worker->gate_sync) {
+            worker->gate_sync = 1;
+            gate_waits++;
+        }
+        hev_socks5_worker_send (worker, EVENT_SYNC);
+    }
+    while (gate_waits)
+        pthread_cond_wait (&gate_cond, &gate_mutex);
+    pthread_mutex_unlock (&gate_mutex);
+}
+
+HevSourceAcl *
+hev_socks5_worker_set_source_acl (HevSourceAcl *acl)
+{
+    atomic_intptr_t *ptr = (atomic_intptr_t *)&source_acl;
+
+    LOG_D ("socks5 worker set source acl");
+
+    return (HevSourceAcl *)atomic_exchange_explicit (ptr, (intptr_t)acl,
+                                                     memory_order_acq_rel);
 }
 
 void
@@ -361,3 +1086,27 @@ hev_socks5_worker_set_auth (HevSocks5Worker *self, HevSocks5Authenticator *auth)
     if (prev)
         hev_object_unref (HEV_OBJECT (prev));
 }
+
+void
+hev_socks5_worker_get_stats (HevSocks5Worker *self,
+                             HevSocks5WorkerStats *stats)
+{
+    stats->task_pool_hits = READ_ONCE (self->stats.task_pool_hits);
+    stats->task_pool_misses = READ_ONCE (self->stats.task_pool_misses);
+    stats->task_pool_trims = READ_ONCE (self->stats.task_pool_trims);
+    stats->session_pool_hits = READ_ONCE (self->session_pool.hits);
+    stats->session_pool_misses = READ_ONCE (self->session_pool.misses);
+    stats->session_pool_trims = READ_ONCE (self->session_pool.trims);
+    stats->accept_pauses = READ_ONCE (self->stats.accept_pauses);
+    stats->session_rejects = READ_ONCE (self->stats.session_rejects);
+    stats->accept_errors = READ_ONCE (self->stats.accept_errors);
+    stats->accept_drops = READ_ONCE (self->stats.accept_drops);
+    stats->session_timeouts = READ_ONCE (self->stats.session_timeouts);
+    stats->acl_drops = READ_ONCE (self->stats.acl_drops);
+    stats->acl_denies = READ_ONCE (self->stats.acl_denies);
+
+    memset (&stats->connect_setup, 0, sizeof (HevHistogram));
+    memset (&stats->connect_bind, 0, sizeof (HevHistogram));
+    hev_histogram_read (&self->stats.connect_setup, &stats->connect_setup);
+    hev_histogram_read (&self->stats.connect_bind, &stats->connect_bind);
+}
@@ -12,16 +12,49 @@
 
 #include <hev-socks5-authenticator.h>
 
+#include "hev-histogram.h"
+#include "hev-source-acl.h"
+
 typedef struct _HevSocks5Worker HevSocks5Worker;
+typedef struct _HevSocks5WorkerStats HevSocks5WorkerStats;
+
+struct _HevSocks5WorkerStats
+{
+    unsigned long task_pool_hits;
+    unsigned long task_pool_misses;
+    unsigned long task_pool_trims;
+    unsigned long session_pool_hits;
+    unsigned long session_pool_misses;
+    unsigned long session_pool_trims;
+    unsigned long accept_pauses;
+    unsigned long session_rejects;
+    unsigned long accept_errors;
+    unsigned long accept_drops;
+    unsigned long session_timeouts;
+    unsigned long acl_drops;
+    unsigned long acl_denies;
+
+    /* Microseconds from accept, and in the binder, to an outbound socket. */
+    HevHistogram connect_setup;
+    HevHistogram connect_bind;
+};
 
 HevSocks5Worker *hev_socks5_worker_new (int fd);
 void hev_socks5_worker_destroy (HevSocks5Worker *self);
 
 void hev_socks5_worker_start (HevSocks5Worker *self);
+void hev_socks5_worker_exit (HevSocks5Worker *self);
 void hev_socks5_worker_stop (HevSocks5Worker *self);
 void hev_socks5_worker_reload (HevSocks5Worker *self);
+void hev_socks5_worker_drain (HevSocks5Worker *self);
 
+void hev_socks5_worker_synchronize (void);
+
+HevSourceAcl *hev_socks5_worker_set_source_acl (HevSourceAcl *acl);
 void hev_socks5_worker_set_auth (HevSocks5Worker *self,
                                  HevSocks5Authenticator *auth);
 
+void hev_socks5_worker_get_stats (HevSocks5Worker *self,
+                                  HevSocks5WorkerStats *stats);
+
 #endif /* __HEV_SOCKS5_WORKER_H__ */
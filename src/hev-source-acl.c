@@ -0,0 +1,149 @@
+/*
+ ============================================================================
+ Name        : hev-source-acl.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Client Source Address ACL
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-cidr-trie.h"
+
+#include "hev-source-acl.h"
+
+enum
+{
+    ACL_ALLOW = 0,
+    ACL_DENY = 1,
+};
+
+struct _HevSourceAcl
+{
+    HevCidrTrie trie;
+};
+
+static int
+hev_source_acl_parse (HevSourceAcl *self, char *line, unsigned int lineno)
+{
+    const char *sep = " \t\r\n";
+    unsigned int plen;
+    uint8_t addr[16];
+    char *action;
+    char *cidr;
+    char *save;
+    int value;
+
+    action = strtok_r (line, sep, &save);
+    if (!action || action[0] == '#')
+        return 0;
+
+    if (strcmp (action, "allow") == 0)
+        value = ACL_ALLOW;
+    else if (strcmp (action, "deny") == 0)
+        value = ACL_DENY;
+    else
+        goto error;
+
+    cidr = strtok_r (NULL, sep, &save);
+    if (!cidr || strtok_r (NULL, sep, &save))
+        goto error;
+
+    if (hev_cidr_trie_parse (cidr, strlen (cidr), addr, &plen) < 0)
+        goto error;
+
+    if (hev_cidr_trie_insert (&self->trie, addr, plen, value) < 0) {
+        LOG_E ("source acl insert");
+        return -1;
+    }
+
+    return 0;
+
+error:
+    LOG_E ("source acl line %u format", lineno);
+    return -1;
+}
+
+HevSourceAcl *
+hev_source_acl_new (const char *path)
+{
+    HevSourceAcl *self;
+    unsigned int lineno = 0;
+    char line[256];
+    FILE *fp;
+
+    fp = fopen (path, "r");
+    if (!fp)
+        return NULL;
+
+    self = hev_malloc0 (sizeof (HevSourceAcl));
+    if (!self) {
+        fclose (fp);
+        return NULL;
+    }
+
+    LOG_D ("%p source acl new", self);
+
+    hev_cidr_trie_init (&self->trie);
+
+    while (fgets (line, sizeof (line), fp)) {
+        if (hev_source_acl_parse (self, line, ++lineno) < 0) {
+            fclose (fp);
+            hev_source_acl_destroy (self);
+            return NULL;
+        }
+    }
+    fclose (fp);
+
+    hev_cidr_trie_seal (&self->trie);
+
+    LOG_I ("source acl %s loaded, %u nodes", path, self->trie.num);
+
+    return self;
+}
+
+void
+hev_source_acl_destroy (HevSourceAcl *self)
+{
+    LOG_D ("%p source acl destroy", self);
+
+    hev_cidr_trie_fini (&self->trie);
+    hev_free (self);
+}
+
+int
+hev_source_acl_check (HevSourceAcl *self, const struct sockaddr *addr)
+{
+    uint8_t key[16];
+
+    switch (addr->sa_family) {
+    case AF_INET: {
+        const struct sockaddr_in *sa = (const struct sockaddr_in *)addr;
+
+        memset (key, 0, 10);
+        key[10] = 0xff;
+        key[11] = 0xff;
+        memcpy (&key[12], &sa->sin_addr, 4);
+        break;
+    }
+    case AF_INET6: {
+        const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *)addr;
+
+        memcpy (key, &sa->sin6_addr, 16);
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    if (hev_cidr_trie_lookup (&self->trie, key) == ACL_DENY)
+        return -1;
+
+    return 0;
+}
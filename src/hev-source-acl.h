@@ -0,0 +1,54 @@
+/*
+ ============================================================================
+ Name        : hev-source-acl.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Client Source Address ACL
+ ============================================================================
+ */
+
+#ifndef __HEV_SOURCE_ACL_H__
+#define __HEV_SOURCE_ACL_H__
+
+#include <sys/socket.h>
+
+typedef struct _HevSourceAcl HevSourceAcl;
+
+/**
+ * hev_source_acl_new:
+ * @path: rules file path
+ *
+ * Load and compile a rules file. Each line is `allow CIDR` or `deny CIDR`,
+ * the longest matching prefix wins and unmatched addresses are allowed.
+ * The result is immutable.
+ *
+ * Returns: returns source acl on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevSourceAcl *hev_source_acl_new (const char *path);
+
+/**
+ * hev_source_acl_destroy:
+ * @self: a #HevSourceAcl
+ *
+ * Destroy the acl.
+ *
+ * Since: 2.14
+ */
+void hev_source_acl_destroy (HevSourceAcl *self);
+
+/**
+ * hev_source_acl_check:
+ * @self: a #HevSourceAcl
+ * @addr: an IPv4 or IPv6 socket address
+ *
+ * Check a client address.
+ *
+ * Returns: returns zero if allowed, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_source_acl_check (HevSourceAcl *self, const struct sockaddr *addr);
+
+#endif /* __HEV_SOURCE_ACL_H__ */
@@ -0,0 +1,418 @@
+/*
+ ============================================================================
+ Name        : hev-uring-acceptor.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : io_uring Acceptor
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ENABLE_IO_URING
+#endif
+#endif
+
+#ifdef ENABLE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-uring-acceptor.h"
+
+#ifdef ENABLE_IO_URING
+
+#ifndef IORING_ACCEPT_MULTISHOT
+#define IORING_ACCEPT_MULTISHOT (1U << 0)
+#endif
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+#ifndef IORING_SQ_CQ_OVERFLOW
+#define IORING_SQ_CQ_OVERFLOW (1U << 1)
+#endif
+
+#define RING_ENTRIES (4)
+#define RING_CQ_ENTRIES (256)
+
+enum
+{
+    URING_ACCEPT = 1,
+    URING_CANCEL = 2,
+};
+
+struct _HevUringAcceptor
+{
+    int fd;
+    int ring_fd;
+    int armed;
+    int multishot;
+
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_flags;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+};
+
+static int
+io_uring_setup (unsigned int entries, struct io_uring_params *p)
+{
+    return syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete,
+                unsigned int flags)
+{
+    return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                    NULL, 0);
+}
+
+static int
+hev_uring_acceptor_map (HevUringAcceptor *self, struct io_uring_params *p)
+{
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_POPULATE;
+
+    self->sq_len = p->sq_off.array + p->sq_entries * sizeof (unsigned int);
+    self->cq_len = p->cq_off.cqes;
+    self->cq_len += p->cq_entries * sizeof (struct io_uring_cqe);
+    self->sqes_len = p->sq_entries * sizeof (struct io_uring_sqe);
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (self->cq_len > self->sq_len)
+            self->sq_len = self->cq_len;
+        self->cq_len = 0;
+    }
+
+    self->sq_ptr = mmap (NULL, self->sq_len, prot, flags, self->ring_fd,
+                         IORING_OFF_SQ_RING);
+    if (self->sq_ptr == MAP_FAILED) {
+        self->sq_ptr = NULL;
+        return -1;
+    }
+
+    if (self->cq_len) {
+        self->cq_ptr = mmap (NULL, self->cq_len, prot, flags, self->ring_fd,
+                             IORING_OFF_CQ_RING);
+        if (self->cq_ptr == MAP_FAILED) {
+            self->cq_ptr = NULL;
+            return -1;
+        }
+    }
+
+    self->sqes = mmap (NULL, self->sqes_len, prot, flags, self->ring_fd,
+                       IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED) {
+        self->sqes = NULL;
+        return -1;
+    }
+
+    self->sq_tail = self->sq_ptr + p->sq_off.tail;
+    self->sq_mask = self->sq_ptr + p->sq_off.ring_mask;
+    self->sq_flags = self->sq_ptr + p->sq_off.flags;
+    self->sq_array = self->sq_ptr + p->sq_off.array;
+
+    if (self->cq_ptr) {
+        self->cq_head = self->cq_ptr + p->cq_off.head;
+        self->cq_tail = self->cq_ptr + p->cq_off.tail;
+        self->cq_mask = self->cq_ptr + p->cq_off.ring_mask;
+        self->cqes = self->cq_ptr + p->cq_off.cqes;
+    } else {
+        self->cq_head = self->sq_ptr + p->cq_off.head;
+        self->cq_tail = self->sq_ptr + p->cq_off.tail;
+        self->cq_mask = self->sq_ptr + p->cq_off.ring_mask;
+        self->cqes = self->sq_ptr + p->cq_off.cqes;
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe *
+hev_uring_acceptor_get_sqe (HevUringAcceptor *self)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+
+    idx = *self->sq_tail & *self->sq_mask;
+    sqe = &self->sqes[idx];
+    self->sq_array[idx] = idx;
+    memset (sqe, 0, sizeof (*sqe));
+
+    return sqe;
+}
+
+static int
+hev_uring_acceptor_commit (HevUringAcceptor *self)
+{
+    unsigned int tail = *self->sq_tail;
+
+    atomic_store_explicit ((atomic_uint *)self->sq_tail, tail + 1,
+                           memory_order_release);
+
+    return io_uring_enter (self->ring_fd, 1, 0, 0);
+}
+
+static int
+hev_uring_acceptor_submit (HevUringAcceptor *self)
+{
+    struct io_uring_sqe *sqe;
+    int res;
+
+    sqe = hev_uring_acceptor_get_sqe (self);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = self->fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = URING_ACCEPT;
+    if (self->multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+
+    res = hev_uring_acceptor_commit (self);
+    if (res < 0)
+        return -1;
+
+    self->armed = 1;
+    return 0;
+}
+
+HevUringAcceptor *
+hev_uring_acceptor_new (int fd)
+{
+    struct io_uring_params params;
+    HevUringAcceptor *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevUringAcceptor));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p uring acceptor new", self);
+
+    memset (&params, 0, sizeof (params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = RING_CQ_ENTRIES;
+    self->ring_fd = io_uring_setup (RING_ENTRIES, &params);
+    if (self->ring_fd < 0) {
+        LOG_W ("%p uring acceptor setup", self);
+        hev_free (self);
+        return NULL;
+    }
+
+    res = hev_uring_acceptor_map (self, &params);
+    if (res < 0) {
+        LOG_W ("%p uring acceptor map", self);
+        hev_uring_acceptor_destroy (self);
+        return NULL;
+    }
+
+    self->fd = fd;
+    self->multishot = 1;
+
+    res = hev_uring_acceptor_submit (self);
+    if (res < 0) {
+        LOG_W ("%p uring acceptor submit", self);
+        hev_uring_acceptor_destroy (self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void
+hev_uring_acceptor_destroy (HevUringAcceptor *self)
+{
+    LOG_D ("%p uring acceptor destroy", self);
+
+    if (self->sqes)
+        munmap (self->sqes, self->sqes_len);
+    if (self->cq_ptr)
+        munmap (self->cq_ptr, self->cq_len);
+    if (self->sq_ptr)
+        munmap (self->sq_ptr, self->sq_len);
+
+    close (self->ring_fd);
+    hev_free (self);
+}
+
+int
+hev_uring_acceptor_get_fd (HevUringAcceptor *self)
+{
+    return self->ring_fd;
+}
+
+void
+hev_uring_acceptor_pause (HevUringAcceptor *self)
+{
+    struct io_uring_sqe *sqe;
+
+    LOG_D ("%p uring acceptor pause", self);
+
+    if (!self->armed)
+        return;
+
+    /*
+     * Stop the kernel from accepting on our behalf. Connections already
+     * completed stay in the ring and are returned after resuming.
+     */
+    sqe = hev_uring_acceptor_get_sqe (self);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = URING_ACCEPT;
+    sqe->user_data = URING_CANCEL;
+
+    if (hev_uring_acceptor_commit (self) < 0)
+        LOG_W ("%p uring acceptor cancel", self);
+}
+
+static int
+hev_uring_acceptor_reap (HevUringAcceptor *self)
+{
+    for (;;) {
+        struct io_uring_cqe *cqe;
+        unsigned int head;
+        unsigned int tail;
+        __u64 user_data;
+        int res;
+
+        head = *self->cq_head;
+        tail = atomic_load_explicit ((atomic_uint *)self->cq_tail,
+                                     memory_order_acquire);
+
+        if (head == tail) {
+            if (!(atomic_load_explicit ((atomic_uint *)self->sq_flags,
+                                        memory_order_relaxed) &
+                  IORING_SQ_CQ_OVERFLOW))
+                return -2;
+
+            io_uring_enter (self->ring_fd, 0, 0, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        cqe = &self->cqes[head & *self->cq_mask];
+        user_data = cqe->user_data;
+        res = cqe->res;
+        if (user_data == URING_ACCEPT && !(cqe->flags & IORING_CQE_F_MORE))
+            self->armed = 0;
+
+        atomic_store_explicit ((atomic_uint *)self->cq_head, head + 1,
+                               memory_order_release);
+
+        if (user_data != URING_ACCEPT || res == -ECANCELED)
+            continue;
+
+        if (res >= 0)
+            return res;
+
+        if (res == -EINVAL && self->multishot) {
+            LOG_I ("%p uring acceptor multishot unsupported", self);
+            self->multishot = 0;
+            continue;
+        }
+
+        errno = -res;
+        return -1;
+    }
+}
+
+int
+hev_uring_acceptor_accept (HevUringAcceptor *self, HevTaskIOYielder yielder,
+                           void *yielder_data)
+{
+    for (;;) {
+        int res;
+
+        res = hev_uring_acceptor_reap (self);
+        if (res != -2)
+            return res;
+
+        if (!self->armed) {
+            res = hev_uring_acceptor_submit (self);
+            if (res < 0)
+                return -1;
+            continue;
+        }
+
+        if (yielder) {
+            if (yielder (HEV_TASK_WAITIO, yielder_data))
+                return -2;
+        } else {
+            hev_task_yield (HEV_TASK_WAITIO);
+        }
+    }
+}
+
+int
+hev_uring_acceptor_flush (HevUringAcceptor *self)
+{
+    int res;
+
+    /* Hand out connections the kernel already accepted, never re-arm. */
+    do {
+        res = hev_uring_acceptor_reap (self);
+    } while (res == -1);
+
+    return res < 0 ? -1 : res;
+}
+
+#else /* ENABLE_IO_URING */
+
+HevUringAcceptor *
+hev_uring_acceptor_new (int fd)
+{
+    return NULL;
+}
+
+void
+hev_uring_acceptor_destroy (HevUringAcceptor *self)
+{
+}
+
+int
+hev_uring_acceptor_get_fd (HevUringAcceptor *self)
+{
+    return -1;
+}
+
+void
+hev_uring_acceptor_pause (HevUringAcceptor *self)
+{
+}
+
+int
+hev_uring_acceptor_accept (HevUringAcceptor *self, HevTaskIOYielder yielder,
+                           void *yielder_data)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+hev_uring_acceptor_flush (HevUringAcceptor *self)
+{
+    return -1;
+}
+
+#endif /* !ENABLE_IO_URING */
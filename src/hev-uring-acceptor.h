@@ -0,0 +1,28 @@
+/*
+ ============================================================================
+ Name        : hev-uring-acceptor.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : io_uring Acceptor
+ ============================================================================
+ */
+
+#ifndef __HEV_URING_ACCEPTOR_H__
+#define __HEV_URING_ACCEPTOR_H__
+
+#include <hev-task-io.h>
+
+typedef struct _HevUringAcceptor HevUringAcceptor;
+
+HevUringAcceptor *hev_uring_acceptor_new (int fd);
+void hev_uring_acceptor_destroy (HevUringAcceptor *self);
+
+int hev_uring_acceptor_get_fd (HevUringAcceptor *self);
+
+void hev_uring_acceptor_pause (HevUringAcceptor *self);
+
+int hev_uring_acceptor_accept (HevUringAcceptor *self, HevTaskIOYielder yielder,
+                               void *yielder_data);
+int hev_uring_acceptor_flush (HevUringAcceptor *self);
+
+#endif /* __HEV_URING_ACCEPTOR_H__ */
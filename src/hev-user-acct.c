@@ -0,0 +1,319 @@
+/*
+ ============================================================================
+ Name        : hev-user-acct.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : User Accounting
+ ============================================================================
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#if defined(__linux__)
+#include <linux/tcp.h>
+#endif
+
+#include <hev-memory-allocator.h>
+
+#include "hev-misc.h"
+#include "hev-logger.h"
+
+#include "hev-user-acct.h"
+
+#define USER_ACCT_MIN_SIZE (64)
+
+typedef struct _HevUserAcctEntry HevUserAcctEntry;
+typedef struct _HevUserAcctDump HevUserAcctDump;
+
+struct _HevUserAcctEntry
+{
+    /* a user pointer, or a mark plus one, 0: empty */
+    uint64_t key;
+    uint64_t bytes_up;
+    uint64_t bytes_down;
+    uint64_t sessions;
+    uint64_t session_msecs;
+};
+
+struct _HevUserAcct
+{
+    unsigned int num;
+    unsigned int max;
+    HevUserAcctEntry *entries;
+};
+
+struct _HevUserAcctDump
+{
+    FILE *fp;
+    HevUserAcct marks;
+};
+
+static unsigned int
+hash_key (uint64_t key)
+{
+    return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static int
+hev_user_acct_grow (HevUserAcct *self)
+{
+    HevUserAcctEntry *entries;
+    unsigned int max;
+    unsigned int i;
+
+    max = self->max ? self->max * 2 : USER_ACCT_MIN_SIZE;
+    entries = hev_malloc0 (sizeof (HevUserAcctEntry) * max);
+    if (!entries)
+        return -1;
+
+    for (i = 0; i < self->max; i++) {
+        HevUserAcctEntry *e = &self->entries[i];
+        unsigned int j;
+
+        if (!e->key)
+            continue;
+
+        j = hash_key (e->key) & (max - 1);
+        while (entries[j].key)
+            j = (j + 1) & (max - 1);
+        entries[j] = *e;
+    }
+
+    hev_free (self->entries);
+    self->entries = entries;
+    self->max = max;
+
+    return 0;
+}
+
+static HevUserAcctEntry *
+hev_user_acct_lookup (HevUserAcct *self, uint64_t key, int *added)
+{
+    unsigned int i;
+
+    /* Kept at most half full, probes stay short. */
+    if (((self->num + 1) * 2) > self->max) {
+        if (hev_user_acct_grow (self) < 0) {
+            LOG_E ("user acct grow");
+            return NULL;
+        }
+    }
+
+    i = hash_key (key) & (self->max - 1);
+    for (;; i = (i + 1) & (self->max - 1)) {
+        HevUserAcctEntry *e = &self->entries[i];
+
+        if (e->key == key) {
+            *added = 0;
+            return e;
+        }
+
+        if (!e->key) {
+            e->key = key;
+            self->num++;
+            *added = 1;
+            return e;
+        }
+    }
+}
+
+HevUserAcct *
+hev_user_acct_new (void)
+{
+    HevUserAcct *self;
+
+    self = hev_malloc0 (sizeof (HevUserAcct));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p user acct new", self);
+
+    return self;
+}
+
+void
+hev_user_acct_destroy (HevUserAcct *self)
+{
+    LOG_D ("%p user acct destroy", self);
+
+    hev_user_acct_flush (self);
+    hev_free (self->entries);
+    hev_free (self);
+}
+
+void
+hev_user_acct_meter_init (HevUserAcctMeter *meter)
+{
+    meter->bytes_up = 0;
+    meter->bytes_down = 0;
+    meter->time = get_monotonic_ms ();
+}
+
+int
+hev_user_acct_sample (HevUserAcct *self, HevSocks5UserMark *user,
+                      HevUserAcctMeter *meter, int fd, int done)
+{
+    uint64_t down = meter->bytes_down;
+    uint64_t up = meter->bytes_up;
+    HevUserAcctEntry *e;
+    int64_t now;
+    int added;
+    int moved;
+
+#if defined(__linux__)
+    if (fd >= 0) {
+        struct tcp_info info;
+        socklen_t len = sizeof (info);
+        socklen_t need;
+        int res;
+
+        /* Received from the client is upload, acked by it is download. */
+        need = offsetof (struct tcp_info, tcpi_bytes_received);
+        need += sizeof (info.tcpi_bytes_received);
+        res = getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+        if (res == 0 && len >= need) {
+            up = info.tcpi_bytes_received;
+            down = info.tcpi_bytes_acked;
+        }
+    }
+#endif
+
+    moved = (up != meter->bytes_up) || (down != meter->bytes_down);
+
+    e = hev_user_acct_lookup (self, (uintptr_t)user, &added);
+    if (!e)
+        return moved;
+
+    /* The shard holds the user until it is flushed. */
+    if (added)
+        hev_object_ref (HEV_OBJECT (user));
+
+    now = get_monotonic_ms ();
+    e->bytes_up += up - meter->bytes_up;
+    e->bytes_down += down - meter->bytes_down;
+    e->session_msecs += now - meter->time;
+    e->sessions += !!done;
+
+    meter->bytes_up = up;
+    meter->bytes_down = down;
+    meter->time = now;
+
+    return moved;
+}
+
+void
+hev_user_acct_flush (HevUserAcct *self)
+{
+    unsigned int i;
+
+    if (!self->num)
+        return;
+
+    for (i = 0; i < self->max; i++) {
+        HevUserAcctEntry *e = &self->entries[i];
+        HevSocks5UserMark *user;
+        HevSocks5UserStats *s;
+
+        if (!e->key)
+            continue;
+
+        user = (HevSocks5UserMark *)(uintptr_t)e->key;
+        s = &user->stats;
+        atomic_fetch_add_explicit (&s->bytes_up, e->bytes_up,
+                                   memory_order_relaxed);
+        atomic_fetch_add_explicit (&s->bytes_down, e->bytes_down,
+                                   memory_order_relaxed);
+        atomic_fetch_add_explicit (&s->sessions, e->sessions,
+                                   memory_order_relaxed);
+        atomic_fetch_add_explicit (&s->session_msecs, e->session_msecs,
+                                   memory_order_relaxed);
+        hev_object_unref (HEV_OBJECT (user));
+    }
+
+    memset (self->entries, 0, sizeof (HevUserAcctEntry) * self->max);
+    self->num = 0;
+}
+
+static void
+hev_user_acct_write (FILE *fp, const char *prefix, HevUserAcctEntry *e)
+{
+    fprintf (fp, "%s.bytes-up %llu\n", prefix,
+             (unsigned long long)e->bytes_up);
+    fprintf (fp, "%s.bytes-down %llu\n", prefix,
+             (unsigned long long)e->bytes_down);
+    fprintf (fp, "%s.sessions %llu\n", prefix,
+             (unsigned long long)e->sessions);
+    fprintf (fp, "%s.session-msecs %llu\n", prefix,
+             (unsigned long long)e->session_msecs);
+}
+
+static void
+hev_user_acct_dump_user (HevSocks5UserMark *user, void *data)
+{
+    HevSocks5User *base = HEV_SOCKS5_USER (user);
+    HevSocks5UserStats *s = &user->stats;
+    HevUserAcctDump *dump = data;
+    HevUserAcctEntry total;
+    HevUserAcctEntry *e;
+    unsigned long rejects;
+    unsigned int active;
+    char prefix[256 + 8];
+    int added;
+
+    total.bytes_up = atomic_load_explicit (&s->bytes_up, memory_order_relaxed);
+    total.bytes_down =
+        atomic_load_explicit (&s->bytes_down, memory_order_relaxed);
+    total.sessions = atomic_load_explicit (&s->sessions, memory_order_relaxed);
+    total.session_msecs =
+        atomic_load_explicit (&s->session_msecs, memory_order_relaxed);
+    rejects = atomic_load_explicit (&s->session_rejects, memory_order_relaxed);
+    active = atomic_load_explicit (&user->sessions, memory_order_relaxed);
+
+    /* Idle users are left out, the list may be millions long. */
+    if (!total.bytes_up && !total.bytes_down && !total.sessions &&
+        !total.session_msecs && !rejects && !active)
+        return;
+
+    snprintf (prefix, sizeof (prefix), "user.%.*s", base->name_len,
+              base->name);
+    hev_user_acct_write (dump->fp, prefix, &total);
+    fprintf (dump->fp, "%s.sessions-active %u\n", prefix, active);
+    fprintf (dump->fp, "%s.session-rejects %lu\n", prefix, rejects);
+
+    e = hev_user_acct_lookup (&dump->marks, (uint64_t)user->mark + 1, &added);
+    if (!e)
+        return;
+
+    e->bytes_up += total.bytes_up;
+    e->bytes_down += total.bytes_down;
+    e->sessions += total.sessions;
+    e->session_msecs += total.session_msecs;
+}
+
+void
+hev_user_acct_dump (FILE *fp, HevAuthFile *file)
+{
+    HevUserAcctDump dump = { 0 };
+    unsigned int i;
+
+    dump.fp = fp;
+    hev_auth_file_foreach (file, hev_user_acct_dump_user, &dump);
+
+    for (i = 0; i < dump.marks.max; i++) {
+        HevUserAcctEntry *e = &dump.marks.entries[i];
+        char prefix[32];
+
+        if (!e->key)
+            continue;
+
+        snprintf (prefix, sizeof (prefix), "mark.%x",
+                  (unsigned int)(e->key - 1));
+        hev_user_acct_write (fp, prefix, e);
+    }
+
+    hev_free (dump.marks.entries);
+}
@@ -0,0 +1,103 @@
+/*
+ ============================================================================
+ Name        : hev-user-acct.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : User Accounting
+ ============================================================================
+ */
+
+#ifndef __HEV_USER_ACCT_H__
+#define __HEV_USER_ACCT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "hev-auth-file.h"
+#include "hev-socks5-user-mark.h"
+
+typedef struct _HevUserAcct HevUserAcct;
+typedef struct _HevUserAcctMeter HevUserAcctMeter;
+
+struct _HevUserAcctMeter
+{
+    uint64_t bytes_up;
+    uint64_t bytes_down;
+    int64_t time;
+};
+
+/**
+ * hev_user_acct_new:
+ *
+ * Create a per-worker accounting shard. It is only used by the thread of
+ * its worker, so samples are added without atomics.
+ *
+ * Returns: returns user acct on successful, otherwise returns %NULL.
+ *
+ * Since: 2.14
+ */
+HevUserAcct *hev_user_acct_new (void);
+
+/**
+ * hev_user_acct_destroy:
+ * @self: a #HevUserAcct
+ *
+ * Flush and destroy the shard.
+ *
+ * Since: 2.14
+ */
+void hev_user_acct_destroy (HevUserAcct *self);
+
+/**
+ * hev_user_acct_meter_init:
+ * @meter: a #HevUserAcctMeter
+ *
+ * Start metering a session from now.
+ *
+ * Since: 2.14
+ */
+void hev_user_acct_meter_init (HevUserAcctMeter *meter);
+
+/**
+ * hev_user_acct_sample:
+ * @self: a #HevUserAcct
+ * @user: the user of the session
+ * @meter: the meter of the session
+ * @fd: the client TCP socket, or -1
+ * @done: whether the session has ended
+ *
+ * Add the traffic and time of a session since its last sample. Bytes are
+ * read from the kernel counters of @fd, the relay is not touched.
+ *
+ * Returns: returns 1 if the session had traffic since its last sample,
+ * otherwise returns 0.
+ *
+ * Since: 2.14
+ */
+int hev_user_acct_sample (HevUserAcct *self, HevSocks5UserMark *user,
+                          HevUserAcctMeter *meter, int fd, int done);
+
+/**
+ * hev_user_acct_flush:
+ * @self: a #HevUserAcct
+ *
+ * Merge the shard into the totals of its users, one atomic add per counter
+ * and user, and empty it.
+ *
+ * Since: 2.14
+ */
+void hev_user_acct_flush (HevUserAcct *self);
+
+/**
+ * hev_user_acct_dump:
+ * @fp: output file
+ * @file: a #HevAuthFile
+ *
+ * Write the totals of every user with traffic, and the totals per mark.
+ * Reloads of @file must be held off meanwhile.
+ *
+ * Since: 2.14
+ */
+void hev_user_acct_dump (FILE *fp, HevAuthFile *file);
+
+#endif /* __HEV_USER_ACCT_H__ */
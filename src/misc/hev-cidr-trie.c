@@ -0,0 +1,350 @@
+/*
+ ============================================================================
+ Name        : hev-cidr-trie.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : CIDR Radix Trie
+ ============================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "hev-cidr-trie.h"
+
+#define NODE_NONE (~0U)
+#define JUMP_BITS (16)
+#define JUMP_MIN_NODES (4096)
+
+struct _HevCidrTrieNode
+{
+    uint64_t key[2];
+    unsigned int child[2];
+    int value;
+    unsigned int len;
+};
+
+struct _HevCidrTrieJump
+{
+    unsigned int node;
+    int value;
+};
+
+static void
+key_load (uint64_t *key, const uint8_t *addr)
+{
+    int i;
+
+    key[0] = 0;
+    key[1] = 0;
+    for (i = 0; i < 16; i++)
+        key[i >> 3] = (key[i >> 3] << 8) | addr[i];
+}
+
+static void
+key_mask (uint64_t *key, unsigned int len)
+{
+    if (len < 64) {
+        key[0] &= len ? ~0ULL << (64 - len) : 0;
+        key[1] = 0;
+    } else if (len < 128) {
+        key[1] &= (len > 64) ? ~0ULL << (128 - len) : 0;
+    }
+}
+
+static unsigned int
+key_bit (const uint64_t *key, unsigned int pos)
+{
+    return (key[pos >> 6] >> (63 - (pos & 63))) & 1;
+}
+
+/* Number of leading bits two keys share, up to @max. */
+static unsigned int
+key_common (const uint64_t *a, const uint64_t *b, unsigned int max)
+{
+    unsigned int len;
+    uint64_t x;
+
+    x = a[0] ^ b[0];
+    if (x)
+        len = __builtin_clzll (x);
+    else if ((x = a[1] ^ b[1]))
+        len = 64 + __builtin_clzll (x);
+    else
+        len = 128;
+
+    return (len < max) ? len : max;
+}
+
+static unsigned int
+hev_cidr_trie_node_new (HevCidrTrie *self, const uint64_t *key,
+                        unsigned int len, int value)
+{
+    HevCidrTrieNode *n;
+
+    if (self->num == self->max) {
+        unsigned int max = self->max ? self->max * 2 : 64;
+
+        n = realloc (self->nodes, sizeof (HevCidrTrieNode) * max);
+        if (!n)
+            return NODE_NONE;
+
+        self->nodes = n;
+        self->max = max;
+    }
+
+    n = &self->nodes[self->num];
+    n->key[0] = key[0];
+    n->key[1] = key[1];
+    key_mask (n->key, len);
+    n->len = len;
+    n->value = value;
+    n->child[0] = NODE_NONE;
+    n->child[1] = NODE_NONE;
+
+    return self->num++;
+}
+
+void
+hev_cidr_trie_init (HevCidrTrie *self)
+{
+    self->root = NODE_NONE;
+    self->num = 0;
+    self->max = 0;
+    self->nodes = NULL;
+    self->jump = NULL;
+}
+
+void
+hev_cidr_trie_fini (HevCidrTrie *self)
+{
+    free (self->nodes);
+    free (self->jump);
+    hev_cidr_trie_init (self);
+}
+
+int
+hev_cidr_trie_insert (HevCidrTrie *self, const uint8_t *addr,
+                      unsigned int plen, int value)
+{
+    unsigned int parent = NODE_NONE;
+    unsigned int branch = 0;
+    unsigned int idx;
+    unsigned int top;
+    uint64_t key[2];
+
+    if (plen > 128 || value < 0)
+        return -1;
+
+    key_load (key, addr);
+    key_mask (key, plen);
+
+    /* Links are kept as (parent, branch), the array moves on growth. */
+    for (idx = self->root; idx != NODE_NONE;) {
+        HevCidrTrieNode *n = &self->nodes[idx];
+        unsigned int common;
+
+        common = key_common (key, n->key, (plen < n->len) ? plen : n->len);
+        if (common != n->len)
+            break;
+
+        if (plen == n->len) {
+            n->value = value;
+            return 0;
+        }
+
+        parent = idx;
+        branch = key_bit (key, n->len);
+        idx = n->child[branch];
+    }
+
+    if (idx == NODE_NONE) {
+        top = hev_cidr_trie_node_new (self, key, plen, value);
+        if (top == NODE_NONE)
+            return -1;
+    } else {
+        const uint64_t *nkey = self->nodes[idx].key;
+        unsigned int common;
+
+        /* The node diverges from the key, split its edge. */
+        common = key_common (key, nkey, plen);
+        if (common == plen) {
+            top = hev_cidr_trie_node_new (self, key, plen, value);
+            if (top == NODE_NONE)
+                return -1;
+        } else {
+            unsigned int leaf;
+
+            top = hev_cidr_trie_node_new (self, key, common, -1);
+            if (top == NODE_NONE)
+                return -1;
+            leaf = hev_cidr_trie_node_new (self, key, plen, value);
+            if (leaf == NODE_NONE)
+                return -1;
+            self->nodes[top].child[key_bit (key, common)] = leaf;
+        }
+
+        nkey = self->nodes[idx].key;
+        self->nodes[top].child[key_bit (nkey, common)] = idx;
+    }
+
+    if (parent == NODE_NONE)
+        self->root = top;
+    else
+        self->nodes[parent].child[branch] = top;
+
+    return 0;
+}
+
+static int
+is_v4_mapped (const uint64_t *key)
+{
+    return key[0] == 0 && (key[1] >> 32) == 0xffff;
+}
+
+/* The path of a 16-bit slot, down to the first node longer than it. */
+static void
+hev_cidr_trie_jump_fill (HevCidrTrie *self, HevCidrTrieJump *jump,
+                         const uint64_t *key, unsigned int base)
+{
+    unsigned int idx = self->root;
+    int value = -1;
+
+    while (idx != NODE_NONE) {
+        const HevCidrTrieNode *n = &self->nodes[idx];
+
+        if (n->len >= (base + JUMP_BITS))
+            break;
+
+        if (key_common (key, n->key, n->len) != n->len) {
+            idx = NODE_NONE;
+            break;
+        }
+
+        if (n->value >= 0)
+            value = n->value;
+
+        idx = n->child[key_bit (key, n->len)];
+    }
+
+    jump->node = idx;
+    jump->value = value;
+}
+
+void
+hev_cidr_trie_seal (HevCidrTrie *self)
+{
+    unsigned int i;
+
+    if (self->num < JUMP_MIN_NODES || self->jump)
+        return;
+
+    self->jump = malloc (sizeof (HevCidrTrieJump) << (JUMP_BITS + 1));
+    if (!self->jump)
+        return;
+
+    /* IPv4 slots first, under ::ffff:0:0/96, then the IPv6 ones. */
+    for (i = 0; i < (1U << JUMP_BITS); i++) {
+        uint64_t key[2];
+
+        key[0] = 0;
+        key[1] = (0xffffULL << 32) | ((uint64_t)i << 16);
+        hev_cidr_trie_jump_fill (self, &self->jump[i], key, 96);
+
+        key[0] = (uint64_t)i << 48;
+        key[1] = 0;
+        hev_cidr_trie_jump_fill (self, &self->jump[i + (1U << JUMP_BITS)],
+                                 key, 0);
+    }
+}
+
+int
+hev_cidr_trie_lookup (const HevCidrTrie *self, const uint8_t *addr)
+{
+    unsigned int idx = self->root;
+    uint64_t key[2];
+    int value = -1;
+
+    key_load (key, addr);
+
+    if (self->jump) {
+        const HevCidrTrieJump *j;
+
+        if (is_v4_mapped (key))
+            j = &self->jump[(key[1] >> 16) & 0xffff];
+        else
+            j = &self->jump[(1U << JUMP_BITS) + (key[0] >> 48)];
+
+        idx = j->node;
+        value = j->value;
+    }
+
+    while (idx != NODE_NONE) {
+        const HevCidrTrieNode *n = &self->nodes[idx];
+
+        if (key_common (key, n->key, n->len) != n->len)
+            break;
+        if (n->value >= 0)
+            value = n->value;
+        if (n->len == 128)
+            break;
+
+        idx = n->child[key_bit (key, n->len)];
+    }
+
+    return value;
+}
+
+int
+hev_cidr_trie_parse (const char *str, unsigned int len, uint8_t *addr,
+                     unsigned int *plen)
+{
+    const char *slash;
+    char buf[64];
+    unsigned int max;
+    unsigned int alen;
+
+    slash = memchr (str, '/', len);
+    alen = slash ? slash - str : len;
+    if (alen >= sizeof (buf))
+        return -1;
+
+    memcpy (buf, str, alen);
+    buf[alen] = '\0';
+
+    memset (addr, 0, 16);
+    if (inet_pton (AF_INET, buf, addr + 12) == 1) {
+        addr[10] = 0xff;
+        addr[11] = 0xff;
+        max = 32;
+    } else if (inet_pton (AF_INET6, buf, addr) == 1) {
+        max = 128;
+    } else {
+        return -1;
+    }
+
+    *plen = max;
+    if (slash) {
+        const char *p = slash + 1;
+        const char *e = str + len;
+        unsigned int v = 0;
+
+        if (p == e || (e - p) > 3)
+            return -1;
+        for (; p < e; p++) {
+            if (*p < '0' || *p > '9')
+                return -1;
+            v = v * 10 + (*p - '0');
+        }
+        if (v > max)
+            return -1;
+        *plen = v;
+    }
+
+    /* IPv4 prefixes live under ::ffff:0:0/96. */
+    if (max == 32)
+        *plen += 96;
+
+    return 0;
+}
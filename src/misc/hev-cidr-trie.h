@@ -0,0 +1,117 @@
+/*
+ ============================================================================
+ Name        : hev-cidr-trie.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : CIDR Radix Trie
+ ============================================================================
+ */
+
+#ifndef __HEV_CIDR_TRIE_H__
+#define __HEV_CIDR_TRIE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevCidrTrie HevCidrTrie;
+typedef struct _HevCidrTrieNode HevCidrTrieNode;
+typedef struct _HevCidrTrieJump HevCidrTrieJump;
+
+struct _HevCidrTrie
+{
+    unsigned int root;
+    unsigned int num;
+    unsigned int max;
+
+    HevCidrTrieNode *nodes;
+    HevCidrTrieJump *jump;
+};
+
+/**
+ * hev_cidr_trie_init:
+ * @self: a #HevCidrTrie
+ *
+ * Initialize an empty trie. Keys are 128-bit, IPv4 prefixes are stored
+ * mapped into ::ffff:0:0/96.
+ *
+ * Since: 2.14
+ */
+void hev_cidr_trie_init (HevCidrTrie *self);
+
+/**
+ * hev_cidr_trie_fini:
+ * @self: a #HevCidrTrie
+ *
+ * Release the nodes of the trie.
+ *
+ * Since: 2.14
+ */
+void hev_cidr_trie_fini (HevCidrTrie *self);
+
+/**
+ * hev_cidr_trie_insert:
+ * @self: a #HevCidrTrie
+ * @addr: 16 bytes address in network order
+ * @plen: prefix length, up to 128
+ * @value: a non-negative value
+ *
+ * Insert a prefix, the value of an existing equal prefix is replaced. The
+ * trie is path compressed and kept in one array, so lookups never chase
+ * more nodes than there are distinct branch points on the path.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_cidr_trie_insert (HevCidrTrie *self, const uint8_t *addr,
+                          unsigned int plen, int value);
+
+/**
+ * hev_cidr_trie_seal:
+ * @self: a #HevCidrTrie
+ *
+ * Finish a trie, no more inserts are allowed. Large tries get a direct
+ * table on the first 16 bits of IPv4 and IPv6 addresses, which skips the
+ * top levels where most cache misses would be.
+ *
+ * Since: 2.14
+ */
+void hev_cidr_trie_seal (HevCidrTrie *self);
+
+/**
+ * hev_cidr_trie_lookup:
+ * @self: a #HevCidrTrie
+ * @addr: 16 bytes address in network order
+ *
+ * Find the longest prefix covering @addr. Nothing is allocated.
+ *
+ * Returns: returns the value of the match, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_cidr_trie_lookup (const HevCidrTrie *self, const uint8_t *addr);
+
+/**
+ * hev_cidr_trie_parse:
+ * @str: an address with an optional /prefix
+ * @len: length of @str
+ * @addr: (out): 16 bytes address in network order
+ * @plen: (out): prefix length
+ *
+ * Parse an IPv4 or IPv6 CIDR. A bare address is a full length prefix.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_cidr_trie_parse (const char *str, unsigned int len, uint8_t *addr,
+                         unsigned int *plen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_CIDR_TRIE_H__ */
@@ -0,0 +1,295 @@
+/*
+ ============================================================================
+ Name        : hev-domain-trie.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Domain Suffix Trie
+ ============================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hev-domain-trie.h"
+
+#define LABEL_MAX (255)
+
+/*
+ * Nodes are only indices, the children of all nodes are kept in one open
+ * addressing table keyed by (parent, label). Node 0 is the root and is
+ * never a child, so a zero child marks a free slot.
+ */
+struct _HevDomainTrieEdge
+{
+    unsigned int parent;
+    unsigned int child;
+    unsigned int hash;
+    unsigned int label;
+    unsigned int len;
+};
+
+static inline char
+lower (char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+static unsigned int
+label_hash (unsigned int parent, const char *label, unsigned int len)
+{
+    unsigned int hash = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)lower (label[i]);
+        hash *= 16777619U;
+    }
+
+    return hash ^ (parent * 0x9e3779b1U);
+}
+
+static int
+label_equal (const char *stored, const char *label, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++)
+        if (stored[i] != lower (label[i]))
+            return 0;
+
+    return 1;
+}
+
+/* Walk labels right to left, returns the length of the next one. */
+static unsigned int
+label_prev (const char *name, unsigned int *end)
+{
+    unsigned int beg = *end;
+
+    while (beg && name[beg - 1] != '.')
+        beg--;
+
+    return *end - beg;
+}
+
+static const HevDomainTrieEdge *
+hev_domain_trie_find (const HevDomainTrie *self, unsigned int parent,
+                      const char *label, unsigned int len, unsigned int hash)
+{
+    unsigned int i;
+
+    if (!self->table)
+        return NULL;
+
+    for (i = hash & self->mask;; i = (i + 1) & self->mask) {
+        const HevDomainTrieEdge *e = &self->table[i];
+
+        if (!e->child)
+            return NULL;
+        if (e->hash == hash && e->parent == parent && e->len == len &&
+            label_equal (&self->labels[e->label], label, len))
+            return e;
+    }
+}
+
+static int
+hev_domain_trie_grow (HevDomainTrie *self)
+{
+    HevDomainTrieEdge *table;
+    unsigned int size;
+    unsigned int i;
+
+    size = self->table ? (self->mask + 1) * 2 : 64;
+    table = calloc (size, sizeof (HevDomainTrieEdge));
+    if (!table)
+        return -1;
+
+    for (i = 0; self->table && i <= self->mask; i++) {
+        HevDomainTrieEdge *e = &self->table[i];
+        unsigned int j;
+
+        if (!e->child)
+            continue;
+
+        for (j = e->hash & (size - 1); table[j].child; j = (j + 1) & (size - 1))
+            ;
+        table[j] = *e;
+    }
+
+    free (self->table);
+    self->table = table;
+    self->mask = size - 1;
+
+    return 0;
+}
+
+static unsigned int
+hev_domain_trie_node_new (HevDomainTrie *self)
+{
+    if (self->num == self->max) {
+        unsigned int max = self->max ? self->max * 2 : 64;
+        int *values;
+
+        values = realloc (self->values, sizeof (int) * max);
+        if (!values)
+            return 0;
+
+        self->values = values;
+        self->max = max;
+    }
+
+    self->values[self->num] = -1;
+    return self->num++;
+}
+
+static unsigned int
+hev_domain_trie_add (HevDomainTrie *self, unsigned int parent,
+                     const char *label, unsigned int len, unsigned int hash)
+{
+    HevDomainTrieEdge *e;
+    unsigned int child;
+    unsigned int i;
+
+    if ((self->edges + 1) * 2 > (self->table ? self->mask + 1 : 0)) {
+        if (hev_domain_trie_grow (self) < 0)
+            return 0;
+    }
+
+    if ((self->labels_len + len) > self->labels_max) {
+        unsigned int max = self->labels_max ? self->labels_max * 2 : 1024;
+        char *labels;
+
+        while (max < (self->labels_len + len))
+            max *= 2;
+
+        labels = realloc (self->labels, max);
+        if (!labels)
+            return 0;
+
+        self->labels = labels;
+        self->labels_max = max;
+    }
+
+    child = hev_domain_trie_node_new (self);
+    if (!child)
+        return 0;
+
+    for (i = hash & self->mask; self->table[i].child; i = (i + 1) & self->mask)
+        ;
+
+    e = &self->table[i];
+    e->parent = parent;
+    e->child = child;
+    e->hash = hash;
+    e->label = self->labels_len;
+    e->len = len;
+
+    for (i = 0; i < len; i++)
+        self->labels[self->labels_len++] = lower (label[i]);
+    self->edges++;
+
+    return child;
+}
+
+void
+hev_domain_trie_init (HevDomainTrie *self)
+{
+    memset (self, 0, sizeof (HevDomainTrie));
+}
+
+void
+hev_domain_trie_fini (HevDomainTrie *self)
+{
+    free (self->values);
+    free (self->labels);
+    free (self->table);
+    hev_domain_trie_init (self);
+}
+
+int
+hev_domain_trie_insert (HevDomainTrie *self, const char *name,
+                        unsigned int len, int value)
+{
+    unsigned int node = 0;
+
+    if (value < 0)
+        return -1;
+
+    /* The root, it holds the value of the empty name. */
+    if (!self->num) {
+        hev_domain_trie_node_new (self);
+        if (!self->num)
+            return -1;
+    }
+
+    if (len && name[len - 1] == '.')
+        len--;
+
+    while (len) {
+        const HevDomainTrieEdge *e;
+        unsigned int llen;
+        unsigned int hash;
+        const char *label;
+
+        llen = label_prev (name, &len);
+        if (!llen || llen > LABEL_MAX)
+            return -1;
+
+        label = name + len - llen;
+        hash = label_hash (node, label, llen);
+        e = hev_domain_trie_find (self, node, label, llen, hash);
+        if (e) {
+            node = e->child;
+        } else {
+            node = hev_domain_trie_add (self, node, label, llen, hash);
+            if (!node)
+                return -1;
+        }
+
+        len -= llen;
+        if (len && --len == 0)
+            return -1;
+    }
+
+    self->values[node] = value;
+
+    return 0;
+}
+
+int
+hev_domain_trie_lookup (const HevDomainTrie *self, const char *name,
+                        unsigned int len)
+{
+    unsigned int node = 0;
+    int value;
+
+    if (!self->num)
+        return -1;
+
+    if (len && name[len - 1] == '.')
+        len--;
+
+    value = self->values[0];
+    while (len) {
+        const HevDomainTrieEdge *e;
+        unsigned int llen;
+        const char *label;
+
+        llen = label_prev (name, &len);
+        label = name + len - llen;
+        e = hev_domain_trie_find (self, node, label, llen,
+                                  label_hash (node, label, llen));
+        if (!e)
+            break;
+
+        node = e->child;
+        if (self->values[node] >= 0)
+            value = self->values[node];
+
+        len -= llen;
+        if (len)
+            len--;
+    }
+
+    return value;
+}
@@ -0,0 +1,91 @@
+/*
+ ============================================================================
+ Name        : hev-domain-trie.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Domain Suffix Trie
+ ============================================================================
+ */
+
+#ifndef __HEV_DOMAIN_TRIE_H__
+#define __HEV_DOMAIN_TRIE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevDomainTrie HevDomainTrie;
+typedef struct _HevDomainTrieEdge HevDomainTrieEdge;
+
+struct _HevDomainTrie
+{
+    unsigned int num;
+    unsigned int max;
+    unsigned int mask;
+    unsigned int edges;
+    unsigned int labels_len;
+    unsigned int labels_max;
+
+    int *values;
+    char *labels;
+    HevDomainTrieEdge *table;
+};
+
+/**
+ * hev_domain_trie_init:
+ * @self: a #HevDomainTrie
+ *
+ * Initialize an empty trie. Names are split into labels and stored from
+ * the top level down, so a name covers itself and all of its subdomains.
+ *
+ * Since: 2.14
+ */
+void hev_domain_trie_init (HevDomainTrie *self);
+
+/**
+ * hev_domain_trie_fini:
+ * @self: a #HevDomainTrie
+ *
+ * Release the nodes of the trie.
+ *
+ * Since: 2.14
+ */
+void hev_domain_trie_fini (HevDomainTrie *self);
+
+/**
+ * hev_domain_trie_insert:
+ * @self: a #HevDomainTrie
+ * @name: a domain name, case insensitive
+ * @len: length of @name
+ * @value: a non-negative value
+ *
+ * Insert a name, the value of an existing equal name is replaced.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_domain_trie_insert (HevDomainTrie *self, const char *name,
+                            unsigned int len, int value);
+
+/**
+ * hev_domain_trie_lookup:
+ * @self: a #HevDomainTrie
+ * @name: a domain name, case insensitive
+ * @len: length of @name
+ *
+ * Find the longest suffix of @name on label boundaries. Nothing is
+ * allocated, each label costs one hash probe.
+ *
+ * Returns: returns the value of the match, otherwise returns -1.
+ *
+ * Since: 2.14
+ */
+int hev_domain_trie_lookup (const HevDomainTrie *self, const char *name,
+                            unsigned int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_DOMAIN_TRIE_H__ */
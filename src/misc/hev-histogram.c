@@ -0,0 +1,89 @@
+/*
+ ============================================================================
+ Name        : hev-histogram.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Log2 Histogram
+ ============================================================================
+ */
+
+#include "hev-compiler.h"
+
+#include "hev-histogram.h"
+
+void
+hev_histogram_add (HevHistogram *self, unsigned long value)
+{
+    unsigned int i = 0;
+
+    if (value)
+        i = sizeof (long) * 8 - __builtin_clzl (value);
+    if (i >= HEV_HISTOGRAM_BUCKETS)
+        i = HEV_HISTOGRAM_BUCKETS - 1;
+
+    WRITE_ONCE (self->buckets[i], self->buckets[i] + 1);
+}
+
+void
+hev_histogram_read (const HevHistogram *self, HevHistogram *dst)
+{
+    int i;
+
+    for (i = 0; i < HEV_HISTOGRAM_BUCKETS; i++)
+        dst->buckets[i] += READ_ONCE (self->buckets[i]);
+}
+
+static unsigned long
+hev_histogram_bound (int i)
+{
+    return 1UL << i;
+}
+
+static int
+hev_histogram_rank (const HevHistogram *self, unsigned long rank)
+{
+    unsigned long sum = 0;
+    int i;
+
+    for (i = 0; i < HEV_HISTOGRAM_BUCKETS - 1; i++) {
+        sum += self->buckets[i];
+        if (sum > rank)
+            break;
+    }
+
+    return i;
+}
+
+void
+hev_histogram_write (const HevHistogram *self, FILE *fp, const char *prefix)
+{
+    static const unsigned int pcts[] = { 50, 90, 99 };
+    unsigned long count = 0;
+    int i;
+
+    for (i = 0; i < HEV_HISTOGRAM_BUCKETS; i++)
+        count += self->buckets[i];
+
+    fprintf (fp, "%s.count %lu\n", prefix, count);
+    if (!count)
+        return;
+
+    /* Upper bounds of the buckets, the last one has none. */
+    for (i = 0; i < sizeof (pcts) / sizeof (pcts[0]); i++) {
+        int b = hev_histogram_rank (self, count * pcts[i] / 100);
+
+        if (b < HEV_HISTOGRAM_BUCKETS - 1)
+            fprintf (fp, "%s.p%u %lu\n", prefix, pcts[i],
+                     hev_histogram_bound (b));
+        else
+            fprintf (fp, "%s.p%u inf\n", prefix, pcts[i]);
+    }
+
+    for (i = 0; i < HEV_HISTOGRAM_BUCKETS - 1; i++) {
+        if (self->buckets[i])
+            fprintf (fp, "%s.lt-%lu %lu\n", prefix, hev_histogram_bound (i),
+                     self->buckets[i]);
+    }
+    if (self->buckets[i])
+        fprintf (fp, "%s.inf %lu\n", prefix, self->buckets[i]);
+}
@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : hev-histogram.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Log2 Histogram
+ ============================================================================
+ */
+
+#ifndef __HEV_HISTOGRAM_H__
+#define __HEV_HISTOGRAM_H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_HISTOGRAM_BUCKETS (24)
+
+typedef struct _HevHistogram HevHistogram;
+
+struct _HevHistogram
+{
+    unsigned long buckets[HEV_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * hev_histogram_add:
+ * @self: a #HevHistogram
+ * @value: a sample
+ *
+ * Count @value in the bucket of its bit width: bucket n holds the values
+ * below 2^n, and the last one everything above. Only the owner thread may
+ * add, other threads read with hev_histogram_read().
+ *
+ * Since: 2.14
+ */
+void hev_histogram_add (HevHistogram *self, unsigned long value);
+
+/**
+ * hev_histogram_read:
+ * @self: a #HevHistogram
+ * @dst: the histogram to add @self to
+ *
+ * Add the counts of @self, which may be updated concurrently, to @dst.
+ *
+ * Since: 2.14
+ */
+void hev_histogram_read (const HevHistogram *self, HevHistogram *dst);
+
+/**
+ * hev_histogram_write:
+ * @self: a #HevHistogram
+ * @fp: a stream
+ * @prefix: the key prefix
+ *
+ * Write the sample count, the p50, p90 and p99 bucket bounds and the
+ * non-empty buckets as "key value" lines.
+ *
+ * Since: 2.14
+ */
+void hev_histogram_write (const HevHistogram *self, FILE *fp,
+                          const char *prefix);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_HISTOGRAM_H__ */
@@ -7,10 +7,21 @@
  ============================================================================
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+#include <linux/filter.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <net/if.h>
 #include <sys/resource.h>
 
@@ -148,3 +159,221 @@ set_sock_mark (int fd, unsigned int mark)
 #endif
     return 0;
 }
+
+int
+set_sock_pacing_rate (int fd, unsigned int rate)
+{
+#if defined(SO_MAX_PACING_RATE)
+    return setsockopt (fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate,
+                       sizeof (rate));
+#endif
+    return 0;
+}
+
+int
+set_sock_bind_no_port (int fd)
+{
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+    int one = 1;
+
+    return setsockopt (fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one,
+                       sizeof (one));
+#endif
+    return 0;
+}
+
+int
+set_sock_freebind (int fd)
+{
+#if defined(IP_FREEBIND)
+    int one = 1;
+
+    return setsockopt (fd, IPPROTO_IP, IP_FREEBIND, &one, sizeof (one));
+#endif
+    return -1;
+}
+
+int
+set_sock_incoming_cpu (int fd, int cpu)
+{
+#if defined(SO_INCOMING_CPU)
+    return setsockopt (fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof (cpu));
+#endif
+    return 0;
+}
+
+int
+set_sock_reuseport_steering (int fd, const int *cpus, int num, int socks)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter *code;
+    struct sock_fprog prog;
+    int res;
+    int i;
+    int n;
+
+    /*
+     * A = cpu; if (A == cpus[i]) return i + num * (random % k); ...;
+     * return A % socks. Worker w is pinned to cpus[w % num], so the k
+     * workers sharing a cpu are spread at random, never left idle. The
+     * returned index selects the socket in the reuseport group, which is
+     * the listen order of the workers.
+     */
+    prog.len = num * 6 + 3;
+    if (prog.len > BPF_MAXINSNS)
+        return -1;
+
+    code = calloc (prog.len, sizeof (struct sock_filter));
+    if (!code)
+        return -1;
+
+    n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT (BPF_LD | BPF_W | BPF_ABS,
+                                              SKF_AD_OFF + SKF_AD_CPU);
+    for (i = 0; i < num; i++) {
+        int k = (i < socks) ? (socks - i + num - 1) / num : 1;
+
+        if (k == 1) {
+            code[n++] = (struct sock_filter)BPF_JUMP (
+                BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1);
+            code[n++] =
+                (struct sock_filter)BPF_STMT (BPF_RET | BPF_K, i % socks);
+            continue;
+        }
+
+        code[n++] = (struct sock_filter)BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,
+                                                  cpus[i], 0, 5);
+        code[n++] = (struct sock_filter)BPF_STMT (BPF_LD | BPF_W | BPF_ABS,
+                                                  SKF_AD_OFF + SKF_AD_RANDOM);
+        code[n++] = (struct sock_filter)BPF_STMT (BPF_ALU | BPF_MOD | BPF_K, k);
+        code[n++] =
+            (struct sock_filter)BPF_STMT (BPF_ALU | BPF_MUL | BPF_K, num);
+        code[n++] = (struct sock_filter)BPF_STMT (BPF_ALU | BPF_ADD | BPF_K, i);
+        code[n++] = (struct sock_filter)BPF_STMT (BPF_RET | BPF_A, 0);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT (BPF_ALU | BPF_MOD | BPF_K, socks);
+    code[n++] = (struct sock_filter)BPF_STMT (BPF_RET | BPF_A, 0);
+    prog.len = n;
+
+    prog.filter = code;
+    res = setsockopt (fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                      sizeof (prog));
+    free (code);
+
+    return res;
+#endif
+    return -1;
+}
+
+int
+get_allowed_cpus (int *cpus, int max)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    int res;
+    int i;
+    int n;
+
+    res = sched_getaffinity (0, sizeof (set), &set);
+    if (res < 0)
+        return -1;
+
+    for (i = 0, n = 0; i < CPU_SETSIZE && n < max; i++) {
+        if (CPU_ISSET (i, &set))
+            cpus[n++] = i;
+    }
+
+    return n;
+#endif
+    return -1;
+}
+
+int
+set_thread_cpu_affinity (int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+
+    CPU_ZERO (&set);
+    CPU_SET (cpu, &set);
+    return sched_setaffinity (0, sizeof (set), &set);
+#endif
+    return -1;
+}
+
+int64_t
+get_thread_cpu_time (pthread_t thread)
+{
+#if defined(__linux__)
+    struct timespec ts;
+    clockid_t cid;
+    int res;
+
+    res = pthread_getcpuclockid (thread, &cid);
+    if (res != 0)
+        return -1;
+
+    res = clock_gettime (cid, &ts);
+    if (res < 0)
+        return -1;
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return -1;
+}
+
+int
+get_sock_idle_time (int fd)
+{
+#if defined(__linux__)
+    struct tcp_info info;
+    socklen_t len = sizeof (info);
+    int res;
+
+    res = getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    if (res < 0)
+        return -1;
+
+    if (info.tcpi_last_data_recv < info.tcpi_last_data_sent)
+        return info.tcpi_last_data_recv;
+    return info.tcpi_last_data_sent;
+#endif
+    return -1;
+}
+
+int64_t
+get_monotonic_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t
+get_monotonic_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+futex_wait (atomic_int *addr, int val)
+{
+#if defined(__linux__)
+    syscall (SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    if (atomic_load (addr) == val)
+        usleep (50);
+#endif
+}
+
+void
+futex_wake (atomic_int *addr)
+{
+#if defined(__linux__)
+    syscall (SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
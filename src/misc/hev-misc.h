@@ -10,6 +10,9 @@
 #ifndef __HEV_MISC_H__
 #define __HEV_MISC_H__
 
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <netinet/in.h>
 
 int hev_netaddr_resolve (struct sockaddr_in6 *daddr, const char *addr,
@@ -21,5 +24,25 @@ int set_limit_nofile (int limit_nofile);
 
 int set_sock_bind (int fd, const char *iface);
 int set_sock_mark (int fd, unsigned int mark);
+int set_sock_pacing_rate (int fd, unsigned int rate);
+int set_sock_bind_no_port (int fd);
+int set_sock_freebind (int fd);
+int set_sock_incoming_cpu (int fd, int cpu);
+int set_sock_reuseport_steering (int fd, const int *cpus, int num, int socks);
+int get_sock_idle_time (int fd);
+
+int get_allowed_cpus (int *cpus, int max);
+int set_thread_cpu_affinity (int cpu);
+int64_t get_thread_cpu_time (pthread_t thread);
+
+int64_t get_monotonic_ms (void);
+int64_t get_monotonic_us (void);
+
+/*
+ * Sleep while *addr is val, until a wake. Both are async-signal-safe.
+ * Without futexes the wait is a short sleep, callers loop anyway.
+ */
+void futex_wait (atomic_int *addr, int val);
+void futex_wake (atomic_int *addr);
 
 #endif /* __HEV_MISC_H__ */
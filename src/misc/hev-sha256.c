@@ -0,0 +1,250 @@
+/*
+ ============================================================================
+ Name        : hev-sha256.c
+ Authors     : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 everyone.
+ Description : SHA-256, HMAC and PBKDF2
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include "hev-sha256.h"
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void
+hev_sha256_block (HevSHA256 *self, const uint8_t *p)
+{
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t w[64];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+               ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+
+    for (i = 16; i < 64; i++) {
+        uint32_t s0, s1;
+
+        s0 = ROR (w[i - 15], 7) ^ ROR (w[i - 15], 18) ^ (w[i - 15] >> 3);
+        s1 = ROR (w[i - 2], 17) ^ ROR (w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = self->state[0];
+    b = self->state[1];
+    c = self->state[2];
+    d = self->state[3];
+    e = self->state[4];
+    f = self->state[5];
+    g = self->state[6];
+    h = self->state[7];
+
+    for (i = 0; i < 64; i++) {
+        uint32_t t1, t2;
+
+        t1 = h + (ROR (e, 6) ^ ROR (e, 11) ^ ROR (e, 25)) +
+             ((e & f) ^ (~e & g)) + k[i] + w[i];
+        t2 = (ROR (a, 2) ^ ROR (a, 13) ^ ROR (a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    self->state[0] += a;
+    self->state[1] += b;
+    self->state[2] += c;
+    self->state[3] += d;
+    self->state[4] += e;
+    self->state[5] += f;
+    self->state[6] += g;
+    self->state[7] += h;
+}
+
+void
+hev_sha256_init (HevSHA256 *self)
+{
+    self->state[0] = 0x6a09e667;
+    self->state[1] = 0xbb67ae85;
+    self->state[2] = 0x3c6ef372;
+    self->state[3] = 0xa54ff53a;
+    self->state[4] = 0x510e527f;
+    self->state[5] = 0x9b05688c;
+    self->state[6] = 0x1f83d9ab;
+    self->state[7] = 0x5be0cd19;
+    self->count = 0;
+}
+
+void
+hev_sha256_update (HevSHA256 *self, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    size_t used = self->count % HEV_SHA256_BLOCK;
+
+    self->count += size;
+
+    if (used) {
+        size_t n = HEV_SHA256_BLOCK - used;
+
+        if (n > size)
+            n = size;
+        memcpy (self->buf + used, p, n);
+        p += n;
+        size -= n;
+        if ((used + n) < HEV_SHA256_BLOCK)
+            return;
+        hev_sha256_block (self, self->buf);
+    }
+
+    for (; size >= HEV_SHA256_BLOCK; size -= HEV_SHA256_BLOCK) {
+        hev_sha256_block (self, p);
+        p += HEV_SHA256_BLOCK;
+    }
+
+    memcpy (self->buf, p, size);
+}
+
+void
+hev_sha256_final (HevSHA256 *self, uint8_t *digest)
+{
+    uint64_t bits = self->count * 8;
+    uint8_t pad[HEV_SHA256_BLOCK + 8] = { 0x80 };
+    size_t used = self->count % HEV_SHA256_BLOCK;
+    size_t n;
+    int i;
+
+    n = (used < 56) ? (56 - used) : (120 - used);
+    for (i = 0; i < 8; i++)
+        pad[n + i] = bits >> (56 - i * 8);
+    hev_sha256_update (self, pad, n + 8);
+
+    for (i = 0; i < 8; i++) {
+        digest[i * 4] = self->state[i] >> 24;
+        digest[i * 4 + 1] = self->state[i] >> 16;
+        digest[i * 4 + 2] = self->state[i] >> 8;
+        digest[i * 4 + 3] = self->state[i];
+    }
+}
+
+typedef struct _HevHMAC HevHMAC;
+
+struct _HevHMAC
+{
+    HevSHA256 inner;
+    HevSHA256 outer;
+};
+
+static void
+hev_hmac_init (HevHMAC *self, const void *key, size_t key_len)
+{
+    uint8_t pad[HEV_SHA256_BLOCK] = { 0 };
+    int i;
+
+    if (key_len > HEV_SHA256_BLOCK) {
+        HevSHA256 s;
+
+        hev_sha256_init (&s);
+        hev_sha256_update (&s, key, key_len);
+        hev_sha256_final (&s, pad);
+    } else {
+        memcpy (pad, key, key_len);
+    }
+
+    for (i = 0; i < HEV_SHA256_BLOCK; i++)
+        pad[i] ^= 0x36;
+    hev_sha256_init (&self->inner);
+    hev_sha256_update (&self->inner, pad, HEV_SHA256_BLOCK);
+
+    for (i = 0; i < HEV_SHA256_BLOCK; i++)
+        pad[i] ^= 0x36 ^ 0x5c;
+    hev_sha256_init (&self->outer);
+    hev_sha256_update (&self->outer, pad, HEV_SHA256_BLOCK);
+}
+
+static void
+hev_hmac_final (HevHMAC *self, uint8_t *digest)
+{
+    uint8_t inner[HEV_SHA256_SIZE];
+
+    hev_sha256_final (&self->inner, inner);
+    hev_sha256_update (&self->outer, inner, HEV_SHA256_SIZE);
+    hev_sha256_final (&self->outer, digest);
+}
+
+void
+hev_hmac_sha256 (const void *key, size_t key_len, const void *data,
+                 size_t size, uint8_t *digest)
+{
+    HevHMAC hmac;
+
+    hev_hmac_init (&hmac, key, key_len);
+    hev_sha256_update (&hmac.inner, data, size);
+    hev_hmac_final (&hmac, digest);
+}
+
+void
+hev_pbkdf2_sha256 (const void *pass, size_t pass_len, const void *salt,
+                   size_t salt_len, unsigned int rounds, uint8_t *out,
+                   size_t out_len)
+{
+    HevHMAC base;
+    uint32_t block;
+
+    /* The keyed pads are hashed once and copied for every round. */
+    hev_hmac_init (&base, pass, pass_len);
+
+    for (block = 1; out_len; block++) {
+        uint8_t u[HEV_SHA256_SIZE];
+        uint8_t t[HEV_SHA256_SIZE];
+        uint8_t be[4];
+        unsigned int r;
+        HevHMAC hmac;
+        size_t n;
+        int i;
+
+        be[0] = block >> 24;
+        be[1] = block >> 16;
+        be[2] = block >> 8;
+        be[3] = block;
+
+        hmac = base;
+        hev_sha256_update (&hmac.inner, salt, salt_len);
+        hev_sha256_update (&hmac.inner, be, sizeof (be));
+        hev_hmac_final (&hmac, u);
+        memcpy (t, u, HEV_SHA256_SIZE);
+
+        for (r = 1; r < rounds; r++) {
+            hmac = base;
+            hev_sha256_update (&hmac.inner, u, HEV_SHA256_SIZE);
+            hev_hmac_final (&hmac, u);
+            for (i = 0; i < HEV_SHA256_SIZE; i++)
+                t[i] ^= u[i];
+        }
+
+        n = (out_len < HEV_SHA256_SIZE) ? out_len : HEV_SHA256_SIZE;
+        memcpy (out, t, n);
+        out += n;
+        out_len -= n;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ ============================================================================
+ Name        : hev-sha256.h
+ Authors     : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 everyone.
+ Description : SHA-256, HMAC and PBKDF2
+ ============================================================================
+ */
+
+#ifndef __HEV_SHA256_H__
+#define __HEV_SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_SHA256_SIZE (32)
+#define HEV_SHA256_BLOCK (64)
+
+typedef struct _HevSHA256 HevSHA256;
+
+struct _HevSHA256
+{
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t buf[HEV_SHA256_BLOCK];
+};
+
+void hev_sha256_init (HevSHA256 *self);
+void hev_sha256_update (HevSHA256 *self, const void *data, size_t size);
+void hev_sha256_final (HevSHA256 *self, uint8_t *digest);
+
+void hev_hmac_sha256 (const void *key, size_t key_len, const void *data,
+                      size_t size, uint8_t *digest);
+
+void hev_pbkdf2_sha256 (const void *pass, size_t pass_len, const void *salt,
+                        size_t salt_len, unsigned int rounds, uint8_t *out,
+                        size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SHA256_H__ */
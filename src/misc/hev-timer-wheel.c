@@ -0,0 +1,124 @@
+/*
+ ============================================================================
+ Name        : hev-timer-wheel.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Hierarchical Timer Wheel
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include "hev-timer-wheel.h"
+
+#define MASK (HEV_TIMER_WHEEL_SLOTS - 1)
+#define SPAN(l) ((int64_t)1 << (HEV_TIMER_WHEEL_BITS * (l)))
+
+void
+hev_timer_wheel_init (HevTimerWheel *self, int tick, int64_t now)
+{
+    memset (self, 0, sizeof (HevTimerWheel));
+
+    self->tick = tick;
+    self->curr = now / tick;
+}
+
+static void
+hev_timer_wheel_link (HevTimerWheel *self, HevTimerWheelNode *node)
+{
+    int64_t tick;
+    int64_t delta;
+    int level;
+
+    tick = (node->expire + self->tick - 1) / self->tick;
+    if (tick < self->curr)
+        tick = self->curr;
+
+    delta = tick - self->curr;
+    if (delta >= SPAN (HEV_TIMER_WHEEL_LEVELS))
+        tick = self->curr + SPAN (HEV_TIMER_WHEEL_LEVELS) - 1;
+
+    for (level = 0; level < HEV_TIMER_WHEEL_LEVELS - 1; level++)
+        if (delta < SPAN (level + 1))
+            break;
+
+    tick >>= HEV_TIMER_WHEEL_BITS * level;
+    node->slot = &self->slots[level][tick & MASK];
+    hev_list_add_tail (node->slot, &node->node);
+}
+
+void
+hev_timer_wheel_add (HevTimerWheel *self, HevTimerWheelNode *node,
+                     int64_t expire)
+{
+    node->expire = expire;
+    hev_timer_wheel_link (self, node);
+}
+
+void
+hev_timer_wheel_del (HevTimerWheel *self, HevTimerWheelNode *node)
+{
+    if (!node->slot)
+        return;
+
+    hev_list_del (node->slot, &node->node);
+    node->slot = NULL;
+}
+
+static void
+hev_timer_wheel_cascade (HevTimerWheel *self)
+{
+    int level;
+
+    /* Pull down the upper slots whose span starts at the current tick. */
+    for (level = 1; level < HEV_TIMER_WHEEL_LEVELS; level++) {
+        HevListNode *node;
+        HevList *slot;
+        int64_t idx;
+
+        if (self->curr & (SPAN (level) - 1))
+            break;
+
+        idx = (self->curr >> (HEV_TIMER_WHEEL_BITS * level)) & MASK;
+        slot = &self->slots[level][idx];
+        while ((node = hev_list_first (slot))) {
+            HevTimerWheelNode *tn = (HevTimerWheelNode *)node;
+
+            hev_list_del (slot, node);
+            hev_timer_wheel_link (self, tn);
+        }
+    }
+}
+
+HevTimerWheelNode *
+hev_timer_wheel_pop (HevTimerWheel *self, int64_t now)
+{
+    int64_t tick = now / self->tick;
+
+    for (;;) {
+        HevListNode *node;
+        HevList *slot;
+
+        slot = &self->slots[0][self->curr & MASK];
+        while ((node = hev_list_first (slot))) {
+            HevTimerWheelNode *tn = (HevTimerWheelNode *)node;
+
+            hev_list_del (slot, node);
+            tn->slot = NULL;
+
+            /* Deadlines clamped to the horizon go around again. */
+            if (tn->expire > now) {
+                hev_timer_wheel_link (self, tn);
+                continue;
+            }
+
+            return tn;
+        }
+
+        if (self->curr >= tick)
+            return NULL;
+
+        self->curr++;
+        hev_timer_wheel_cascade (self);
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ ============================================================================
+ Name        : hev-timer-wheel.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Hierarchical Timer Wheel
+ ============================================================================
+ */
+
+#ifndef __HEV_TIMER_WHEEL_H__
+#define __HEV_TIMER_WHEEL_H__
+
+#include <stdint.h>
+
+#include "hev-list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_TIMER_WHEEL_BITS (6)
+#define HEV_TIMER_WHEEL_SLOTS (1 << HEV_TIMER_WHEEL_BITS)
+#define HEV_TIMER_WHEEL_LEVELS (3)
+
+typedef struct _HevTimerWheel HevTimerWheel;
+typedef struct _HevTimerWheelNode HevTimerWheelNode;
+
+struct _HevTimerWheel
+{
+    int64_t curr;
+    int tick;
+
+    HevList slots[HEV_TIMER_WHEEL_LEVELS][HEV_TIMER_WHEEL_SLOTS];
+};
+
+struct _HevTimerWheelNode
+{
+    HevListNode node;
+    HevList *slot;
+    int64_t expire;
+};
+
+/**
+ * hev_timer_wheel_init:
+ * @self: a #HevTimerWheel
+ * @tick: tick in milliseconds
+ * @now: current time in milliseconds
+ *
+ * Initialize an empty wheel. Deadlines are rounded up to whole ticks, and
+ * deadlines beyond 64^3 ticks fire early at the horizon.
+ *
+ * Since: 2.14
+ */
+void hev_timer_wheel_init (HevTimerWheel *self, int tick, int64_t now);
+
+/**
+ * hev_timer_wheel_add:
+ * @self: a #HevTimerWheel
+ * @node: an unlinked #HevTimerWheelNode
+ * @expire: deadline in milliseconds
+ *
+ * Arm a timer in O(1).
+ *
+ * Since: 2.14
+ */
+void hev_timer_wheel_add (HevTimerWheel *self, HevTimerWheelNode *node,
+                          int64_t expire);
+
+/**
+ * hev_timer_wheel_del:
+ * @self: a #HevTimerWheel
+ * @node: a #HevTimerWheelNode
+ *
+ * Disarm a timer in O(1). Unlinked nodes are ignored.
+ *
+ * Since: 2.14
+ */
+void hev_timer_wheel_del (HevTimerWheel *self, HevTimerWheelNode *node);
+
+/**
+ * hev_timer_wheel_pop:
+ * @self: a #HevTimerWheel
+ * @now: current time in milliseconds
+ *
+ * Advance the wheel up to @now and unlink one expired timer.
+ *
+ * Returns: an expired node, or NULL if none is due.
+ *
+ * Since: 2.14
+ */
+HevTimerWheelNode *hev_timer_wheel_pop (HevTimerWheel *self, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_TIMER_WHEEL_H__ */
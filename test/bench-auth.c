@@ -0,0 +1,143 @@
+/*
+ ============================================================================
+ Name        : bench-auth.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Load time and memory of user files and compiled images
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <hev-socks5-authenticator.h>
+
+#include "hev-misc.h"
+#include "hev-logger.h"
+#include "hev-auth-file.h"
+
+static long
+bench_rss (void)
+{
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static int
+bench_write (const char *path, int users)
+{
+    FILE *fp;
+    int i;
+
+    fp = fopen (path, "w");
+    if (!fp)
+        return -1;
+
+    for (i = 0; i < users; i++)
+        fprintf (fp, "user%08d pass%08d %d up=1m down=8m\n", i, i, i & 0xff);
+
+    return fclose (fp);
+}
+
+/*
+ * Loads @path into a new authenticator, then loads it again as a reload
+ * with no changes. Runs in a child, so the peak RSS is of this load only.
+ */
+static void
+bench_load (const char *kind, const char *path, int users)
+{
+    HevSocks5Authenticator *auth;
+    HevAuthFile *file;
+    int64_t load;
+    int64_t reload;
+    long rss;
+
+    rss = bench_rss ();
+
+    auth = hev_socks5_authenticator_new ();
+    file = hev_auth_file_new (auth);
+    if (!auth || !file)
+        exit (1);
+
+    load = get_monotonic_us ();
+    if (hev_auth_file_diff (file, path) < 0)
+        exit (1);
+    if (hev_auth_file_apply (file) < 0)
+        exit (1);
+    hev_auth_file_release (file);
+    load = get_monotonic_us () - load;
+
+    reload = get_monotonic_us ();
+    if (hev_auth_file_diff (file, path) < 0)
+        exit (1);
+    if (hev_auth_file_apply (file) < 0)
+        exit (1);
+    hev_auth_file_release (file);
+    reload = get_monotonic_us () - reload;
+
+    printf ("%-6s %9d %10lld %10lld %12ld\n", kind, users,
+            (long long)load / 1000, (long long)reload / 1000,
+            bench_rss () - rss);
+    exit (0);
+}
+
+static int
+bench_run (const char *kind, const char *path, int users)
+{
+    pid_t pid;
+    int status;
+
+    fflush (stdout);
+    pid = fork ();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+        bench_load (kind, path, users);
+
+    if (waitpid (pid, &status, 0) < 0)
+        return -1;
+
+    return (WIFEXITED (status) && !WEXITSTATUS (status)) ? 0 : -1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const int counts[] = { 10000, 100000, 1000000 };
+    int num = sizeof (counts) / sizeof (counts[0]);
+    char text[64];
+    char image[64];
+    int res = 0;
+    int i;
+
+    hev_logger_init (HEV_LOGGER_ERROR, "stderr");
+
+    snprintf (text, sizeof (text), "/tmp/bench-auth-%d.txt", getpid ());
+    snprintf (image, sizeof (image), "/tmp/bench-auth-%d.db", getpid ());
+
+    printf ("%-6s %9s %10s %10s %12s\n", "kind", "users", "load-ms",
+            "reload-ms", "peak-rss-kb");
+
+    for (i = 0; i < num && !res; i++) {
+        if (bench_write (text, counts[i]) < 0 ||
+            hev_auth_file_compile (text, image) < 0) {
+            fprintf (stderr, "auth file of %d users failed\n", counts[i]);
+            res = -1;
+            break;
+        }
+
+        res |= bench_run ("text", text, counts[i]);
+        res |= bench_run ("image", image, counts[i]);
+    }
+
+    unlink (text);
+    unlink (image);
+    hev_logger_fini ();
+
+    return res ? 1 : 0;
+}
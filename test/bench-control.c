@@ -0,0 +1,127 @@
+/*
+ ============================================================================
+ Name        : bench-control.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Fan-out latency of worker control messages
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "hev-misc.h"
+#include "hev-main.h"
+
+#define PORT (10879)
+#define ROUNDS (5)
+
+static int
+bench_ready (void)
+{
+    struct sockaddr_in addr = { 0 };
+    int i;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (PORT);
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    for (i = 0; i < 5000; i++) {
+        int fd = socket (AF_INET, SOCK_STREAM, 0);
+        int res;
+
+        res = connect (fd, (struct sockaddr *)&addr, sizeof (addr));
+        close (fd);
+        if (res == 0)
+            return 0;
+        usleep (1000);
+    }
+
+    return -1;
+}
+
+static void *
+bench_server (void *data)
+{
+    const char *conf = data;
+
+    hev_socks5_server_main_from_str ((const unsigned char *)conf,
+                                     strlen (conf));
+    return NULL;
+}
+
+/*
+ * Time from hev_socks5_server_quit() until the server returns, which is
+ * the stop reaching every worker and every worker thread being joined.
+ */
+static int64_t
+bench_stop (int workers)
+{
+    pthread_t thread;
+    char conf[256];
+    int64_t begin;
+
+    snprintf (conf, sizeof (conf),
+              "main:\n"
+              "  workers: %d\n"
+              "  port: %d\n"
+              "  listen-address: '127.0.0.1'\n"
+              "misc:\n"
+              "  log-level: error\n",
+              workers, PORT);
+
+    if (pthread_create (&thread, NULL, bench_server, conf) != 0)
+        return -1;
+
+    if (bench_ready () < 0) {
+        hev_socks5_server_quit ();
+        pthread_join (thread, NULL);
+        return -1;
+    }
+
+    begin = get_monotonic_us ();
+    hev_socks5_server_quit ();
+    pthread_join (thread, NULL);
+
+    return get_monotonic_us () - begin;
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const int counts[] = { 1, 4, 16, 64 };
+    int num = sizeof (counts) / sizeof (counts[0]);
+    int i;
+
+    printf ("%8s %12s %12s\n", "workers", "stop-min-us", "stop-max-us");
+
+    for (i = 0; i < num; i++) {
+        int64_t min = INT64_MAX;
+        int64_t max = 0;
+        int r;
+
+        for (r = 0; r < ROUNDS; r++) {
+            int64_t us = bench_stop (counts[i]);
+
+            if (us < 0) {
+                fprintf (stderr, "server with %d workers failed\n",
+                         counts[i]);
+                return 1;
+            }
+            if (us < min)
+                min = us;
+            if (us > max)
+                max = us;
+        }
+
+        printf ("%8d %12lld %12lld\n", counts[i], (long long)min,
+                (long long)max);
+    }
+
+    return 0;
+}
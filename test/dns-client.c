@@ -0,0 +1,113 @@
+/*
+ ============================================================================
+ Name        : dns-client.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2024 hev
+ Description : Native DNS client test, run by dns-client.sh
+ ============================================================================
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include <hev-task.h>
+#include <hev-task-dns.h>
+#include <hev-task-system.h>
+
+#include "hev-dns-client.h"
+
+typedef struct _TestCase TestCase;
+
+struct _TestCase
+{
+    const char *name;
+    int error;
+    const char *addr;
+    unsigned int ttl;
+};
+
+static const TestCase cases[] = {
+    /* Truncated over UDP, answered over TCP. */
+    { "big.test", 0, "9.9.9.1", 60 },
+    /* The lower of the ttl and the minimum of the SOA record. */
+    { "nx.test", EAI_NONAME, NULL, 9 },
+    /* Followed by owner names, bounded by the lowest ttl of the chain. */
+    { "cname.test", 0, "5.6.7.8", 20 },
+    /* Addresses of names off the chain are no answer. */
+    { "stray.test", EAI_NODATA, NULL, 0 },
+};
+
+static int failed;
+
+/* Names of hev-misc go through the resolver of the server, not built here. */
+int
+hev_resolver_getaddrinfo (const char *node, const char *service,
+                          const struct addrinfo *hints, struct addrinfo **res)
+{
+    return hev_task_dns_getaddrinfo (node, service, hints, res);
+}
+
+static void
+test_entry (void *data)
+{
+    HevDnsClient *client = data;
+    int i;
+
+    for (i = 0; i < sizeof (cases) / sizeof (cases[0]); i++) {
+        const TestCase *c = &cases[i];
+        char addr[INET6_ADDRSTRLEN] = "-";
+        HevDnsCacheAnswer ans;
+        unsigned int ttl;
+        int res;
+
+        res = hev_dns_client_resolve (client, c->name, AF_INET, &ans, &ttl,
+                                      NULL);
+        if (res == 0)
+            inet_ntop (ans.family, ans.addr, addr, sizeof (addr));
+
+        if (res != c->error || ttl != c->ttl ||
+            (c->addr && strcmp (addr, c->addr) != 0)) {
+            printf ("FAIL %s: %d %s ttl %u\n", c->name, res, addr, ttl);
+            failed++;
+        } else {
+            printf ("ok   %s\n", c->name);
+        }
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevDnsClient *client;
+    HevTask *task;
+
+    if (argc < 2) {
+        fprintf (stderr, "usage: %s resolv.conf\n", argv[0]);
+        return 2;
+    }
+
+    if (hev_task_system_init () < 0)
+        return 2;
+
+    client = hev_dns_client_new (argv[1], "/dev/null");
+    if (!client)
+        return 2;
+
+    task = hev_task_new (-1);
+    if (!task)
+        return 2;
+
+    hev_task_run (task, test_entry, client);
+    hev_task_system_run ();
+
+    hev_dns_client_destroy (client);
+    hev_task_system_fini ();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Run the native DNS client test against the stub name server.
+#
+# usage: dns-client.sh test-binary [port]
+
+BIN=$1
+PORT=${2:-15353}
+DIR=$(mktemp -d)
+
+cat > $DIR/resolv.conf << END
+nameserver 127.0.0.1:$PORT
+options timeout:1 attempts:1
+END
+
+python3 $(dirname $0)/dns-stub.py $PORT &
+STUB=$!
+sleep 1
+
+$BIN $DIR/resolv.conf
+RES=$?
+
+kill $STUB
+rm -rf $DIR
+exit $RES
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+#
+# Stub name server for test/dns-client.c, on UDP and TCP of 127.0.0.1.
+#
+# usage: dns-stub.py port
+
+import socket
+import struct
+import sys
+import threading
+
+TYPE_A = 1
+TYPE_CNAME = 5
+TYPE_SOA = 6
+
+
+def wire(name):
+    labels = [l for l in name.split('.') if l]
+    return b''.join(bytes([len(l)]) + l.encode() for l in labels) + b'\0'
+
+
+def record(name, rtype, ttl, rdata):
+    return wire(name) + struct.pack('>HHIH', rtype, 1, ttl, len(rdata)) + rdata
+
+
+def soa(zone, ttl, minimum):
+    rdata = wire('ns.' + zone) + wire('host.' + zone)
+    rdata += struct.pack('>IIIII', 1, 3600, 600, 86400, minimum)
+    return record(zone, TYPE_SOA, ttl, rdata)
+
+
+def question(req):
+    off = 12
+    labels = []
+    while req[off]:
+        size = req[off]
+        labels.append(req[off + 1:off + 1 + size].decode())
+        off += 1 + size
+    qtype = struct.unpack('>H', req[off + 1:off + 3])[0]
+    return '.'.join(labels).lower(), qtype, req[12:off + 5]
+
+
+def reply(req, tcp):
+    name, qtype, qsec = question(req)
+    rcode = 0
+    flags = 0x8180
+    an = []
+    ns = []
+
+    if qtype != TYPE_A:
+        ns = [soa('test', 30, 9)]
+    elif name == 'big.test':
+        # Too big for a datagram, only answered over TCP.
+        if tcp:
+            an = [record(name, TYPE_A, 60, bytes([9, 9, 9, i]))
+                  for i in range(1, 64)]
+        else:
+            flags |= 0x0200
+    elif name == 'nx.test':
+        rcode = 3
+        ns = [soa('test', 30, 9)]
+    elif name == 'cname.test':
+        an = [record('decoy.test', TYPE_A, 300, bytes([6, 6, 6, 6])),
+              record(name, TYPE_CNAME, 20, wire('alias.test')),
+              record('alias.test', TYPE_CNAME, 40, wire('target.test')),
+              record('target.test', TYPE_A, 50, bytes([5, 6, 7, 8]))]
+    elif name == 'stray.test':
+        an = [record(name, TYPE_CNAME, 20, wire('target.test')),
+              record('decoy.test', TYPE_A, 300, bytes([6, 6, 6, 6]))]
+    else:
+        rcode = 3
+
+    hdr = req[:2] + struct.pack('>HHHHH', flags | rcode, 1, len(an),
+                                len(ns), 0)
+    return hdr + qsec + b''.join(an) + b''.join(ns)
+
+
+def serve_udp(port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('127.0.0.1', port))
+    while True:
+        req, addr = sock.recvfrom(512)
+        sock.sendto(reply(req, False), addr)
+
+
+def recv_full(conn, size):
+    buf = b''
+    while len(buf) < size:
+        data = conn.recv(size - len(buf))
+        if not data:
+            raise EOFError
+        buf += data
+    return buf
+
+
+def serve_tcp(port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(('127.0.0.1', port))
+    sock.listen(8)
+    while True:
+        conn, _ = sock.accept()
+        try:
+            size = struct.unpack('>H', recv_full(conn, 2))[0]
+            res = reply(recv_full(conn, size), True)
+            conn.sendall(struct.pack('>H', len(res)) + res)
+        except EOFError:
+            pass
+        conn.close()
+
+
+if __name__ == '__main__':
+    port = int(sys.argv[1])
+    threading.Thread(target=serve_udp, args=(port,), daemon=True).start()
+    serve_tcp(port)